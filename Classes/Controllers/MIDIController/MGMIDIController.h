@@ -8,9 +8,12 @@
 
 #import <Foundation/Foundation.h>
 #import "MGPart.h"
+#import "bass.h"
 
 @interface MGMIDIController : UIViewController {
     //UIView *_view;
+    NSData *_playbackData;   //Midi data BASS is playing from memory. Must outlive the stream
+    HSTREAM _playbackStream; //The stream playing _playbackData, or 0
 }
 //@property(nonatomic,retain) UIView *view;
 
@@ -24,6 +24,7 @@
 
 @interface MGMIDIController (Private)
 -(HSTREAM)initStream;
+-(void)freePlayback;
 -(void)testScale;
 -(void)testBachChorale;
 -(void)testMIDIFile;
@@ -37,6 +38,7 @@
 //@synthesize view = _view;
 
 -(void)dealloc {
+    [self freePlayback];
     [super dealloc];   
 }
 
@@ -239,8 +241,11 @@
     [midiFile transposeByAmount:INTERVAL_A4];
     //NSLog(@"%@", [midiFile description]);
     
-    NSString *tempFileName = [midiFile writeTemporaryMIDI];
-    HSTREAM stream=BASS_MIDI_StreamCreateFile(FALSE, [tempFileName UTF8String], 0, 0, 0, 44100);
+    //Play from memory, instead of writing a temporary file
+    [self freePlayback];
+    _playbackData = [[midiFile midiData] retain];
+    _playbackStream = BASS_MIDI_StreamCreateFile(TRUE, [_playbackData bytes], 0, [_playbackData length], 0, 44100);
+    HSTREAM stream = _playbackStream;
     if (BASS_ErrorGetCode()) {
     NSLog(@"Bass error: %i", BASS_ErrorGetCode());
     }
@@ -296,6 +301,16 @@
     return stream;
 }
 
+//Stop the stream playing from memory, then release the data it was reading
+-(void)freePlayback {
+    if (_playbackStream) {
+        BASS_StreamFree(_playbackStream);
+        _playbackStream = 0;
+    }
+    [_playbackData release];
+    _playbackData = nil;
+}
+
 -(void)initFonts {
     
 }
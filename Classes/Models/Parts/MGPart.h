@@ -10,10 +10,14 @@
 #import "MGChord.h"
 #import "MGTimeSignature.h"
 
+@class MGScoreSnapshot;
+
 /* A part contains a string of notes/chords. It is a single instrument. */
 @interface MGPart : NSObject {
     NSMutableArray *_notesArray;
     MGTimeSignature *_timeSignature;
+    MGScoreSnapshot *_snapshot;     /** The snapshot the notes come from, until they're made */
+    int _snapshotPart;              /** The part number within the snapshot */
     //track number?
 }
 @property(nonatomic,assign) NSMutableArray *notesArray;
@@ -25,6 +29,12 @@
 -(id)initWithCapacity: (NSInteger)capacity;
 -(id)initWithTimeSignature:(MGTimeSignature *)timeSignature;
 -(id)initWithMidiEventArray:(Array *)array;
+-(id)initWithMidiEventArray:(Array *)array 
+                 andOverlap:(int)overlap 
+                andDangling:(int)dangling;
+-(id)initWithSnapshot:(MGScoreSnapshot *)snapshot
+                 part:(int)part
+     andTimeSignature:(MGTimeSignature *)timeSignature;
 
 -(void)add:             (void*) chord;
 -(MGNote *)getNote:     (NSInteger)index; 
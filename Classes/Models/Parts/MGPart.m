@@ -9,10 +9,7 @@
 #import "MGPart.h"
 #import "MGNote.h"
 #import "MidiFile.h"
-
-@interface MGPart (Private)
--(void)noteOffMidiEvent:(MidiEvent *)midiEvent;
-@end
+#import "MGScoreSnapshot.h"
 
 @implementation MGPart
 @synthesize notesArray    = _notesArray;
@@ -22,6 +19,7 @@
 #pragma mark Initialization
 -(void)dealloc {
     //autoreleased? [array release];
+    [_snapshot release];
     [super dealloc];   
 }
 
@@ -30,11 +28,10 @@
      andTimeSignature:(MGTimeSignature *)timeSignature {
     
     if (self = [super init]) {
-       self.notesArray = [[NSMutableArray alloc]initWithCapacity:1]; 
         if (capacity == 0) {
             capacity = 1;
         }
-        self.notesArray = [NSMutableArray arrayWithCapacity:capacity];
+        self.notesArray = [[NSMutableArray alloc]initWithCapacity:capacity];
         
         if (timeSignature == nil) {
             self.timeSignature = [MGTimeSignature commonTime];
@@ -54,45 +51,97 @@
     return [self initWithCapacity:0 andTimeSignature:timeSignature];
 }
 
-/** Adds MidiNotes for every MidiEvent */
+/** Adds MGNotes for every NoteOn MidiEvent.  The NoteOn/NoteOff
+ events are matched up by a NotePairer, by channel and note number.
+ A NoteOn with velocity 0 counts as a NoteOff. */
 -(id)initWithMidiEventArray:(Array *)eventArray {
+    return [self initWithMidiEventArray:eventArray
+                             andOverlap:NoteOverlapLastOpened
+                            andDangling:NoteDanglingEndOfTrack];
+}
+
+-(id)initWithMidiEventArray:(Array *)eventArray
+                 andOverlap:(int)overlap
+                andDangling:(int)dangling {
     if (self = [super init]) {
-        self.notesArray = [[NSMutableArray alloc]initWithCapacity:0];
+        NotePairer *pairer = (NotePairer *)malloc(sizeof(NotePairer));
+        notePairerInit(pairer, overlap, dangling, [eventArray count] / 2);
+        int endTime = 0;
         for (int i = 0; i < [eventArray count]; i++) {
             MidiEvent *midiEvent = [eventArray get:i];
-            if ([midiEvent eventFlag] == EventNoteOn && [midiEvent velocity] >= 0)
-            {
-                //Init note and add to part
-                MGNote *note = [[MGNote alloc]initWithMidiEvent:midiEvent];
-                [self.notesArray addObject:note];
+            endTime = [midiEvent startTime];
+            if ([midiEvent eventFlag] == EventNoteOn && [midiEvent velocity] > 0) {
+                notePairerNoteOn(pairer, [midiEvent channel], [midiEvent notenumber],
+                                 [midiEvent velocity], [midiEvent startTime], i);
             }
-            else if ([midiEvent eventFlag] == EventNoteOff) {
-                [self noteOffMidiEvent:midiEvent];
+            else if ([midiEvent eventFlag] == EventNoteOn || 
+                     [midiEvent eventFlag] == EventNoteOff) {
+                notePairerNoteOff(pairer, [midiEvent channel], [midiEvent notenumber],
+                                  [midiEvent startTime]);
             }
         }
+        notePairerFinish(pairer, endTime);
+
+        self.notesArray = [[NSMutableArray alloc]initWithCapacity:pairer->count];
+        for (int i = 0; i < pairer->count; i++) {
+            PairedNote *paired = &pairer->notes[i];
+            if (paired->dropped) {
+                continue;
+            }
+            //Init note and add to part
+            MGNote *note = [[MGNote alloc]initWithMidiEvent:[eventArray get:paired->tag]];
+            note.duration = paired->duration;
+            [self.notesArray addObject:note];
+            [note release];
+        }
+        notePairerFree(pairer);
+        free(pairer);
     }
 
     return self;
 }
 
--(void)noteOffMidiEvent:(MidiEvent *)midiEvent {
-    if ([midiEvent eventFlag] != EventNoteOff) {
-        NSLog(@"noteOffMidiEvent: attempted with incorrect midiEvent");
-        return;
-    }
-    
-    for (int i = [self.notesArray count]-1; i >= 0; i--) {
-        MGNote* note = [self.notesArray objectAtIndex:i];
-        if ([note MIDIValue] == [midiEvent notenumber] && note.duration == 0) {
-            note.duration = [midiEvent startTime] - note.startTime;
-            return;
-        }
+/** A part whose notes are the given part of a snapshot.  The MGNotes
+ are made from the mapped notes the first time notesArray is read, so
+ opening a score from its snapshot doesn't allocate a note until a
+ part is used.  The snapshot is kept (and mapped) until then. */
+-(id)initWithSnapshot:(MGScoreSnapshot *)snapshot
+                 part:(int)part
+     andTimeSignature:(MGTimeSignature *)timeSignature {
+    if (self = [super init]) {
+        _snapshot = [snapshot retain];
+        _snapshotPart = part;
+        self.timeSignature = timeSignature;
     }
+    return self;
 }
 
 #pragma mark
 #pragma mark Methods
 
+/** Return the notes, making them from the snapshot if needed */
+-(NSMutableArray *)notesArray {
+    if (_snapshot != nil) {
+        int count = [_snapshot parts][_snapshotPart].noteCount;
+        const MGSnapshotNote *notes = [_snapshot notesForPart:_snapshotPart];
+        _notesArray = [[NSMutableArray alloc]initWithCapacity:(count > 0 ? count : 1)];
+        for (int i = 0; i < count; i++) {
+            MGNote *note = [[MGNote alloc]init];
+            note.startTime = notes[i].startTime;
+            note.duration = notes[i].duration;
+            note.measureNumber = notes[i].measureNumber;
+            note.pitchClass = notes[i].pitchClass;
+            note.octave = notes[i].octave;
+            note.velocity = notes[i].velocity;
+            [_notesArray addObject:note];
+            [note release];
+        }
+        [_snapshot release];
+        _snapshot = nil;
+    }
+    return _notesArray;
+}
+
 //Play the entire part
 //-(void)play:(HSTREAM)astream{
 //    for (int i=0; i<[self count]; i++) {
@@ -120,6 +169,9 @@
 
 
 -(NSInteger)count {
+    if (_snapshot != nil) {
+        return [_snapshot parts][_snapshotPart].noteCount;
+    }
     return [self.notesArray count];
 }    
 
@@ -12,6 +12,8 @@
 #import "MGKeySignature.h"
 #import "MidiFile.h"
 
+@class MGScoreSnapshot;
+
 /* A part contains a string of notes/chords. It is a single instrument,
  voice, or piano (one or both hands) */
 @interface MGScore : NSObject {
@@ -24,7 +26,7 @@
     int _totalPulses;         /** The total length of the song, in pulses */
     BOOL trackPerChannel;    /** True if we've split each channel into a track */
 }
-@property(nonatomic,assign) NSString *fileName;
+@property(nonatomic,copy) NSString *fileName;
 @property(nonatomic,assign) NSMutableArray *partsArray;
 @property(nonatomic,assign) MGTimeSignature *timeSignature; //assign?
 @property(nonatomic,retain) MGKeySignature *keySignature;
@@ -42,6 +44,8 @@
 
 -(id)initWithMidiFile: (MidiFile *)midiFile;
 -(id)initWithFileName: (NSString *)fileName;
+-(id)initByParsingFileName: (NSString *)fileName;
+-(id)initWithSnapshot: (MGScoreSnapshot *)snapshot;
 
 /** Instance methods */
 -(int)totalMeasures; /** Returns total number of measures in the score */
@@ -8,6 +8,8 @@
 
 #import "MGScore.h"
 #import "MGNote.h"
+#import "MGScoreSnapshot.h"
+#import "MGScoreCache.h"
 
 @implementation MGScore
 @synthesize fileName        = _fileName;
@@ -21,6 +23,7 @@
 #pragma mark 
 #pragma mark Initialization
 -(void)dealloc {
+    [_fileName release];
     [self.partsArray release];
     [super dealloc];   
 }
@@ -84,10 +87,59 @@
     return self;
 }
 
-//Check to make sure this doesn't double init
+/** Rebuild a score from a snapshot, without parsing the Midi file.
+ The parts read their notes from the snapshot when first used. */
+-(id)initWithSnapshot:(MGScoreSnapshot *)snapshot {
+    if (self = [super init]) {
+        const MGSnapshotHeader *header = [snapshot header];
+        self.timeSignature = [[MGTimeSignature alloc]initWithNumerator:header->numerator
+                                                        andDenominator:header->denominator
+                                                            andQuarter:header->quarterNote
+                                                              andTempo:header->tempo];
+        self.totalPulses = header->totalPulses;
+        self.quarterNote = header->quarterNote;
+        self.trackMode = header->trackMode;
+        self.partsArray = [[NSMutableArray alloc]initWithCapacity:header->numParts];
+
+        for (int i = 0; i < header->numParts; i++) {
+            MGPart *part = [[MGPart alloc]initWithSnapshot:snapshot
+                                                      part:i
+                                          andTimeSignature:self.timeSignature];
+            [self.partsArray addObject:part];
+            [part release];
+        }
+
+        if (header->keyTonic >= 0) {
+            MGNote *tonic = [[MGNote alloc]initWithPitchClass:header->keyTonic];
+            MGKeySignature *key = [[MGKeySignature alloc]initMode:header->keyMode
+                                                        withTonic:tonic];
+            self.keySignature = key;
+            [key release];
+            [tonic release];
+        }
+    }
+    return self;
+}
+
+/** Return the score of the given Midi file.  Scores are shared through
+ the MGScoreCache, so a file that was opened before is not parsed again. */
 -(id)initWithFileName: (NSString *)fileName {
-        MidiFile *midiFile = [[MidiFile alloc]initWithFile:fileName];
-        return [self initWithMidiFile:midiFile];
+    MGScore *score = [[MGScoreCache sharedCache] scoreForFile:fileName];
+    [self release];
+    return [score retain];
+}
+
+/** Parse the Midi file, without looking in the cache */
+-(id)initByParsingFileName: (NSString *)fileName {
+    //The score only needs the notes, instruments, tempo and time signature
+    MidiLoadOptions options;
+    options.eventclasses = MidiEventClassDisplay;
+    options.channels = MidiChannelsAll;
+    options.tracks = nil;
+    options.overlap = NoteOverlapLastOpened;
+    options.dangling = NoteDanglingEndOfTrack;
+    MidiFile *midiFile = [[MidiFile alloc]initWithFile:fileName andOptions:&options];
+    return [self initWithMidiFile:midiFile];
 }
 
 #pragma mark
@@ -0,0 +1,55 @@
+//
+//  MGScoreCache.h
+//  MetroGnomeiPad
+//
+//  Copyright (c) 2012 Princeton University. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class MGScore;
+@class MGScoreSnapshot;
+
+/* The MGScoreCache keeps parsed scores, keyed by a hash of the Midi
+ file's bytes plus the parser and snapshot versions.  A renamed or
+ duplicated file maps to the same entry.
+
+ There are two tiers:
+ - memory: the mapped snapshots of the most recently used scores, up
+   to memoryCapacity.
+ - disk: .mgscore snapshots in the cache directory, evicted least
+   recently used first once they take more than byteBudget bytes.
+
+ Both tiers hold snapshots, which never change.  Each request gets a
+ new MGScore made from one (see MGScore initWithSnapshot:), with the
+ fileName it asked for, so callers never share a mutable MGScore.
+ */
+@interface MGScoreCache : NSObject {
+    NSString *_directory;               /** Where the snapshots are kept */
+    unsigned long long _byteBudget;     /** The most bytes of snapshots to keep */
+    NSUInteger _memoryCapacity;         /** The most scores to keep in memory */
+    NSMutableDictionary *_memorySnapshots; /** key -> MGScoreSnapshot */
+    NSMutableArray *_memoryOrder;       /** The keys in memory, least recently used first */
+    NSUInteger _memoryHits;
+    NSUInteger _diskHits;
+    NSUInteger _misses;
+}
+@property(nonatomic,readonly) NSUInteger memoryHits;
+@property(nonatomic,readonly) NSUInteger diskHits;
+@property(nonatomic,readonly) NSUInteger misses;
+
+/** Initialization functions */
+-(id)initWithDirectory:(NSString *)directory
+            byteBudget:(unsigned long long)byteBudget
+        memoryCapacity:(NSUInteger)memoryCapacity;
+
+/** Class methods */
++(MGScoreCache *)sharedCache;
++(NSString *)keyForFile:(NSString *)path;
+
+/** Instance methods */
+-(MGScore *)scoreForFile:(NSString *)path;
+-(void)evictToBudget;
+-(void)removeAllScores;
+
+@end
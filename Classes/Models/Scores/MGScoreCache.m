@@ -0,0 +1,212 @@
+//
+//  MGScoreCache.m
+//  MetroGnomeiPad
+//
+//  Copyright (c) 2012 Princeton University. All rights reserved.
+//
+
+#import "MGScoreCache.h"
+#import "MGScore.h"
+#import "MGScoreSnapshot.h"
+#include "MidiDecoder.h"
+
+#define DefaultByteBudget      (32 * 1024 * 1024)
+#define DefaultMemoryCapacity  8
+
+/** Return the 64-bit FNV-1a hash of the given bytes */
+static uint64_t fnv1a(const u_char *bytes, NSUInteger len) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (NSUInteger i = 0; i < len; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+@implementation MGScoreCache
+@synthesize memoryHits = _memoryHits;
+@synthesize diskHits   = _diskHits;
+@synthesize misses     = _misses;
+
+#pragma mark
+#pragma mark Initialization
+-(void)dealloc {
+    [_directory release];
+    [_memorySnapshots release];
+    [_memoryOrder release];
+    [super dealloc];
+}
+
+-(id)initWithDirectory:(NSString *)directory
+            byteBudget:(unsigned long long)byteBudget
+        memoryCapacity:(NSUInteger)memoryCapacity {
+    if (self = [super init]) {
+        _directory = [directory retain];
+        _byteBudget = byteBudget;
+        _memoryCapacity = memoryCapacity;
+        _memorySnapshots = [[NSMutableDictionary alloc]initWithCapacity:memoryCapacity];
+        _memoryOrder = [[NSMutableArray alloc]initWithCapacity:memoryCapacity];
+        [[NSFileManager defaultManager] createDirectoryAtPath:directory
+                                  withIntermediateDirectories:YES
+                                                   attributes:nil
+                                                        error:NULL];
+    }
+    return self;
+}
+
+#pragma mark
+#pragma mark Class methods
+
+/** The cache used by -[MGScore initWithFileName:] */
++(MGScoreCache *)sharedCache {
+    static MGScoreCache *sharedCache = nil;
+    static dispatch_once_t once;
+    dispatch_once(&once, ^{
+        sharedCache = [[MGScoreCache alloc]initWithDirectory:[MGScoreSnapshot cacheDirectory]
+                                                  byteBudget:DefaultByteBudget
+                                              memoryCapacity:DefaultMemoryCapacity];
+    });
+    return sharedCache;
+}
+
+/** Return the cache key of the given Midi file, or nil if it can't be read */
++(NSString *)keyForFile:(NSString *)path {
+    NSData *data = [NSData dataWithContentsOfFile:path
+                                          options:NSDataReadingMappedIfSafe
+                                            error:NULL];
+    if (data == nil) {
+        return nil;
+    }
+    uint64_t hash = fnv1a([data bytes], [data length]);
+    return [NSString stringWithFormat:@"%016llx-%d-%d",
+            (unsigned long long)hash, MidiDecoderVersion, MGSnapshotVersion];
+}
+
+#pragma mark
+#pragma mark Methods
+
+/** Make key the most recently used snapshot in memory, evicting the
+ least recently used ones past the memory capacity. */
+-(void)rememberSnapshot:(MGScoreSnapshot *)snapshot forKey:(NSString *)key {
+    [_memoryOrder removeObject:key];
+    [_memoryOrder addObject:key];
+    [_memorySnapshots setObject:snapshot forKey:key];
+    while ([_memoryOrder count] > _memoryCapacity) {
+        [_memorySnapshots removeObjectForKey:[_memoryOrder objectAtIndex:0]];
+        [_memoryOrder removeObjectAtIndex:0];
+    }
+}
+
+/** Return a new score for the given Midi file: from the snapshot in
+ memory, else from the snapshot on disk, else by parsing the file
+ (and writing a snapshot). */
+-(MGScore *)scoreForFile:(NSString *)path {
+    NSString *key = [MGScoreCache keyForFile:path];
+    if (key == nil) {
+        return [[[MGScore alloc]initByParsingFileName:path] autorelease];
+    }
+
+    MGScoreSnapshot *snapshot = nil;
+    @synchronized(self) {
+        snapshot = [[_memorySnapshots objectForKey:key] retain];
+        if (snapshot != nil) {
+            _memoryHits++;
+            [self rememberSnapshot:snapshot forKey:key];
+        }
+    }
+
+    MGScore *score = nil;
+    if (snapshot == nil) {
+        NSFileManager *fileManager = [NSFileManager defaultManager];
+        NSString *snapshotPath = [_directory stringByAppendingPathComponent:
+                                  [key stringByAppendingPathExtension:@"mgscore"]];
+        snapshot = [[MGScoreSnapshot alloc]initWithFile:snapshotPath];
+        if (snapshot != nil) {
+            /* The modification date orders the snapshots for eviction */
+            NSDictionary *attributes =
+                [NSDictionary dictionaryWithObject:[NSDate date] forKey:NSFileModificationDate];
+            [fileManager setAttributes:attributes ofItemAtPath:snapshotPath error:NULL];
+            @synchronized(self) {
+                _diskHits++;
+            }
+        }
+        else {
+            score = [[MGScore alloc]initByParsingFileName:path];
+            if ([MGScoreSnapshot writeScore:score toFile:snapshotPath]) {
+                snapshot = [[MGScoreSnapshot alloc]initWithFile:snapshotPath];
+            }
+            @synchronized(self) {
+                _misses++;
+            }
+            [self evictToBudget];
+        }
+        if (snapshot != nil) {
+            @synchronized(self) {
+                [self rememberSnapshot:snapshot forKey:key];
+            }
+        }
+    }
+
+    if (score == nil) {
+        score = [[MGScore alloc]initWithSnapshot:snapshot];
+    }
+    [snapshot release];
+    score.fileName = path;
+    return [score autorelease];
+}
+
+/** Delete the least recently used snapshots until they fit in the byte budget */
+-(void)evictToBudget {
+    @synchronized(self) {
+        NSFileManager *fileManager = [NSFileManager defaultManager];
+        NSArray *names = [fileManager contentsOfDirectoryAtPath:_directory error:NULL];
+        NSMutableArray *snapshots = [NSMutableArray arrayWithCapacity:[names count]];
+        unsigned long long total = 0;
+        for (NSString *name in names) {
+            if (![[name pathExtension] isEqualToString:@"mgscore"]) {
+                continue;
+            }
+            NSString *path = [_directory stringByAppendingPathComponent:name];
+            NSDictionary *attributes = [fileManager attributesOfItemAtPath:path error:NULL];
+            if (attributes == nil) {
+                continue;
+            }
+            total += [attributes fileSize];
+            [snapshots addObject:[NSArray arrayWithObjects:
+                                  [attributes fileModificationDate], path,
+                                  [NSNumber numberWithUnsignedLongLong:[attributes fileSize]], nil]];
+        }
+        if (total <= _byteBudget) {
+            return;
+        }
+        [snapshots sortUsingComparator:^NSComparisonResult(id a, id b) {
+            return [[a objectAtIndex:0] compare:[b objectAtIndex:0]];
+        }];
+        for (NSArray *snapshot in snapshots) {
+            if (total <= _byteBudget) {
+                break;
+            }
+            if ([fileManager removeItemAtPath:[snapshot objectAtIndex:1] error:NULL]) {
+                total -= [[snapshot objectAtIndex:2] unsignedLongLongValue];
+            }
+        }
+    }
+}
+
+/** Empty both tiers, and reset the counters */
+-(void)removeAllScores {
+    @synchronized(self) {
+        [_memorySnapshots removeAllObjects];
+        [_memoryOrder removeAllObjects];
+        NSFileManager *fileManager = [NSFileManager defaultManager];
+        for (NSString *name in [fileManager contentsOfDirectoryAtPath:_directory error:NULL]) {
+            if ([[name pathExtension] isEqualToString:@"mgscore"]) {
+                [fileManager removeItemAtPath:[_directory stringByAppendingPathComponent:name]
+                                        error:NULL];
+            }
+        }
+        _memoryHits = _diskHits = _misses = 0;
+    }
+}
+
+@end
@@ -0,0 +1,85 @@
+//
+//  MGScoreSnapshot.h
+//  MetroGnomeiPad
+//
+//  Copyright (c) 2012 Princeton University. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#include <stdint.h>
+
+@class MGScore;
+
+/* A .mgscore file is a snapshot of a fully derived MGScore: the notes
+ of every part, and the time and key signature.  It is laid out so
+ that it can be mmap'ed and used in place.  A score made from a
+ snapshot allocates one MGPart per part; the MGNotes of a part are
+ only made from the mapped notes when the part is first read.
+
+ Layout (native byte order, all offsets from the start of the file):
+   MGSnapshotHeader
+   MGSnapshotPart  parts[numParts]
+   MGSnapshotNote  notes[numNotes]            (all parts, part by part)
+ */
+
+#define MGSnapshotMagic    0x4353474D   /* "MGSC" */
+#define MGSnapshotVersion  2
+
+typedef struct _MGSnapshotHeader {
+    uint32_t magic;          /** MGSnapshotMagic */
+    uint32_t version;        /** MGSnapshotVersion */
+    uint32_t fileSize;       /** The size of the whole snapshot */
+    int32_t  trackMode;      /** The MGScore trackMode */
+    int32_t  quarterNote;    /** Pulses per quarter note */
+    int32_t  totalPulses;    /** The length of the song, in pulses */
+    int32_t  numerator;      /** The time signature */
+    int32_t  denominator;
+    int32_t  measure;        /** Pulses per measure */
+    int32_t  tempo;          /** Microseconds per quarter note */
+    int32_t  keyTonic;       /** The pitch class of the key's tonic, or -1 if none */
+    int32_t  keyMode;        /** KEY_SIG_MAJ or KEY_SIG_MIN */
+    int32_t  numParts;
+    int32_t  numNotes;
+    uint32_t partsOffset;
+    uint32_t notesOffset;
+} MGSnapshotHeader;
+
+typedef struct _MGSnapshotPart {
+    int32_t firstNote;       /** The index of the part's first note in notes[] */
+    int32_t noteCount;       /** The number of notes in the part */
+} MGSnapshotPart;
+
+typedef struct _MGSnapshotNote {
+    int32_t startTime;       /** In pulses */
+    int32_t duration;        /** In pulses */
+    int32_t measureNumber;
+    uint8_t pitchClass;      /** PITCH_CLASS_C, etc */
+    int8_t  octave;
+    uint8_t velocity;
+    uint8_t unused;
+} MGSnapshotNote;
+
+
+@interface MGScoreSnapshot : NSObject {
+    void *_map;                        /** The mmap'ed snapshot file */
+    size_t _mapLength;
+    const MGSnapshotHeader *_header;
+}
+
+/** Initialization functions.  Return nil if the file is missing,
+ damaged (including a part whose notes run past notes[]), or from
+ another snapshot version. */
+-(id)initWithFile:(NSString *)path;
+
+/** Class methods */
++(BOOL)writeScore:(MGScore *)score
+           toFile:(NSString *)path;
++(NSString *)cacheDirectory;
+
+/** Instance methods */
+-(const MGSnapshotHeader *)header;
+-(int)numParts;
+-(const MGSnapshotPart *)parts;
+-(const MGSnapshotNote *)notesForPart:(int)part;
+
+@end
@@ -0,0 +1,182 @@
+//
+//  MGScoreSnapshot.m
+//  MetroGnomeiPad
+//
+//  Copyright (c) 2012 Princeton University. All rights reserved.
+//
+
+#import "MGScoreSnapshot.h"
+#import "MGScore.h"
+#import "MGNote.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+@implementation MGScoreSnapshot
+
+#pragma mark
+#pragma mark Initialization
+-(void)dealloc {
+    if (_map != NULL) {
+        munmap(_map, _mapLength);
+    }
+    [super dealloc];
+}
+
+/** Map the snapshot file, and check that the header, the section
+ offsets and every part are consistent with the file size, so that
+ no later read goes outside the mapping. */
+-(id)initWithFile:(NSString *)path {
+    if (self = [super init]) {
+        int fd = open([path fileSystemRepresentation], O_RDONLY);
+        if (fd == -1) {
+            [self release];
+            return nil;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size < sizeof(MGSnapshotHeader)) {
+            close(fd);
+            [self release];
+            return nil;
+        }
+        _mapLength = info.st_size;
+        _map = mmap(NULL, _mapLength, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (_map == MAP_FAILED) {
+            _map = NULL;
+            [self release];
+            return nil;
+        }
+
+        /* The sizes are computed in 64 bits, so a damaged count can't
+         wrap around and pass the checks. */
+        const MGSnapshotHeader *header = (const MGSnapshotHeader *)_map;
+        if (header->magic != MGSnapshotMagic ||
+            header->version != MGSnapshotVersion ||
+            header->fileSize != _mapLength ||
+            header->numParts < 0 || header->numNotes < 0 ||
+            header->partsOffset % sizeof(int32_t) != 0 ||
+            header->notesOffset % sizeof(int32_t) != 0 ||
+            header->partsOffset < sizeof(MGSnapshotHeader) ||
+            header->notesOffset < sizeof(MGSnapshotHeader) ||
+            (uint64_t)header->partsOffset +
+                (uint64_t)header->numParts * sizeof(MGSnapshotPart) > _mapLength ||
+            (uint64_t)header->notesOffset +
+                (uint64_t)header->numNotes * sizeof(MGSnapshotNote) > _mapLength) {
+            [self release];
+            return nil;
+        }
+        const MGSnapshotPart *parts =
+            (const MGSnapshotPart *)((const u_char *)_map + header->partsOffset);
+        for (int p = 0; p < header->numParts; p++) {
+            if (parts[p].firstNote < 0 || parts[p].noteCount < 0 ||
+                (int64_t)parts[p].firstNote + parts[p].noteCount > header->numNotes) {
+                [self release];
+                return nil;
+            }
+        }
+        _header = header;
+    }
+    return self;
+}
+
+#pragma mark
+#pragma mark Class methods
+
+/** Return the directory for snapshots of Midi files we can't write
+ next to, like the ones in the app bundle.  Create it if needed. */
++(NSString *)cacheDirectory {
+    NSArray *pathList = NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES);
+    NSString *path = [[pathList objectAtIndex:0] stringByAppendingPathComponent:@"Scores"];
+    [[NSFileManager defaultManager] createDirectoryAtPath:path
+                              withIntermediateDirectories:YES
+                                               attributes:nil
+                                                    error:NULL];
+    return path;
+}
+
+/** Write a snapshot of the given score.  The snapshot is written to a
+ temporary file and renamed, so readers never see a partial snapshot. */
++(BOOL)writeScore:(MGScore *)score
+           toFile:(NSString *)path {
+    int numParts = [score.partsArray count];
+    int numNotes = 0;
+    for (int p = 0; p < numParts; p++) {
+        MGPart *part = [score.partsArray objectAtIndex:p];
+        numNotes += [part count];
+    }
+
+    MGSnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = MGSnapshotMagic;
+    header.version = MGSnapshotVersion;
+    header.trackMode = score.trackMode;
+    header.quarterNote = score.quarterNote;
+    header.totalPulses = score.totalPulses;
+    header.numerator = score.timeSignature.numerator;
+    header.denominator = score.timeSignature.denominator;
+    header.measure = score.timeSignature.measure;
+    header.tempo = score.timeSignature.tempo;
+    header.keyTonic = (score.keySignature != nil) ? score.keySignature.tonic.pitchClass : -1;
+    header.keyMode = (score.keySignature != nil) ? score.keySignature.mode : KEY_SIG_MAJ;
+    header.numParts = numParts;
+    header.numNotes = numNotes;
+    header.partsOffset = sizeof(MGSnapshotHeader);
+    header.notesOffset = header.partsOffset + numParts * sizeof(MGSnapshotPart);
+    header.fileSize = header.notesOffset + numNotes * sizeof(MGSnapshotNote);
+
+    NSMutableData *data = [[NSMutableData alloc] initWithLength:header.fileSize];
+    u_char *bytes = [data mutableBytes];
+    memcpy(bytes, &header, sizeof(header));
+    MGSnapshotPart *parts = (MGSnapshotPart *)(bytes + header.partsOffset);
+    MGSnapshotNote *notes = (MGSnapshotNote *)(bytes + header.notesOffset);
+
+    int noteIndex = 0;
+    for (int p = 0; p < numParts; p++) {
+        MGPart *part = [score.partsArray objectAtIndex:p];
+        int count = [part.notesArray count];
+        parts[p].firstNote = noteIndex;
+        parts[p].noteCount = count;
+        for (int i = 0; i < count; i++) {
+            MGNote *note = [part.notesArray objectAtIndex:i];
+            MGSnapshotNote *out = &notes[noteIndex + i];
+            out->startTime = note.startTime;
+            out->duration = note.duration;
+            out->measureNumber = note.measureNumber;
+            out->pitchClass = note.pitchClass;
+            out->octave = note.octave;
+            out->velocity = note.velocity;
+        }
+        noteIndex += count;
+    }
+
+    BOOL result = [data writeToFile:path atomically:YES];
+    [data release];
+    return result;
+}
+
+#pragma mark
+#pragma mark Methods
+
+-(const MGSnapshotHeader *)header {
+    return _header;
+}
+
+-(int)numParts {
+    return _header->numParts;
+}
+
+-(const MGSnapshotPart *)parts {
+    return (const MGSnapshotPart *)((const u_char *)_map + _header->partsOffset);
+}
+
+/** Return the notes of the given part, in start time order */
+-(const MGSnapshotNote *)notesForPart:(int)part {
+    assert(part >= 0 && part < _header->numParts);
+    const MGSnapshotNote *notes =
+        (const MGSnapshotNote *)((const u_char *)_map + _header->notesOffset);
+    return &notes[[self parts][part].firstNote];
+}
+
+@end
@@ -2093,7 +2093,7 @@ int sortbytime(void* v1, void* v2) {
 
     int pulses_per_second = (int) (1000000.0 / [timesig tempo] * [timesig quarter]);
     int minmeasure = pulses_per_second / 2; /* The minimum measure length in pulses */
-    int maxmeasure = pulses_per_second * 4; /* The maximum measure length in pulses *
+    int maxmeasure = pulses_per_second * 4; /* The maximum measure length in pulses */
 
     /* Get the start time of the first note in the midi file. */
     int firstnote = [timesig measure] * 5;
@@ -0,0 +1,46 @@
+//
+//  MGLibraryIndexer.h
+//  MetroGnomeiPad
+//
+//  Copyright (c) 2012 Princeton University. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/* The MGLibraryIndexer parses every Midi file under a directory, in
+ parallel, and writes a catalog with one tab-separated line per file:
+
+   path  tracks  instruments  pulses  seconds  time  key  notes  low  high
+
+ A file that fails to parse gets an ERROR line instead, and the rest
+ of the library is still indexed.
+
+ It is not part of the app; Tools/Makefile builds it, with
+ indexer_main(), as the indexer program for the iOS simulator
+ (make objc-tools).
+ */
+@interface MGLibraryIndexer : NSObject {
+    NSString *_directory;       /** The root of the library */
+    NSUInteger _numFiles;       /** The number of Midi files indexed */
+    NSUInteger _failures;       /** The number of files that failed to parse */
+    unsigned long long _bytes;  /** The total size of the Midi files */
+    double _elapsed;            /** The time taken to index, in seconds */
+}
+@property(nonatomic,readonly) NSUInteger numFiles;
+@property(nonatomic,readonly) NSUInteger failures;
+@property(nonatomic,readonly) unsigned long long bytes;
+@property(nonatomic,readonly) double elapsed;
+
+/** Initialization functions */
+-(id)initWithDirectory:(NSString *)directory;
+
+/** Instance methods */
+-(NSArray *)findMidiFiles;
+-(BOOL)writeCatalogToFile:(NSString *)catalogPath;
+
+/** Class methods */
++(NSString *)catalogLineForFile:(NSString *)path;
+
+@end
+
+int indexer_main(int argc, char **argv);
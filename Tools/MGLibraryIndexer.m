@@ -0,0 +1,190 @@
+//
+//  MGLibraryIndexer.m
+//  MetroGnomeiPad
+//
+//  Copyright (c) 2012 Princeton University. All rights reserved.
+//
+
+#import "MGLibraryIndexer.h"
+#import "MGScore.h"
+#import "MGNote.h"
+#import "MidiFile.h"
+#include <dispatch/dispatch.h>
+
+static const char *pitchClassNames[] = {
+    "C", "C#", "D", "Eb", "E", "F", "F#", "G", "Ab", "A", "Bb", "B"
+};
+
+@implementation MGLibraryIndexer
+@synthesize numFiles = _numFiles;
+@synthesize failures = _failures;
+@synthesize bytes    = _bytes;
+@synthesize elapsed  = _elapsed;
+
+#pragma mark
+#pragma mark Initialization
+-(void)dealloc {
+    [_directory release];
+    [super dealloc];
+}
+
+-(id)initWithDirectory:(NSString *)directory {
+    if (self = [super init]) {
+        _directory = [directory retain];
+    }
+    return self;
+}
+
+#pragma mark
+#pragma mark Methods
+
+/** Return the paths of all the .mid/.midi files under the directory, sorted */
+-(NSArray *)findMidiFiles {
+    NSMutableArray *files = [NSMutableArray arrayWithCapacity:100];
+    NSDirectoryEnumerator *enumerator = [[NSFileManager defaultManager] enumeratorAtPath:_directory];
+    for (NSString *name in enumerator) {
+        NSString *extension = [[name pathExtension] lowercaseString];
+        if ([extension isEqualToString:@"mid"] || [extension isEqualToString:@"midi"]) {
+            [files addObject:[_directory stringByAppendingPathComponent:name]];
+        }
+    }
+    [files sortUsingSelector:@selector(compare:)];
+    return files;
+}
+
+/** Return the catalog line for one Midi file.  Throws if the file can't be parsed. */
++(NSString *)catalogLineForFile:(NSString *)path {
+    MidiLoadOptions options;
+    options.eventclasses = MidiEventClassDisplay;
+    options.channels = MidiChannelsAll;
+    options.tracks = nil;
+    options.overlap = NoteOverlapLastOpened;
+    options.dangling = NoteDanglingEndOfTrack;
+    MidiFile *midiFile = [[[MidiFile alloc]initWithFile:path andOptions:&options] autorelease];
+
+    Array *tracks = [midiFile tracks];
+    NSMutableArray *instruments = [NSMutableArray arrayWithCapacity:[tracks count]];
+    int numNotes = 0;
+    int low = 127, high = 0;
+    for (int i = 0; i < [tracks count]; i++) {
+        MidiTrack *track = [tracks get:i];
+        [instruments addObject:[track instrumentName]];
+        const MidiNoteArray *notes = [track readNotes];
+        numNotes += notes->count;
+        for (int j = 0; j < notes->count; j++) {
+            int number = notes->notes[j].number;
+            if (number < low) low = number;
+            if (number > high) high = number;
+        }
+    }
+    if (numNotes == 0) {
+        low = high = 0;
+    }
+
+    MGTimeSignature *time = [midiFile time];
+    double seconds = [midiFile microsecondsAtPulse:[midiFile totalpulses]] / 1000000.0;
+
+    NSString *key = @"-";
+    if ([tracks count] > 0) {
+        MGScore *score = [[[MGScore alloc]initWithMidiFile:midiFile] autorelease];
+        MGKeySignature *keySignature = score.keySignature;
+        if (keySignature != nil && keySignature.tonic.pitchClass >= 0 &&
+            keySignature.tonic.pitchClass < PITCH_CLASS_TOTAL) {
+            key = [NSString stringWithFormat:@"%s %s",
+                   pitchClassNames[keySignature.tonic.pitchClass],
+                   (keySignature.mode == KEY_SIG_MIN) ? "minor" : "major"];
+        }
+    }
+
+    return [NSString stringWithFormat:@"%@\t%d\t%@\t%d\t%.2f\t%d/%d\t%@\t%d\t%d\t%d",
+            path, [tracks count], [instruments componentsJoinedByString:@","],
+            [midiFile totalpulses], seconds, [time numerator], [time denominator],
+            key, numNotes, low, high];
+}
+
+/** Index every Midi file under the directory, and write the catalog.
+ The files are parsed in parallel with dispatch_apply, which hands
+ the files out to the worker threads as they become free.  A file
+ that throws is reported on its own line, without stopping the others. */
+-(BOOL)writeCatalogToFile:(NSString *)catalogPath {
+    NSArray *files = [self findMidiFiles];
+    NSUInteger count = [files count];
+    NSString **lines = (NSString **)calloc(count + 1, sizeof(NSString *));
+    BOOL *failed = (BOOL *)calloc(count + 1, sizeof(BOOL));
+    unsigned long long *sizes = (unsigned long long *)calloc(count + 1, sizeof(unsigned long long));
+
+    CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+    dispatch_queue_t queue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+    dispatch_apply(count, queue, ^(size_t i) {
+        NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+        NSString *path = [files objectAtIndex:i];
+        sizes[i] = [[[NSFileManager defaultManager] attributesOfItemAtPath:path error:NULL] fileSize];
+        @try {
+            lines[i] = [[MGLibraryIndexer catalogLineForFile:path] retain];
+        }
+        @catch (NSException *e) {
+            /* MidiFileException for bad Midi data, or anything else
+             thrown while deriving the score */
+            lines[i] = [[NSString alloc] initWithFormat:@"%@\tERROR\t%@", path, [e reason]];
+            failed[i] = YES;
+        }
+        [pool drain];
+    });
+    _elapsed = CFAbsoluteTimeGetCurrent() - start;
+
+    NSMutableString *catalog = [NSMutableString stringWithCapacity:count * 100];
+    [catalog appendString:@"path\ttracks\tinstruments\tpulses\tseconds\ttime\tkey\tnotes\tlow\thigh\n"];
+    _numFiles = count;
+    _failures = 0;
+    _bytes = 0;
+    for (NSUInteger i = 0; i < count; i++) {
+        [catalog appendString:lines[i]];
+        [catalog appendString:@"\n"];
+        [lines[i] release];
+        _failures += failed[i];
+        _bytes += sizes[i];
+    }
+    free(lines);
+    free(failed);
+    free(sizes);
+
+    return [catalog writeToFile:catalogPath atomically:YES
+                       encoding:NSUTF8StringEncoding error:NULL];
+}
+
+@end
+
+
+/** Command-line program to index a library of Midi files.
+ *  Usage: indexer <directory> <catalog>
+ */
+int indexer_main(int argc, char **argv)
+{
+    if (argc < 3) {
+        printf("Usage: indexer <directory> <catalog>\n");
+        return 1;
+    }
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    NSString *directory = [NSString stringWithUTF8String:argv[1]];
+    NSString *catalog = [NSString stringWithUTF8String:argv[2]];
+
+    MGLibraryIndexer *indexer = [[MGLibraryIndexer alloc] initWithDirectory:directory];
+    BOOL written = [indexer writeCatalogToFile:catalog];
+    double elapsed = [indexer elapsed] > 0 ? [indexer elapsed] : 1e-9;
+    printf("%lu files (%lu failed), %.1f MB in %.3f sec: %.1f files/sec, %.2f MB/sec\n",
+           (unsigned long)[indexer numFiles], (unsigned long)[indexer failures],
+           [indexer bytes] / 1048576.0, elapsed,
+           [indexer numFiles] / elapsed, [indexer bytes] / 1048576.0 / elapsed);
+    if (!written) {
+        printf("Could not write %s\n", argv[2]);
+    }
+    [indexer release];
+    [pool drain];
+    return written ? 0 : 1;
+}
+
+#ifdef INDEXER_MAIN
+int main(int argc, char **argv) {
+    return indexer_main(argc, argv);
+}
+#endif
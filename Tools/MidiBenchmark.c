@@ -0,0 +1,445 @@
+//
+//  MidiBenchmark.c
+//  MetroGnomeiPad
+//
+//  Copyright (c) 2012 Princeton University. All rights reserved.
+//
+
+/* A headless benchmark of the plain C stages of the Midi pipeline:
+ * decoding, filtered decoding, merge streaming, note pairing and
+ * encoding.  It is not part of the app; Tools/Makefile builds it as
+ * the midibench program, on Mac OS X or on Linux (make midibench).
+ *
+ * The Foundation stages (MidiFile, MGScore) are timed by the
+ * filebench program, built from MidiFileBenchmark.m.
+ *
+ * The output is one CSV line per (input, stage):
+ *   input,events,stage,iterations,ns_per_event,heap_bytes,allocs,peak_rss_kb
+ * heap_bytes is the heap memory held by one iteration's result.
+ * allocs is the number of malloc, calloc and realloc calls made by
+ * one iteration.  They are counted by wrapping the allocator: on
+ * glibc by defining malloc, calloc and realloc here, on Mac OS X by
+ * patching the default malloc zone.  Elsewhere, or when built with
+ * -DMIDIBENCH_NO_COUNTING, allocs is -1.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#ifdef __APPLE__
+#include <mach/mach.h>
+#include <mach/mach_time.h>
+#include <malloc/malloc.h>
+#else
+#include <time.h>
+#include <malloc.h>
+#endif
+#include "MidiDecoder.h"
+#include "MidiEncoder.h"
+#include "NotePairer.h"
+#include "MidiSynth.h"
+#include "MidiBenchmark.h"
+
+#define MinBenchEvents  (4 * 1000 * 1000)  /* Events to process per stage */
+#define MaxSynthEvents  (10 * 1000 * 1000)
+
+/** Return a monotonic time in nanoseconds */
+double midiBenchNanos(void) {
+#ifdef __APPLE__
+    static mach_timebase_info_data_t timebase;
+    if (timebase.denom == 0) {
+        mach_timebase_info(&timebase);
+    }
+    return (double)mach_absolute_time() * timebase.numer / timebase.denom;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e9 + now.tv_nsec;
+#endif
+}
+
+/** Return the peak resident set size of the process, in kilobytes */
+long midiBenchPeakRSS(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+}
+
+static long long allocCount;   /* The malloc, calloc and realloc calls so far */
+
+#if defined(MIDIBENCH_NO_COUNTING)
+
+/* Built with a sanitizer, which owns the allocator */
+static int countAllocations(void) {
+    return 0;
+}
+
+#elif defined(__GLIBC__)
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void *ptr, size_t size);
+
+/* These replace the glibc allocator entry points for the whole
+ * program.  free() needs no wrapper.
+ */
+void* malloc(size_t size) {
+    __sync_fetch_and_add(&allocCount, 1);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+    __sync_fetch_and_add(&allocCount, 1);
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void *ptr, size_t size) {
+    __sync_fetch_and_add(&allocCount, 1);
+    return __libc_realloc(ptr, size);
+}
+
+static int countAllocations(void) {
+    return 1;
+}
+
+#elif defined(__APPLE__)
+
+static void* (*zoneMalloc)(malloc_zone_t *zone, size_t size);
+static void* (*zoneCalloc)(malloc_zone_t *zone, size_t count, size_t size);
+static void* (*zoneRealloc)(malloc_zone_t *zone, void *ptr, size_t size);
+
+static void* countingMalloc(malloc_zone_t *zone, size_t size) {
+    __sync_fetch_and_add(&allocCount, 1);
+    return zoneMalloc(zone, size);
+}
+
+static void* countingCalloc(malloc_zone_t *zone, size_t count, size_t size) {
+    __sync_fetch_and_add(&allocCount, 1);
+    return zoneCalloc(zone, count, size);
+}
+
+static void* countingRealloc(malloc_zone_t *zone, void *ptr, size_t size) {
+    __sync_fetch_and_add(&allocCount, 1);
+    return zoneRealloc(zone, ptr, size);
+}
+
+/** Patch the default malloc zone to count its allocations, the first
+ *  time this is called.  The zone struct is read-only, so unprotect
+ *  its pages while swapping in the counting functions.
+ */
+static int countAllocations(void) {
+    static int installed = 0;
+    if (installed) {
+        return 1;
+    }
+    malloc_zone_t *zone = malloc_default_zone();
+    vm_address_t page = trunc_page((vm_address_t)zone);
+    vm_size_t size = round_page((vm_address_t)(zone + 1)) - page;
+    if (vm_protect(mach_task_self(), page, size, 0, VM_PROT_READ | VM_PROT_WRITE) != KERN_SUCCESS) {
+        return 0;
+    }
+    zoneMalloc = zone->malloc;
+    zoneCalloc = zone->calloc;
+    zoneRealloc = zone->realloc;
+    zone->malloc = countingMalloc;
+    zone->calloc = countingCalloc;
+    zone->realloc = countingRealloc;
+    vm_protect(mach_task_self(), page, size, 0, VM_PROT_READ);
+    installed = 1;
+    return 1;
+}
+
+#else
+
+static int countAllocations(void) {
+    return 0;
+}
+
+#endif
+
+/** Return the number of malloc, calloc and realloc calls made so
+ *  far, or -1 if they cannot be counted on this platform.  Only the
+ *  difference between two calls is meaningful.
+ */
+long long midiBenchAllocations(void) {
+    if (!countAllocations()) {
+        return -1;
+    }
+    return __sync_fetch_and_add(&allocCount, 0);
+}
+
+/** Return the allocations made since midiBenchAllocations() returned
+ *  before, or -1 if they cannot be counted.
+ */
+long long midiBenchAllocationsSince(long long before) {
+    return (before >= 0) ? midiBenchAllocations() - before : -1;
+}
+
+/** Return the bytes of malloc heap in use */
+long long midiBenchHeapInUse(void) {
+#if defined(__APPLE__)
+    malloc_statistics_t stats;
+    malloc_zone_statistics(NULL, &stats);
+    return (long long)stats.size_in_use;
+#elif defined(__GLIBC__)
+#if __GLIBC_PREREQ(2, 33)
+    struct mallinfo2 info = mallinfo2();
+    return (long long)info.uordblks + (long long)info.hblkhd;
+#else
+    struct mallinfo info = mallinfo();
+    return (long long)(unsigned)info.uordblks + (long long)(unsigned)info.hblkhd;
+#endif
+#else
+    return 0;
+#endif
+}
+
+/** Print one CSV result line.  allocs is the number of allocations
+ *  made by all the iterations, from midiBenchAllocations().
+ */
+void midiBenchReport(const char *input, long long events, const char *stage,
+                     int iterations, double nanos, long long heapbytes,
+                     long long allocs) {
+    double perevent = (events > 0) ? nanos / ((double)events * iterations) : 0;
+    long long periteration = (allocs >= 0) ? allocs / iterations : -1;
+    printf("%s,%lld,%s,%d,%.2f,%lld,%lld,%ld\n", input, events, stage, iterations,
+           perevent, heapbytes, periteration, midiBenchPeakRSS());
+    fflush(stdout);
+}
+
+/** Return the heap memory held by an event store */
+static long long storeBytes(const MidiEventStore *store) {
+    return (long long)store->capacity * (4 * sizeof(int) + 3) + store->extracap;
+}
+
+/** Decode every track of the file into stores[].  Return the number
+ *  of events, or -1 if the file is bad.
+ */
+static long long decodeAll(const u_char *data, int datalen, const int *offsets,
+                           int numtracks, const MidiDecodeFilter *filter,
+                           MidiEventStore *stores) {
+    long long count = 0;
+    int erroroffset = 0;
+    for (int tracknum = 0; tracknum < numtracks; tracknum++) {
+        int result = midiDecodeTrack(data, datalen, offsets[tracknum], filter,
+                                     &stores[tracknum], &erroroffset);
+        count += stores[tracknum].count;
+        if (result != MidiDecodeOK) {
+            for (int i = 0; i <= tracknum; i++) {
+                eventStoreFree(&stores[i]);
+            }
+            return -1;
+        }
+    }
+    return count;
+}
+
+/** Pair the notes of one decoded track.  Return the heap memory held
+ *  by the pairer.
+ */
+static long long pairTrack(const MidiEventStore *store) {
+    NotePairer *pairer = (NotePairer*)malloc(sizeof(NotePairer));
+    notePairerInit(pairer, NoteOverlapLastOpened, NoteDanglingEndOfTrack, 0);
+    int endtime = 0;
+    for (int i = 0; i < store->count; i++) {
+        u_char flag = eventStoreFlag(store, i);
+        endtime = store->starttime[i];
+        if (flag == 0x90 && store->data2[i] > 0) {
+            notePairerNoteOn(pairer, eventStoreChannel(store, i), store->data1[i],
+                             store->data2[i], store->starttime[i], i);
+        }
+        else if (flag == 0x80 || flag == 0x90) {
+            notePairerNoteOff(pairer, eventStoreChannel(store, i), store->data1[i],
+                              store->starttime[i]);
+        }
+    }
+    notePairerFinish(pairer, endtime);
+    long long bytes = sizeof(NotePairer) + (long long)pairer->capacity * sizeof(PairedNote);
+    notePairerFree(pairer);
+    free(pairer);
+    return bytes;
+}
+
+/** Run all the C stages on one Midi file image */
+static int benchData(const char *input, const u_char *data, int datalen) {
+    MidiHeader header;
+    int erroroffset = 0;
+    if (midiDecodeHeader(data, datalen, &header, &erroroffset) != MidiDecodeOK) {
+        fprintf(stderr, "%s: bad header at offset %d\n", input, erroroffset);
+        return 1;
+    }
+    int *offsets = (int*)calloc(header.numtracks, sizeof(int));
+    MidiEventStore *stores = (MidiEventStore*)calloc(header.numtracks, sizeof(MidiEventStore));
+    if (midiFindTracks(data, datalen, 14, header.numtracks, offsets, &erroroffset) != MidiDecodeOK) {
+        fprintf(stderr, "%s: bad track at offset %d\n", input, erroroffset);
+        free(offsets); free(stores);
+        return 1;
+    }
+
+    long long events = decodeAll(data, datalen, offsets, header.numtracks, NULL, stores);
+    if (events < 0) {
+        fprintf(stderr, "%s: bad event\n", input);
+        free(offsets); free(stores);
+        return 1;
+    }
+    eventStoreFreeList(stores, header.numtracks);
+    stores = (MidiEventStore*)calloc(header.numtracks, sizeof(MidiEventStore));
+    int iterations = (events >= MinBenchEvents) ? 1 : (int)(MinBenchEvents / (events + 1)) + 1;
+
+    /* decode: every event of every track */
+    long long heapbytes = 0;
+    long long allocs = midiBenchAllocations();
+    double start = midiBenchNanos();
+    for (int iter = 0; iter < iterations; iter++) {
+        decodeAll(data, datalen, offsets, header.numtracks, NULL, stores);
+        if (iter == iterations - 1) {
+            for (int i = 0; i < header.numtracks; i++) {
+                heapbytes += storeBytes(&stores[i]);
+            }
+        }
+        for (int i = 0; i < header.numtracks; i++) {
+            eventStoreFree(&stores[i]);
+        }
+    }
+    midiBenchReport(input, events, "decode", iterations, midiBenchNanos() - start, heapbytes,
+                    midiBenchAllocationsSince(allocs));
+
+    /* decode_display: only the events the sheet music needs */
+    MidiDecodeFilter filter;
+    filter.eventclasses = MidiEventClassDisplay;
+    filter.channels = MidiChannelsAll;
+    heapbytes = 0;
+    allocs = midiBenchAllocations();
+    start = midiBenchNanos();
+    for (int iter = 0; iter < iterations; iter++) {
+        decodeAll(data, datalen, offsets, header.numtracks, &filter, stores);
+        if (iter == iterations - 1) {
+            for (int i = 0; i < header.numtracks; i++) {
+                heapbytes += storeBytes(&stores[i]);
+            }
+        }
+        for (int i = 0; i < header.numtracks; i++) {
+            eventStoreFree(&stores[i]);
+        }
+    }
+    midiBenchReport(input, events, "decode_display", iterations, midiBenchNanos() - start, heapbytes,
+                    midiBenchAllocationsSince(allocs));
+
+    /* merge_stream: all tracks in time order, nothing stored */
+    heapbytes = 0;
+    allocs = midiBenchAllocations();
+    start = midiBenchNanos();
+    for (int iter = 0; iter < iterations; iter++) {
+        MidiMergeCursor merge;
+        MidiRawEvent event;
+        int tracknum;
+        midiMergeCursorInit(&merge, data, datalen, NULL, &erroroffset);
+        while (midiMergeCursorNext(&merge, &event, &tracknum) == MidiDecodeOK) {
+        }
+        heapbytes = (long long)merge.numtracks *
+                    (sizeof(MidiCursor) + sizeof(MidiRawEvent) + sizeof(int));
+        midiMergeCursorFree(&merge);
+    }
+    midiBenchReport(input, events, "merge_stream", iterations, midiBenchNanos() - start, heapbytes,
+                    midiBenchAllocationsSince(allocs));
+
+    /* pair_notes: NoteOn/NoteOff matching over the decoded tracks */
+    decodeAll(data, datalen, offsets, header.numtracks, NULL, stores);
+    allocs = midiBenchAllocations();
+    start = midiBenchNanos();
+    for (int iter = 0; iter < iterations; iter++) {
+        heapbytes = 0;
+        for (int i = 0; i < header.numtracks; i++) {
+            heapbytes += pairTrack(&stores[i]);
+        }
+    }
+    midiBenchReport(input, events, "pair_notes", iterations, midiBenchNanos() - start, heapbytes,
+                    midiBenchAllocationsSince(allocs));
+
+    /* encode: serialize the decoded tracks back into a Midi file */
+    allocs = midiBenchAllocations();
+    start = midiBenchNanos();
+    for (int iter = 0; iter < iterations; iter++) {
+        int len = 0;
+        u_char *encoded = midiEncodeFile(stores, header.numtracks, header.trackmode,
+                                         header.quarternote, NULL, &len);
+        heapbytes = len;
+        free(encoded);
+    }
+    midiBenchReport(input, events, "encode", iterations, midiBenchNanos() - start, heapbytes,
+                    midiBenchAllocationsSince(allocs));
+
+    eventStoreFreeList(stores, header.numtracks);
+    free(offsets);
+    return 0;
+}
+
+/** Read a whole file.  Return the data (allocated with malloc) or NULL */
+static u_char* benchReadFile(const char *path, int *len) {
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        return NULL;
+    }
+    fseek(fp, 0, SEEK_END);
+    *len = (int)ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    u_char *data = (u_char*)malloc(*len > 0 ? *len : 1);
+    if (fread(data, 1, *len, fp) != (size_t)*len) {
+        free(data);
+        data = NULL;
+    }
+    fclose(fp);
+    return data;
+}
+
+/** Command-line program to benchmark the C Midi stages.
+ *  Usage: midibench [-max events] [file.mid ...]
+ *  Runs each given file, then synthetic files of 1k, 10k, ... events,
+ *  up to max (default 10M).
+ */
+int midibench_main(int argc, char **argv) {
+    int maxevents = MaxSynthEvents;
+    int status = 0;
+    printf("input,events,stage,iterations,ns_per_event,heap_bytes,allocs,peak_rss_kb\n");
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-max") == 0 && i + 1 < argc) {
+            maxevents = atoi(argv[++i]);
+            continue;
+        }
+        int len = 0;
+        u_char *data = benchReadFile(argv[i], &len);
+        if (data == NULL) {
+            fprintf(stderr, "%s: cannot read\n", argv[i]);
+            status = 1;
+            continue;
+        }
+        const char *name = strrchr(argv[i], '/');
+        status |= benchData(name ? name + 1 : argv[i], data, len);
+        free(data);
+    }
+
+    for (int numevents = 1000; numevents <= maxevents; numevents *= 10) {
+        MidiSynthOptions options;
+        char name[64];
+        int len = 0;
+        midiSynthDefaults(&options);
+        options.numtracks = 16;
+        options.numevents = numevents;
+        u_char *data = midiSynthGenerate(&options, &len);
+        snprintf(name, sizeof(name), "synth-%d", numevents);
+        status |= benchData(name, data, len);
+        free(data);
+    }
+    return status;
+}
+
+#ifdef MIDIBENCH_MAIN
+int main(int argc, char **argv) {
+    return midibench_main(argc, argv);
+}
+#endif
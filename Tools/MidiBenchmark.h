@@ -0,0 +1,27 @@
+//
+//  MidiBenchmark.h
+//  MetroGnomeiPad
+//
+//  Copyright (c) 2012 Princeton University. All rights reserved.
+//
+
+#ifndef MetroGnomeiPad_MidiBenchmark_h
+#define MetroGnomeiPad_MidiBenchmark_h
+
+/* Shared helpers of the headless benchmarks, midibench_main() in
+ * MidiBenchmark.c (the C stages) and filebench_main() in
+ * MidiFileBenchmark.m (the MidiFile and MGScore stages).  They are
+ * built by Tools/Makefile, not by the app target.
+ */
+
+double    midiBenchNanos(void);
+long      midiBenchPeakRSS(void);
+long long midiBenchHeapInUse(void);
+long long midiBenchAllocations(void);
+long long midiBenchAllocationsSince(long long before);
+void      midiBenchReport(const char *input, long long events, const char *stage,
+                          int iterations, double nanos, long long heapbytes,
+                          long long allocs);
+int       midibench_main(int argc, char **argv);
+
+#endif
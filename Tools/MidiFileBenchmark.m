@@ -0,0 +1,353 @@
+//
+//  MidiFileBenchmark.m
+//  MetroGnomeiPad
+//
+//  Copyright (c) 2012 Princeton University. All rights reserved.
+//
+
+/* A headless benchmark of the Foundation stages of the Midi pipeline:
+ * loading a MidiFile, applying the sheet music and sound options (to
+ * a file, in memory, and from a pause time), writing a Midi file, combining
+ * and splitting tracks, and building an MGScore.
+ * The output is the same CSV as midibench_main() in MidiBenchmark.c.
+ * heap_bytes is the growth of the malloc heap while one iteration's
+ * result is still alive.
+ *
+ * filestress_main() runs the stress cases of MidiStress.c through
+ * MidiFile initWithFile:.
+ *
+ * MidiFile and MGScore need UIKit and BASS, so these are built for
+ * the iOS simulator, as the filebench and filestress programs of
+ * Tools/Makefile (make objc-tools), and run with xcrun simctl spawn.
+ */
+
+#import <Foundation/Foundation.h>
+#import "MidiFile.h"
+#import "MGScore.h"
+#include "MidiSynth.h"
+#include "MidiBenchmark.h"
+#include "MidiStress.h"
+
+#define MinBenchEvents  (1000 * 1000)  /* Events to process per stage */
+#define MaxSynthEvents  (10 * 1000 * 1000)
+#define MinStressNanos  50e6           /* Time each stress file for at least 50 msec */
+
+/** Return the number of events in the file's tracks */
+static long long countEvents(MidiFile *file) {
+    long long count = 0;
+    MidiEventStore *stores = [file eventStores];
+    for (int i = 0; i < [file eventStoreCount]; i++) {
+        count += stores[i].count;
+    }
+    return count;
+}
+
+/** Return a new IntArray of the given length, filled with value */
+static IntArray* filledIntArray(int length, int value) {
+    IntArray *array = [IntArray new:length];
+    for (int i = 0; i < length; i++) {
+        [array add:value];
+    }
+    return array;
+}
+
+/** Run all the Foundation stages on one Midi file */
+static int benchFile(NSString *path, const char *input) {
+    MidiFile *file = nil;
+    @try {
+        file = [[MidiFile alloc] initWithFile:path];
+    }
+    @catch (MidiFileException *e) {
+        fprintf(stderr, "%s: %s\n", input, [[e reason] UTF8String]);
+        return 1;
+    }
+    long long events = countEvents(file);
+    int iterations = (events >= MinBenchEvents) ? 1 : (int)(MinBenchEvents / (events + 1)) + 1;
+    int numtracks = [[file tracks] count];
+    NSString *outfile = [NSTemporaryDirectory() stringByAppendingPathComponent:@"filebench-out.mid"];
+    long long heapbytes = 0;
+    long long allocs;
+    double start;
+
+    /* MidiFile initWithFile: */
+    allocs = midiBenchAllocations();
+    start = midiBenchNanos();
+    for (int iter = 0; iter < iterations; iter++) {
+        NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+        long long before = midiBenchHeapInUse();
+        MidiFile *f = [[MidiFile alloc] initWithFile:path];
+        heapbytes = midiBenchHeapInUse() - before;
+        [f release];
+        [pool drain];
+    }
+    midiBenchReport(input, events, "midifile_init", iterations, midiBenchNanos() - start, heapbytes,
+                    midiBenchAllocationsSince(allocs));
+
+    /* MidiFile changeSheetMusicOptions: */
+    SheetMusicOptions sheet;
+    memset(&sheet, 0, sizeof(sheet));
+    sheet.tracks = filledIntArray(numtracks, 1);
+    sheet.numtracks = numtracks;
+    sheet.combineInterval = 40;
+    allocs = midiBenchAllocations();
+    start = midiBenchNanos();
+    for (int iter = 0; iter < iterations; iter++) {
+        NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+        [file clearSheetMusicCache];
+        long long before = midiBenchHeapInUse();
+        Array *tracks = [file changeSheetMusicOptions:&sheet];
+        heapbytes = midiBenchHeapInUse() - before;
+        [tracks release];
+        [pool drain];
+    }
+    midiBenchReport(input, events, "sheet_options", iterations, midiBenchNanos() - start, heapbytes,
+                    midiBenchAllocationsSince(allocs));
+
+    /* Only the transpose changes, so the cached stages are reused */
+    allocs = midiBenchAllocations();
+    start = midiBenchNanos();
+    for (int iter = 0; iter < iterations; iter++) {
+        NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+        long long before = midiBenchHeapInUse();
+        sheet.transpose = (iter % 12) - 6;
+        Array *tracks = [file changeSheetMusicOptions:&sheet];
+        heapbytes = midiBenchHeapInUse() - before;
+        [tracks release];
+        [pool drain];
+    }
+    midiBenchReport(input, events, "sheet_options_transpose", iterations, midiBenchNanos() - start, heapbytes,
+                    midiBenchAllocationsSince(allocs));
+    [file clearSheetMusicCache];
+    [sheet.tracks release];
+
+    /* MidiFile changeSound:toFile: */
+    MidiSoundOptions sound;
+    memset(&sound, 0, sizeof(sound));
+    sound.tempo = [[file time] tempo];
+    sound.numtracks = numtracks;
+    sound.tracks = filledIntArray(numtracks, 1);
+    sound.instruments = filledIntArray(numtracks, 0);
+    sound.useDefaultInstruments = YES;
+    allocs = midiBenchAllocations();
+    start = midiBenchNanos();
+    for (int iter = 0; iter < iterations; iter++) {
+        NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+        long long before = midiBenchHeapInUse();
+        [file changeSound:&sound toFile:outfile];
+        heapbytes = midiBenchHeapInUse() - before;
+        [pool drain];
+    }
+    midiBenchReport(input, events, "change_sound", iterations, midiBenchNanos() - start, heapbytes,
+                    midiBenchAllocationsSince(allocs));
+
+    /* MidiFile changeSound: (in memory, for playback) */
+    allocs = midiBenchAllocations();
+    start = midiBenchNanos();
+    for (int iter = 0; iter < iterations; iter++) {
+        NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+        long long before = midiBenchHeapInUse();
+        [file changeSound:&sound];
+        heapbytes = midiBenchHeapInUse() - before;
+        [pool drain];
+    }
+    midiBenchReport(input, events, "change_sound_data", iterations, midiBenchNanos() - start, heapbytes,
+                    midiBenchAllocationsSince(allocs));
+
+    /* MidiFile changeSound: starting halfway through, as when seeking */
+    sound.pauseTime = [file totalpulses] / 2;
+    allocs = midiBenchAllocations();
+    start = midiBenchNanos();
+    for (int iter = 0; iter < iterations; iter++) {
+        NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+        long long before = midiBenchHeapInUse();
+        [file changeSound:&sound];
+        heapbytes = midiBenchHeapInUse() - before;
+        [pool drain];
+    }
+    midiBenchReport(input, events, "change_sound_seek", iterations, midiBenchNanos() - start, heapbytes,
+                    midiBenchAllocationsSince(allocs));
+    [sound.tracks release];
+    [sound.instruments release];
+
+    /* MidiFile writeMidiFile: */
+    allocs = midiBenchAllocations();
+    start = midiBenchNanos();
+    for (int iter = 0; iter < iterations; iter++) {
+        NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+        long long before = midiBenchHeapInUse();
+        [MidiFile writeMidiFile:outfile withEvents:[file eventStores] count:[file eventStoreCount]
+                        andMode:[file trackmode] andQuarter:[file quarternote]];
+        heapbytes = midiBenchHeapInUse() - before;
+        [pool drain];
+    }
+    midiBenchReport(input, events, "write_midi", iterations, midiBenchNanos() - start, heapbytes,
+                    midiBenchAllocationsSince(allocs));
+
+    /* MidiFile combineToTwoTracks: */
+    allocs = midiBenchAllocations();
+    start = midiBenchNanos();
+    for (int iter = 0; iter < iterations; iter++) {
+        NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+        long long before = midiBenchHeapInUse();
+        Array *tracks = [MidiFile combineToTwoTracks:[file tracks] withMeasure:[[file time] measure]];
+        heapbytes = midiBenchHeapInUse() - before;
+        [tracks release];
+        [pool drain];
+    }
+    midiBenchReport(input, events, "combine_two_tracks", iterations, midiBenchNanos() - start, heapbytes,
+                    midiBenchAllocationsSince(allocs));
+
+    /* MidiFile splitTrack: (the hand splitting of combineToTwoTracks) */
+    int measure = [[file time] measure];
+    MidiTrack *single = [MidiFile combineToSingleTrack:[file tracks]];
+    allocs = midiBenchAllocations();
+    start = midiBenchNanos();
+    for (int iter = 0; iter < iterations; iter++) {
+        NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+        long long before = midiBenchHeapInUse();
+        Array *tracks = [MidiFile splitTrack:single withMeasure:measure];
+        heapbytes = midiBenchHeapInUse() - before;
+        [tracks release];
+        [pool drain];
+    }
+    midiBenchReport(input, events, "split_track", iterations, midiBenchNanos() - start, heapbytes,
+                    midiBenchAllocationsSince(allocs));
+    [single release];
+
+    /* MGScore initWithMidiFile: */
+    allocs = midiBenchAllocations();
+    start = midiBenchNanos();
+    for (int iter = 0; iter < iterations; iter++) {
+        NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+        long long before = midiBenchHeapInUse();
+        MGScore *score = [[MGScore alloc] initWithMidiFile:file];
+        heapbytes = midiBenchHeapInUse() - before;
+        [score release];
+        [pool drain];
+    }
+    midiBenchReport(input, events, "mgscore_init", iterations, midiBenchNanos() - start, heapbytes,
+                    midiBenchAllocationsSince(allocs));
+
+    [[NSFileManager defaultManager] removeItemAtPath:outfile error:NULL];
+    [file release];
+    return 0;
+}
+
+/** Command-line program to benchmark the MidiFile and MGScore stages.
+ *  Usage: filebench [-max events] [file.mid ...]
+ *  Runs each given file (e.g. the bundled Resources/*.mid), then
+ *  synthetic files of 1k, 10k, ... events, up to max (default 10M).
+ */
+int filebench_main(int argc, char **argv)
+{
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    int maxevents = MaxSynthEvents;
+    int status = 0;
+    printf("input,events,stage,iterations,ns_per_event,heap_bytes,allocs,peak_rss_kb\n");
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-max") == 0 && i + 1 < argc) {
+            maxevents = atoi(argv[++i]);
+            continue;
+        }
+        NSString *path = [NSString stringWithUTF8String:argv[i]];
+        status |= benchFile(path, [[path lastPathComponent] UTF8String]);
+    }
+
+    for (int numevents = 1000; numevents <= maxevents; numevents *= 10) {
+        MidiSynthOptions options;
+        int len = 0;
+        midiSynthDefaults(&options);
+        options.numtracks = 16;
+        options.numevents = numevents;
+        u_char *data = midiSynthGenerate(&options, &len);
+        NSString *name = [NSString stringWithFormat:@"synth-%d", numevents];
+        NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:
+                          [name stringByAppendingPathExtension:@"mid"]];
+        NSData *contents = [[NSData alloc] initWithBytesNoCopy:data length:len freeWhenDone:YES];
+        [contents writeToFile:path atomically:NO];
+        [contents release];
+        status |= benchFile(path, [name UTF8String]);
+        [[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+    }
+    [pool drain];
+    return status;
+}
+
+
+/** Time MidiFile initWithFile: on one stress file.  Return the
+ *  nanoseconds per load, and the heap held by the loaded MidiFile.
+ */
+static double stressLoad(NSString *path, const char *name, int numbytes, long long *heapbytes) {
+    NSString *result = @"No error";
+    int iterations = 0;
+    double start = midiBenchNanos();
+    double elapsed = 0;
+    do {
+        NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+        long long before = midiBenchHeapInUse();
+        MidiFile *file = nil;
+        @try {
+            file = [[MidiFile alloc] initWithFile:path];
+        }
+        @catch (NSException *e) {
+            result = [e reason];
+        }
+        *heapbytes = midiBenchHeapInUse() - before;
+        [file release];
+        [pool drain];
+        iterations++;
+        elapsed = midiBenchNanos() - start;
+    } while (elapsed < MinStressNanos);
+
+    printf("%s,%d,%s,%.2f,%lld\n", name, numbytes, [result UTF8String],
+           elapsed / iterations / (numbytes > 0 ? numbytes : 1), *heapbytes);
+    return elapsed / iterations;
+}
+
+/** Command-line program to stress MidiFile initWithFile: with the
+ *  cases in MidiStress.c.  Return 0 if every case loaded (or failed
+ *  with an exception) in linear time and memory.
+ */
+int filestress_main(int argc, char **argv)
+{
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    int failed = 0;
+    printf("case,bytes,result,ns_per_byte,heap_bytes\n");
+    for (int c = 0; c < midiStressCaseCount; c++) {
+        const MidiStressCase *stresscase = &midiStressCases[c];
+        int numbytes[2];
+        double nanos[2];
+        long long heapbytes[2];
+        for (int size = 0; size < 2; size++) {
+            MidiSynthOptions options;
+            int numevents = (size == 0) ? MidiStressSmall : MidiStressSmall * MidiStressScale;
+            midiStressOptions(stresscase, numevents, &options);
+            u_char *data = midiSynthGenerate(&options, &numbytes[size]);
+            NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:
+                              [NSString stringWithFormat:@"stress-%s-%d.mid", stresscase->name, size]];
+            NSData *contents = [[NSData alloc] initWithBytesNoCopy:data length:numbytes[size]
+                                                      freeWhenDone:YES];
+            [contents writeToFile:path atomically:NO];
+            [contents release];
+            nanos[size] = stressLoad(path, stresscase->name, numbytes[size], &heapbytes[size]);
+            [[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+        }
+        failed |= midiStressCheck(stresscase->name, numbytes[0], numbytes[1],
+                                  nanos[0], nanos[1], heapbytes[0], heapbytes[1]);
+    }
+    printf("%s\n", failed ? "FAILED" : "PASSED");
+    [pool drain];
+    return failed;
+}
+
+#ifdef FILEBENCH_MAIN
+int main(int argc, char **argv) {
+    return filebench_main(argc, argv);
+}
+#endif
+
+#ifdef FILESTRESS_MAIN
+int main(int argc, char **argv) {
+    return filestress_main(argc, argv);
+}
+#endif
@@ -0,0 +1,318 @@
+//
+//  MidiParseBenchmark.m
+//  MetroGnomeiPad
+//
+//  Copyright (c) 2012 Princeton University. All rights reserved.
+//
+
+/* A headless benchmark of the track parse, before and after the
+ * MidiDecoder.  The "before" stage is the MidiFile readTrack method
+ * as it was (one MidiEvent per event, one message send per byte),
+ * run on a non-mapped MidiFileReader, so that every Sysex/Meta
+ * payload is a malloc'ed copy, as it was then.  The old parse never
+ * freed those payloads; here they are freed after each track, and
+ * that is counted in its time.
+ *
+ * The output is the same CSV as midibench_main() in MidiBenchmark.c.
+ * It is built for the iOS simulator, as the parsebench program of
+ * Tools/Makefile (make objc-tools), since MidiFile needs UIKit.
+ */
+
+#import <Foundation/Foundation.h>
+#include <math.h>
+#import "MidiFile.h"
+#include "MidiDecoder.h"
+#include "MidiBenchmark.h"
+
+/* The Midi events and Meta events the old parse reads */
+#define EventNoteOff           0x80
+#define EventNoteOn            0x90
+#define EventKeyPressure       0xA0
+#define EventControlChange     0xB0
+#define EventProgramChange     0xC0
+#define EventChannelPressure   0xD0
+#define EventPitchBend         0xE0
+#define SysexEvent1            0xF0
+#define SysexEvent2            0xF7
+#define MetaEvent              0xFF
+#define MetaEventEndOfTrack    0x2F
+#define MetaEventTempo         0x51
+#define MetaEventTimeSignature 0x58
+
+/** The MidiFile readTrack method from before the MidiDecoder.  Add
+ *  the events of one track to result.  The file offset should be at
+ *  the start of the MTrk header.
+ */
+static void oldReadTrack(MidiFileReader *file, Array *result) {
+    int starttime = 0;
+    const char *hdr = [file readAscii:4];
+
+    if (strncmp(hdr, "MTrk", 4) != 0) {
+        MidiFileException *e =
+           [MidiFileException init:@"Bad MTrk header" offset:([file offset] -4)];
+        @throw e;
+    }
+    int tracklen = [file readInt];
+    int trackend = tracklen + [file offset];
+
+    int eventflag = 0;
+
+    while ([file offset] < trackend) {
+        /* If the midi file is truncated here, we can still recover.
+         * Just return what we've parsed so far.
+         */
+        int deltatime;
+        u_char peekevent;
+        @try {
+            deltatime = [file readVarlen];
+            starttime += deltatime;
+            peekevent = [file peek];
+        }
+        @catch (MidiFileException* e) {
+            return;
+        } 
+
+        MidiEvent *mevent = [[MidiEvent alloc] init];
+        [result add:mevent];
+        [mevent setDeltaTime:deltatime];
+        [mevent setStartTime:starttime];
+
+        if (peekevent >= EventNoteOff) {
+            [mevent setHasEventflag:YES];
+            eventflag = [file readByte];
+        }
+
+        if (eventflag >= EventNoteOn && eventflag < EventNoteOn + 16) {
+            [mevent setEventFlag:EventNoteOn];
+            [mevent setChannel:(u_char)(eventflag - EventNoteOn)];
+            [mevent setNotenumber:[file readByte]];
+            [mevent setVelocity:[file readByte]];
+        }
+        else if (eventflag >= EventNoteOff && eventflag < EventNoteOff + 16) {
+            [mevent setEventFlag:EventNoteOff];
+            [mevent setChannel:(u_char)(eventflag - EventNoteOff)];
+            [mevent setNotenumber:[file readByte]];
+            [mevent setVelocity:[file readByte]];
+        }
+        else if (eventflag >= EventKeyPressure && 
+                 eventflag < EventKeyPressure + 16) {
+            [mevent setEventFlag:EventKeyPressure];
+            [mevent setChannel:(u_char)(eventflag - EventKeyPressure)];
+            [mevent setNotenumber:[file readByte]];
+            [mevent setKeyPressure:[file readByte]];
+        }
+        else if (eventflag >= EventControlChange && 
+                 eventflag < EventControlChange + 16) {
+            [mevent setEventFlag:EventControlChange];
+            [mevent setChannel:(u_char)(eventflag - EventControlChange)];
+            [mevent setControlNum:[file readByte]];
+            [mevent setControlValue:[file readByte]];
+        }
+        else if (eventflag >= EventProgramChange && 
+                 eventflag < EventProgramChange + 16) {
+            [mevent setEventFlag:EventProgramChange];
+            [mevent setChannel:(u_char)(eventflag - EventProgramChange)];
+            [mevent setInstrument:[file readByte]];
+            
+        }
+        else if (eventflag >= EventChannelPressure && 
+                 eventflag < EventChannelPressure + 16) {
+            [mevent setEventFlag:EventChannelPressure];
+            [mevent setChannel:(u_char)(eventflag - EventChannelPressure)];
+            [mevent setChanPressure:[file readByte]];
+        }
+        else if (eventflag >= EventPitchBend && 
+                 eventflag < EventPitchBend + 16) {
+            [mevent setEventFlag:EventPitchBend];
+            [mevent setChannel:(u_char)(eventflag - EventPitchBend)];
+            [mevent setPitchBend:[file readShort]];
+        }
+        else if (eventflag == SysexEvent1) {
+            [mevent setEventFlag:SysexEvent1];
+            [mevent setMetalength:[file readVarlen]];
+            [mevent setMetavalue:[file readBytes:[mevent metalength]] ];
+        }
+        else if (eventflag == SysexEvent2) {
+            [mevent setEventFlag:SysexEvent2];
+            [mevent setMetalength:[file readVarlen]];
+            [mevent setMetavalue:[file readBytes:[mevent metalength]] ];
+        }
+        else if (eventflag == MetaEvent) {
+            [mevent setEventFlag:MetaEvent];
+            [mevent setMetaevent:[file readByte]];
+            [mevent setMetalength:[file readVarlen]];
+            [mevent setMetavalue:[file readBytes:[mevent metalength]] ];
+
+            if ([mevent metaevent] == MetaEventTimeSignature) {
+                if ([mevent metalength] != 4) {
+                    MidiFileException *e = 
+                    [MidiFileException init:@"Bad Meta Event Time Signature len" 
+                      offset:[file offset]];
+                    @throw e;
+                }
+                [mevent setNumerator:[mevent metavalue][0] ];
+                u_char log2 = [mevent metavalue][1];
+                [mevent setDenominator:(int)pow(2, log2)];
+            }
+            else if ([mevent metaevent] == MetaEventTempo) {
+                if ([mevent metalength] != 3) {
+                    MidiFileException *e = 
+                    [MidiFileException init:@"Bad Meta Event Tempo len" 
+                      offset:[file offset]];
+                    @throw e;
+                }
+                u_char *value = [mevent metavalue];
+                [mevent setTempo:((value[0] << 16) | (value[1] << 8) | value[2])];
+            }
+            else if ([mevent metaevent] == MetaEventEndOfTrack) {
+                [mevent release];
+                break; 
+            }
+        }
+        else {
+            MidiFileException *e =
+                [MidiFileException init:@"Unknown event" offset:([file offset] -4)];
+            @throw e;
+        }
+        [mevent release];
+    }
+
+}
+
+/** Free the Sysex/Meta payloads the old parse copied, which its
+ *  MidiEvents don't own.
+ */
+static void freePayloads(Array *events) {
+    for (int i = 0; i < [events count]; i++) {
+        MidiEvent *mevent = [events get:i];
+        u_char flag = [mevent eventFlag];
+        if (flag == SysexEvent1 || flag == SysexEvent2 || flag == MetaEvent) {
+            free([mevent metavalue]);
+            [mevent setMetavalue:NULL];
+        }
+    }
+}
+
+/** Parse every track with the old readTrack.  Return the number of
+ *  events.  A track that fails to parse is skipped, but its events
+ *  are still freed.
+ */
+static long long parseOld(MidiFileReader *file, const int *offsets, int numtracks) {
+    long long numevents = 0;
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    for (int tracknum = 0; tracknum < numtracks; tracknum++) {
+        MidiFileReader *trackfile = [[MidiFileReader alloc] initWithReader:file
+                                                                 atOffset:offsets[tracknum]];
+        Array *events = [Array new:20];
+        @try {
+            oldReadTrack(trackfile, events);
+            numevents += [events count];
+        }
+        @catch (MidiFileException *e) {
+        }
+        @finally {
+            freePayloads(events);
+            [events release];
+            [trackfile release];
+        }
+    }
+    [pool drain];
+    return numevents;
+}
+
+/** Command-line program to time the track parse, before and after
+ *  the MidiDecoder.
+ *  Usage: parsebench <filename> [iterations]
+ */
+int parsebench_main(int argc, char **argv)
+{
+    if (argc == 1) {
+        printf("Usage: parsebench <filename> [iterations]\n");
+        return 1;
+    }
+    int iterations = (argc > 2) ? atoi(argv[2]) : 1000;
+    if (iterations < 1) {
+        iterations = 1;
+    }
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    NSString *path = [NSString stringWithUTF8String:argv[1]];
+    const char *input = [[path lastPathComponent] UTF8String];
+
+    MidiFileReader *file = nil;
+    @try {
+        file = [[MidiFileReader alloc] initWithFile:path];
+    }
+    @catch (MidiFileException *e) {
+        fprintf(stderr, "%s: %s\n", input, [[e reason] UTF8String]);
+        [pool drain];
+        return 1;
+    }
+    MidiHeader header;
+    int erroroffset = 0;
+    int *offsets = NULL;
+    if (midiDecodeHeader([file data], [file datalen], &header, &erroroffset) != MidiDecodeOK ||
+        (offsets = (int*)calloc(header.numtracks, sizeof(int))) == NULL ||
+        midiFindTracks([file data], [file datalen], 14, header.numtracks,
+                       offsets, &erroroffset) != MidiDecodeOK) {
+        fprintf(stderr, "%s: bad Midi file at offset %d\n", input, erroroffset);
+        free(offsets);
+        [file release];
+        [pool drain];
+        return 1;
+    }
+
+    printf("input,events,stage,iterations,ns_per_event,heap_bytes,allocs,peak_rss_kb\n");
+
+    /* readtrack_old: a MidiEvent per event, from a non-mapped reader */
+    long long events = parseOld(file, offsets, header.numtracks);
+    long long allocs = midiBenchAllocations();
+    double start = midiBenchNanos();
+    for (int iter = 0; iter < iterations; iter++) {
+        parseOld(file, offsets, header.numtracks);
+    }
+    midiBenchReport(input, events, "readtrack_old", iterations, midiBenchNanos() - start, 0,
+                    midiBenchAllocationsSince(allocs));
+
+    /* decode: the MidiDecoder, into event stores */
+    long long heapbytes = 0;
+    allocs = midiBenchAllocations();
+    start = midiBenchNanos();
+    for (int iter = 0; iter < iterations; iter++) {
+        heapbytes = 0;
+        for (int tracknum = 0; tracknum < header.numtracks; tracknum++) {
+            MidiEventStore store;
+            midiDecodeTrack([file data], [file datalen], offsets[tracknum], NULL,
+                            &store, &erroroffset);
+            heapbytes += (long long)store.capacity * (4 * sizeof(int) + 3) + store.extracap;
+            eventStoreFree(&store);
+        }
+    }
+    midiBenchReport(input, events, "decode", iterations, midiBenchNanos() - start, heapbytes,
+                    midiBenchAllocationsSince(allocs));
+
+    /* merge_stream: all tracks in time order, nothing stored */
+    allocs = midiBenchAllocations();
+    start = midiBenchNanos();
+    for (int iter = 0; iter < iterations; iter++) {
+        MidiMergeCursor merge;
+        MidiRawEvent event;
+        int tracknum;
+        midiMergeCursorInit(&merge, [file data], [file datalen], NULL, &erroroffset);
+        while (midiMergeCursorNext(&merge, &event, &tracknum) == MidiDecodeOK) {
+        }
+        midiMergeCursorFree(&merge);
+    }
+    midiBenchReport(input, events, "merge_stream", iterations, midiBenchNanos() - start, 0,
+                    midiBenchAllocationsSince(allocs));
+
+    free(offsets);
+    [file release];
+    [pool drain];
+    return 0;
+}
+
+#ifdef PARSEBENCH_MAIN
+int main(int argc, char **argv) {
+    return parsebench_main(argc, argv);
+}
+#endif
@@ -0,0 +1,220 @@
+//
+//  MidiStress.c
+//  MetroGnomeiPad
+//
+//  Copyright (c) 2012 Princeton University. All rights reserved.
+//
+
+/* The stress harness for the MidiDecoder.  It needs no Foundation, so
+ * Tools/Makefile builds it as the midistress program on Mac OS X or
+ * on Linux (make midistress, or make asan to catch out-of-bounds
+ * reads with AddressSanitizer).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "MidiDecoder.h"
+#include "MidiStress.h"
+#include "MidiBenchmark.h"
+
+#define MinStressNanos  50e6   /* Time each file for at least 50 msec */
+#define TimeSlack       3.0    /* Allowed excess over linear time growth */
+#define HeapSlack       2.0    /* Allowed excess over linear memory growth */
+#define MinNanosPerByte 1.0    /* Parses that stop faster than this are timed as this */
+#define HeapPerByte     32     /* The most heap a parse may hold per file byte */
+#define HeapPerTrack    4096   /*   plus this much per track */
+
+const MidiStressCase midiStressCases[] = {
+    /* name                  tracks  rs  overlap  sysex   malformation                  truncate */
+    { "valid",                   16,  50,   5,       0,   MidiSynthValid,                0 },
+    { "one-track",                1,  50,   5,       0,   MidiSynthValid,                0 },
+    { "many-tracks",           1000,  50,   5,       0,   MidiSynthValid,                0 },
+    { "no-running-status",       16,   0,   5,       0,   MidiSynthValid,                0 },
+    { "all-running-status",      16, 100,   5,       0,   MidiSynthValid,                0 },
+    { "overlapping-notes",       16,  50,  90,       0,   MidiSynthValid,                0 },
+    { "large-sysex",             16,  50,   5,   65536,   MidiSynthValid,                0 },
+    { "truncated-half",          16,  50,   5,       0,   MidiSynthValid,               50 },
+    { "truncated-sysex",          1,  50,   5, 1 << 20,   MidiSynthValid,                1 },
+    { "bad-header-length",       16,  50,   5,       0,   MidiSynthBadHeaderLength,      0 },
+    { "extra-tracks",            16,  50,   5,       0,   MidiSynthExtraTracks,          0 },
+    { "long-track-length",       16,  50,   5,       0,   MidiSynthLongTrackLength,      0 },
+    { "negative-track-length",   16,  50,   5,       0,   MidiSynthNegativeTrackLength,  0 },
+    { "no-end-of-track",         16,  50,   5,       0,   MidiSynthNoEndOfTrack,         0 },
+    { "missing-status",          16,  50,   5,       0,   MidiSynthMissingStatus,        0 },
+    { "long-sysex",              16,  50,   5,       0,   MidiSynthLongSysex,            0 },
+    { "huge-deltas",             16,  50,   5,       0,   MidiSynthHugeDeltas,           0 },
+    { "long-varlen",             16,  50,   5,       0,   MidiSynthLongVarlen,           0 },
+};
+const int midiStressCaseCount = sizeof(midiStressCases) / sizeof(midiStressCases[0]);
+
+/** Fill in the synth options for the given case and number of events */
+void midiStressOptions(const MidiStressCase *stresscase, int numevents,
+                       MidiSynthOptions *options) {
+    midiSynthDefaults(options);
+    options->numtracks = stresscase->numtracks;
+    options->numevents = numevents;
+    options->runningstatus = stresscase->runningstatus;
+    options->overlap = stresscase->overlap;
+    options->sysexsize = stresscase->sysexsize;
+    options->malformation = stresscase->malformation;
+    options->truncate = stresscase->truncate;
+}
+
+/** Check that going from the small file to the large one, the time
+ *  and memory grew no faster than the input.  The input grew by the
+ *  size ratio in bytes and by MidiStressScale in events, so allow the
+ *  larger of the two.  Print the result, and return 0 if it passed.
+ */
+int midiStressCheck(const char *name, int smallbytes, int largebytes,
+                    double smallnanos, double largenanos,
+                    long long smallheap, long long largeheap) {
+    double sizeratio = (smallbytes > 0) ? (double)largebytes / smallbytes : 1;
+    if (sizeratio < MidiStressScale) {
+        sizeratio = MidiStressScale;
+    }
+    if (smallnanos < smallbytes * MinNanosPerByte) {
+        smallnanos = smallbytes * MinNanosPerByte;
+    }
+    double timeratio = (smallnanos > 0) ? largenanos / smallnanos : 1;
+    int timeok = timeratio <= sizeratio * TimeSlack;
+    int heapok = largeheap <= smallheap * sizeratio * HeapSlack + HeapPerTrack * 16;
+    printf("%s,linear,time_ratio=%.2f,input_ratio=%.2f,%s\n", name, timeratio, sizeratio,
+           (timeok && heapok) ? "ok" : (timeok ? "FAIL heap" : "FAIL time"));
+    return (timeok && heapok) ? 0 : 1;
+}
+
+/** Parse the file the way MidiFile does: the header, the track
+ *  offsets, then each track, stopping at the first error.  Return the
+ *  decode result, and the heap held by the parsed tracks.
+ */
+static int stressParse(const u_char *data, int datalen, long long *heapbytes) {
+    MidiHeader header;
+    int erroroffset = 0;
+    *heapbytes = 0;
+    int result = midiDecodeHeader(data, datalen, &header, &erroroffset);
+    if (result != MidiDecodeOK) {
+        return result;
+    }
+    int *offsets = (int*)calloc(header.numtracks + 1, sizeof(int));
+    MidiEventStore *stores = (MidiEventStore*)calloc(header.numtracks + 1, sizeof(MidiEventStore));
+    *heapbytes = (long long)(header.numtracks + 1) * (sizeof(int) + sizeof(MidiEventStore));
+    result = midiFindTracks(data, datalen, 14, header.numtracks, offsets, &erroroffset);
+    int numstores = 0;
+    for (int tracknum = 0; result == MidiDecodeOK && tracknum < header.numtracks; tracknum++) {
+        result = midiDecodeTrack(data, datalen, offsets[tracknum], NULL,
+                                 &stores[tracknum], &erroroffset);
+        numstores++;
+        *heapbytes += (long long)stores[tracknum].capacity * (4 * sizeof(int) + 3) +
+                      stores[tracknum].extracap;
+    }
+    eventStoreFreeList(stores, numstores);
+    free(offsets);
+    return result;
+}
+
+/** Time the parse of one file.  Return the nanoseconds per parse */
+static double stressTime(const char *name, const u_char *data, int datalen,
+                         int *result, long long *heapbytes, int *failed) {
+    int iterations = 0;
+    double start = midiBenchNanos();
+    double elapsed = 0;
+    do {
+        *result = stressParse(data, datalen, heapbytes);
+        iterations++;
+        elapsed = midiBenchNanos() - start;
+    } while (elapsed < MinStressNanos);
+
+    int numtracks = (datalen >= 12) ? ((data[10] << 8) | data[11]) : 0;
+    long long maxheap = (long long)datalen * HeapPerByte + (long long)(numtracks + 1) * HeapPerTrack;
+    printf("%s,%d,%s,%.2f,%lld,%s\n", name, datalen, midiDecodeErrorString(*result),
+           elapsed / iterations / (datalen > 0 ? datalen : 1), *heapbytes,
+           (*heapbytes <= maxheap) ? "ok" : "FAIL heap");
+    if (*heapbytes > maxheap) {
+        *failed = 1;
+    }
+    return elapsed / iterations;
+}
+
+/** Parse every prefix of a small file, to check that a truncation at
+ *  any byte is caught (run it under AddressSanitizer).  Return the
+ *  number of prefixes that parsed without error.
+ */
+static int stressTruncations(const MidiStressCase *stresscase) {
+    MidiSynthOptions options;
+    int len = 0;
+    long long heapbytes;
+    int numok = 0;
+    midiStressOptions(stresscase, 200, &options);
+    options.numtracks = 4;
+    if (options.sysexsize > 64) {
+        options.sysexsize = 64;
+    }
+    u_char *data = midiSynthGenerate(&options, &len);
+    for (int prefix = 0; prefix <= len; prefix++) {
+        /* Copy the prefix, so reads past its end are caught */
+        u_char *copy = (u_char*)malloc(prefix > 0 ? prefix : 1);
+        memcpy(copy, data, prefix);
+        if (stressParse(copy, prefix, &heapbytes) == MidiDecodeOK) {
+            numok++;
+        }
+        free(copy);
+    }
+    free(data);
+    return numok;
+}
+
+/** Command-line program to stress the MidiDecoder.
+ *  Usage: midistress [-dump directory]
+ *  With -dump, the small file of each case is also written to the
+ *  given directory, as <case>.mid, to reproduce a failure.
+ *  Return 0 if every case parsed in linear time and memory.
+ */
+int midistress_main(int argc, char **argv) {
+    const char *dumpdir = NULL;
+    int failed = 0;
+    if (argc > 2 && strcmp(argv[1], "-dump") == 0) {
+        dumpdir = argv[2];
+    }
+    printf("case,bytes,result,ns_per_byte,heap_bytes,status\n");
+    for (int c = 0; c < midiStressCaseCount; c++) {
+        const MidiStressCase *stresscase = &midiStressCases[c];
+        MidiSynthOptions options;
+        int smalllen = 0, largelen = 0, result = 0;
+        long long smallheap = 0, largeheap = 0;
+
+        midiStressOptions(stresscase, MidiStressSmall, &options);
+        u_char *small = midiSynthGenerate(&options, &smalllen);
+        midiStressOptions(stresscase, MidiStressSmall * MidiStressScale, &options);
+        u_char *large = midiSynthGenerate(&options, &largelen);
+
+        if (dumpdir != NULL) {
+            char path[1024];
+            snprintf(path, sizeof(path), "%s/%s.mid", dumpdir, stresscase->name);
+            FILE *fp = fopen(path, "wb");
+            if (fp != NULL) {
+                fwrite(small, 1, smalllen, fp);
+                fclose(fp);
+            }
+        }
+
+        double smallnanos = stressTime(stresscase->name, small, smalllen, &result,
+                                       &smallheap, &failed);
+        double largenanos = stressTime(stresscase->name, large, largelen, &result,
+                                       &largeheap, &failed);
+        failed |= midiStressCheck(stresscase->name, smalllen, largelen,
+                                  smallnanos, largenanos, smallheap, largeheap);
+        int numok = stressTruncations(stresscase);
+        printf("%s,truncations,%d prefixes parsed\n", stresscase->name, numok);
+        free(small);
+        free(large);
+    }
+    printf("%s\n", failed ? "FAILED" : "PASSED");
+    return failed;
+}
+
+#ifdef MIDISTRESS_MAIN
+int main(int argc, char **argv) {
+    return midistress_main(argc, argv);
+}
+#endif
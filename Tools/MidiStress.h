@@ -0,0 +1,46 @@
+//
+//  MidiStress.h
+//  MetroGnomeiPad
+//
+//  Copyright (c) 2012 Princeton University. All rights reserved.
+//
+
+#ifndef MetroGnomeiPad_MidiStress_h
+#define MetroGnomeiPad_MidiStress_h
+
+#include "MidiSynth.h"
+
+/* The stress harness feeds valid and malformed synthetic Midi files
+ * to the parser, at two sizes, and checks that the parse time and
+ * memory grow no faster than the file size.  midistress_main() in
+ * MidiStress.c drives the MidiDecoder directly; filestress_main() in
+ * MidiFileBenchmark.m drives MidiFile initWithFile:.
+ */
+
+/** @struct MidiStressCase
+ * One shape of input file.
+ */
+typedef struct _MidiStressCase {
+    const char *name;
+    int numtracks;
+    int runningstatus;   /** See MidiSynthOptions */
+    int overlap;
+    int sysexsize;
+    int malformation;
+    int truncate;
+} MidiStressCase;
+
+extern const MidiStressCase midiStressCases[];
+extern const int midiStressCaseCount;
+
+#define MidiStressSmall  20000    /* The events in the small file of each case */
+#define MidiStressScale  10       /* The large file has this many times more */
+
+void midiStressOptions(const MidiStressCase *stresscase, int numevents,
+                       MidiSynthOptions *options);
+int  midiStressCheck(const char *name, int smallbytes, int largebytes,
+                     double smallnanos, double largenanos,
+                     long long smallheap, long long largeheap);
+int  midistress_main(int argc, char **argv);
+
+#endif
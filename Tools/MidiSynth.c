@@ -0,0 +1,249 @@
+//
+//  MidiSynth.c
+//  MetroGnomeiPad
+//
+//  Copyright (c) 2012 Princeton University. All rights reserved.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "MidiSynth.h"
+
+#define MaxOpenNotes 16
+
+/** A growable output buffer */
+typedef struct _SynthBuffer {
+    u_char *data;
+    int len;
+    int capacity;
+} SynthBuffer;
+
+static void bufferReserve(SynthBuffer *buf, int n) {
+    if (buf->len + n <= buf->capacity)
+        return;
+    int newcapacity = buf->capacity * 2;
+    if (newcapacity < buf->len + n)
+        newcapacity = buf->len + n;
+    buf->data = (u_char*)realloc(buf->data, newcapacity);
+    buf->capacity = newcapacity;
+}
+
+static void bufferByte(SynthBuffer *buf, u_char b) {
+    bufferReserve(buf, 1);
+    buf->data[buf->len++] = b;
+}
+
+static void bufferInt(SynthBuffer *buf, int value, int numbytes) {
+    bufferReserve(buf, numbytes);
+    for (int i = numbytes - 1; i >= 0; i--) {
+        buf->data[buf->len++] = (u_char)((value >> (8 * i)) & 0xFF);
+    }
+}
+
+static void bufferVarlen(SynthBuffer *buf, int value) {
+    u_char bytes[4];
+    int n = 0;
+    bytes[n++] = (u_char)(value & 0x7F);
+    while ((value >>= 7) > 0 && n < 4) {
+        bytes[n++] = (u_char)(0x80 | (value & 0x7F));
+    }
+    bufferReserve(buf, n);
+    while (n > 0) {
+        buf->data[buf->len++] = bytes[--n];
+    }
+}
+
+/** A small xorshift random number generator */
+static unsigned int synthRandom(unsigned int *state) {
+    unsigned int x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+/** Return true with the given percent probability */
+static int synthChance(unsigned int *state, int percent) {
+    return (int)(synthRandom(state) % 100) < percent;
+}
+
+/** Write a channel event, omitting the status byte when running status
+ *  allows it and the options ask for it.
+ */
+static void synthChannelEvent(SynthBuffer *buf, const MidiSynthOptions *options,
+                              unsigned int *state, int delta, u_char *laststatus,
+                              u_char status, u_char data1, int data2) {
+    bufferVarlen(buf, delta);
+    if (status != *laststatus || !synthChance(state, options->runningstatus)) {
+        bufferByte(buf, status);
+    }
+    *laststatus = status;
+    bufferByte(buf, data1);
+    if (data2 >= 0) {
+        bufferByte(buf, (u_char)data2);
+    }
+}
+
+/** Write one MTrk chunk with the given number of channel events */
+static void synthTrack(SynthBuffer *buf, const MidiSynthOptions *options,
+                       unsigned int *state, int tracknum, int numevents) {
+    bufferReserve(buf, 8);
+    memcpy(&buf->data[buf->len], "MTrk", 4);
+    buf->len += 4;
+    int lenoffset = buf->len;
+    bufferInt(buf, 0, 4);
+    int start = buf->len;
+    int malformation = options->malformation;
+
+    if (tracknum == 0) {
+        /* Tempo 500000, time signature 4/4 */
+        bufferVarlen(buf, 0);
+        bufferByte(buf, 0xFF); bufferByte(buf, 0x51); bufferByte(buf, 3);
+        bufferInt(buf, 500000, 3);
+        bufferVarlen(buf, 0);
+        bufferByte(buf, 0xFF); bufferByte(buf, 0x58); bufferByte(buf, 4);
+        bufferByte(buf, 4); bufferByte(buf, 2); bufferByte(buf, 24); bufferByte(buf, 8);
+    }
+    int sysexsize = options->sysexsize;
+    if (malformation == MidiSynthLongSysex && sysexsize < 16) {
+        sysexsize = 16;
+    }
+    if (sysexsize > 0) {
+        bufferVarlen(buf, 0);
+        bufferByte(buf, 0xF0);
+        bufferVarlen(buf, (malformation == MidiSynthLongSysex) ? 0x0FFFFFFF : sysexsize);
+        bufferReserve(buf, sysexsize);
+        memset(&buf->data[buf->len], 0x7F, sysexsize);
+        buf->data[buf->len + sysexsize - 1] = 0xF7;
+        buf->len += sysexsize;
+    }
+
+    u_char channel = (u_char)(tracknum % 16);
+    u_char laststatus = 0;
+    u_char open[MaxOpenNotes];
+    int numopen = 0;
+    int maxdelta = options->quarternote / 2 + 1;
+
+    if (malformation == MidiSynthLongVarlen) {
+        /* A varlen has at most 4 bytes.  The 5th byte looks like a data byte. */
+        bufferByte(buf, 0x81); bufferByte(buf, 0x80); bufferByte(buf, 0x80); bufferByte(buf, 0x80);
+    }
+    else if (malformation == MidiSynthMissingStatus) {
+        /* A NoteOn's data bytes, with no status byte before them */
+        bufferVarlen(buf, 0);
+        bufferByte(buf, 60); bufferByte(buf, 64);
+    }
+
+    for (int i = 0; i < numevents; i++) {
+        int delta = synthRandom(state) % maxdelta;
+        if (malformation == MidiSynthHugeDeltas) {
+            delta = 0x0FFFFFFF;
+        }
+        if (synthChance(state, options->controlchanges)) {
+            if (synthChance(state, 50)) {
+                synthChannelEvent(buf, options, state, delta, &laststatus,
+                                  0xB0 | channel, 64, synthRandom(state) % 128);
+            }
+            else {
+                synthChannelEvent(buf, options, state, delta, &laststatus,
+                                  0xE0 | channel, synthRandom(state) % 128, synthRandom(state) % 128);
+            }
+        }
+        else if (numopen == MaxOpenNotes || (numopen > 0 && synthChance(state, 50))) {
+            /* End a random open note, with a NoteOff or a NoteOn of velocity 0 */
+            int n = synthRandom(state) % numopen;
+            u_char number = open[n];
+            open[n] = open[--numopen];
+            if (synthChance(state, 50)) {
+                synthChannelEvent(buf, options, state, delta, &laststatus,
+                                  0x80 | channel, number, 0);
+            }
+            else {
+                synthChannelEvent(buf, options, state, delta, &laststatus,
+                                  0x90 | channel, number, 0);
+            }
+        }
+        else {
+            u_char number;
+            if (numopen > 0 && synthChance(state, options->overlap)) {
+                number = open[synthRandom(state) % numopen];
+            }
+            else {
+                number = (u_char)(36 + synthRandom(state) % 60);
+            }
+            open[numopen++] = number;
+            synthChannelEvent(buf, options, state, delta, &laststatus,
+                              0x90 | channel, number, 1 + synthRandom(state) % 127);
+        }
+    }
+    while (numopen > 0) {
+        synthChannelEvent(buf, options, state, 1, &laststatus,
+                          0x80 | channel, open[--numopen], 0);
+    }
+
+    if (malformation != MidiSynthNoEndOfTrack) {
+        bufferVarlen(buf, 0);
+        bufferByte(buf, 0xFF); bufferByte(buf, 0x2F); bufferByte(buf, 0);
+    }
+
+    int tracklen = buf->len - start;
+    if (malformation == MidiSynthLongTrackLength) {
+        tracklen = 0x7FFFFFF0;
+    }
+    else if (malformation == MidiSynthNegativeTrackLength) {
+        tracklen = -16;
+    }
+    for (int i = 0; i < 4; i++) {
+        buf->data[lenoffset + i] = (u_char)((tracklen >> (8 * (3 - i))) & 0xFF);
+    }
+}
+
+/** Fill in the default options: 2 tracks, 1000 events, some running
+ *  status, control changes and overlapping notes.
+ */
+void midiSynthDefaults(MidiSynthOptions *options) {
+    options->numtracks = 2;
+    options->numevents = 1000;
+    options->quarternote = 192;
+    options->runningstatus = 50;
+    options->controlchanges = 20;
+    options->overlap = 5;
+    options->sysexsize = 0;
+    options->malformation = MidiSynthValid;
+    options->truncate = 0;
+    options->seed = 12345;
+}
+
+/** Generate a Midi file with the given options.  Return the file data,
+ *  allocated with malloc, and its length (after any truncation).
+ */
+u_char* midiSynthGenerate(const MidiSynthOptions *options, int *length) {
+    SynthBuffer buf;
+    int numtracks = (options->numtracks > 0) ? options->numtracks : 1;
+    buf.len = 0;
+    buf.capacity = 64 + options->numevents * 4;
+    buf.data = (u_char*)malloc(buf.capacity);
+    unsigned int state = options->seed ? options->seed : 1;
+
+    bufferReserve(&buf, 14);
+    memcpy(buf.data, "MThd", 4);
+    buf.len = 4;
+    bufferInt(&buf, (options->malformation == MidiSynthBadHeaderLength) ? 7 : 6, 4);
+    bufferInt(&buf, (numtracks > 1) ? 1 : 0, 2);
+    bufferInt(&buf, (options->malformation == MidiSynthExtraTracks) ? numtracks + 10 : numtracks, 2);
+    bufferInt(&buf, options->quarternote, 2);
+
+    for (int tracknum = 0; tracknum < numtracks; tracknum++) {
+        int numevents = options->numevents / numtracks;
+        if (tracknum < options->numevents % numtracks) {
+            numevents++;
+        }
+        synthTrack(&buf, options, &state, tracknum, numevents);
+    }
+    if (options->truncate > 0 && options->truncate < 100) {
+        buf.len = (int)((long long)buf.len * options->truncate / 100);
+    }
+    *length = buf.len;
+    return buf.data;
+}
@@ -0,0 +1,53 @@
+//
+//  MidiSynth.h
+//  MetroGnomeiPad
+//
+//  Copyright (c) 2012 Princeton University. All rights reserved.
+//
+
+#ifndef MetroGnomeiPad_MidiSynth_h
+#define MetroGnomeiPad_MidiSynth_h
+
+#include <sys/types.h>
+
+/* MidiSynth generates synthetic Standard Midi Files, for benchmarks
+ * and stress tests.  The output is deterministic for a given seed.
+ * It can also make deliberately malformed files, with one of the
+ * defects below, to reproduce the broken files found on the internet.
+ */
+
+/* The deliberate defects, for MidiSynthOptions.malformation */
+enum {
+    MidiSynthValid = 0,            /** A well-formed file */
+    MidiSynthBadHeaderLength,      /** The MThd length is not 6 */
+    MidiSynthExtraTracks,          /** The MThd claims more tracks than there are */
+    MidiSynthLongTrackLength,      /** Each MTrk length runs far past the end of the file */
+    MidiSynthNegativeTrackLength,  /** Each MTrk length is negative */
+    MidiSynthNoEndOfTrack,         /** The tracks have no EndOfTrack event */
+    MidiSynthMissingStatus,        /** The first channel event has no status byte */
+    MidiSynthLongSysex,            /** The sysex length runs far past the end of the file */
+    MidiSynthHugeDeltas,           /** Every delta time is the largest varlen, 0x0FFFFFFF */
+    MidiSynthLongVarlen,           /** The first delta time of each track has 5 bytes */
+    MidiSynthMalformationCount
+};
+
+/** @struct MidiSynthOptions
+ * The shape of the generated file.
+ */
+typedef struct _MidiSynthOptions {
+    int numtracks;       /** The number of MTrk chunks */
+    int numevents;       /** The number of channel events, spread over the tracks */
+    int quarternote;     /** Pulses per quarter note */
+    int runningstatus;   /** Percent (0-100) of events that omit a repeated status byte */
+    int controlchanges;  /** Percent of events that are control changes or pitch bends */
+    int overlap;         /** Percent of NoteOns on a key that is already sounding */
+    int sysexsize;       /** The size of a sysex event at the start of each track, 0 for none */
+    int malformation;    /** MidiSynthValid, or the defect to put in the file */
+    int truncate;        /** If 1-99, keep only that percent of the file */
+    unsigned int seed;   /** The random number seed */
+} MidiSynthOptions;
+
+void    midiSynthDefaults(MidiSynthOptions *options);
+u_char* midiSynthGenerate(const MidiSynthOptions *options, int *length);
+
+#endif
@@ -0,0 +1,188 @@
+//
+//  SplitCheck.c
+//  MetroGnomeiPad
+//
+//  Copyright (c) 2012 Princeton University. All rights reserved.
+//
+
+/* The differential check for the HandSplitter.  It compares the high
+ * and low notes of handSplitterHighLow() against a plain C port of
+ * the scan that MidiFile splitTrack has always done (findHighLowNotes
+ * and findExactHighLowNotes, for each note), on random tracks.  It
+ * needs no Foundation, so Tools/Makefile builds it as the splitcheck
+ * program on Mac OS X or on Linux.
+ *
+ *   splitcheck [tracks] [seed]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "HandSplitter.h"
+
+#define SplitCheckTracks  20000   /* The random tracks to check by default */
+#define SplitCheckNotes   200     /* The most notes in a track */
+
+/** A small xorshift random number generator, as in MidiSynth.c */
+static unsigned int checkRandom(unsigned int *state) {
+    unsigned int x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+/** Return a random number from 0 to n-1 */
+static int checkUniform(unsigned int *state, int n) {
+    return (int)(checkRandom(state) % n);
+}
+
+/** Find the highest and lowest notes that overlap the interval of
+ *  note i, limited to a measure, starting the scan at startindex.
+ *  This is MidiFile findHighLowNotes.
+ */
+static void scanOverlap(const int *start, const int *end, const int *number, int count,
+                        int measurelen, int startindex, int i, int *high, int *low) {
+    int starttime = start[i];
+    int endtime = end[i];
+    if (starttime + measurelen < endtime) {
+        endtime = starttime + measurelen;
+    }
+    for (int j = startindex; j < count; j++) {
+        if (start[j] >= endtime)
+            break;
+        if (end[j] < starttime)
+            continue;
+        if (start[j] + measurelen < starttime)
+            continue;
+        if (*high < number[j])
+            *high = number[j];
+        if (*low > number[j])
+            *low = number[j];
+    }
+}
+
+/** Find the highest and lowest notes that start at the same time as
+ *  note i.  This is MidiFile findExactHighLowNotes.
+ */
+static void scanExact(const int *start, const int *number, int count,
+                      int startindex, int i, int *high, int *low) {
+    int j = startindex;
+    while (start[j] < start[i]) {
+        j++;
+    }
+    for (; j < count && start[j] == start[i]; j++) {
+        if (*high < number[j])
+            *high = number[j];
+        if (*low > number[j])
+            *low = number[j];
+    }
+}
+
+/** Find the high/low notes of each note by scanning, the way
+ *  MidiFile scanHighLowNotes does.
+ */
+static void scanHighLow(const int *start, const int *end, const int *number, int count,
+                        int measurelen, int *high, int *low, int *highExact, int *lowExact) {
+    int startindex = 0;
+    for (int i = 0; i < count; i++) {
+        high[i] = low[i] = highExact[i] = lowExact[i] = number[i];
+        while (end[startindex] < start[i]) {
+            startindex++;
+        }
+        scanOverlap(start, end, number, count, measurelen, startindex, i, &high[i], &low[i]);
+        scanExact(start, number, count, startindex, i, &highExact[i], &lowExact[i]);
+    }
+}
+
+/** Fill in a random track of count notes, sorted by start time, then
+ *  number, the way combineToSingleTrack returns them.  Chords, zero
+ *  length notes, and notes longer than a measure are all common.
+ */
+static void randomTrack(unsigned int *state, int count, int measurelen,
+                        int *start, int *end, int *number) {
+    int time = 0;
+    int minkey = checkUniform(state, 100);
+    int range = 1 + checkUniform(state, 28);
+    for (int i = 0; i < count; i++) {
+        if (i > 0 && checkUniform(state, 100) >= 40) {
+            time += checkUniform(state, measurelen / 2 + 1);
+        }
+        int duration;
+        switch (checkUniform(state, 4)) {
+            case 0:  duration = 0; break;
+            case 1:  duration = checkUniform(state, 3 * measurelen); break;
+            default: duration = checkUniform(state, measurelen / 2 + 1); break;
+        }
+        int key = minkey + checkUniform(state, range);
+        int j = i;
+        while (j > 0 && start[j-1] == time && number[j-1] > key) {
+            start[j] = start[j-1];
+            end[j] = end[j-1];
+            number[j] = number[j-1];
+            j--;
+        }
+        start[j] = time;
+        end[j] = time + duration;
+        number[j] = key;
+    }
+}
+
+static const char *checkNames[] = { "high", "low", "highExact", "lowExact" };
+
+/** Check the given number of random tracks.  Print the first note
+ *  that differs.  Return 0 if the HandSplitter agrees with scanning on
+ *  every note.
+ */
+int splitcheck_main(int argc, char **argv) {
+    int numtracks = (argc > 1) ? atoi(argv[1]) : SplitCheckTracks;
+    unsigned int state = (argc > 2) ? (unsigned int)strtoul(argv[2], NULL, 10) : 12345;
+    if (state == 0)
+        state = 1;
+
+    int *start = (int*)malloc(3 * SplitCheckNotes * sizeof(int));
+    int *end = &start[SplitCheckNotes];
+    int *number = &start[2 * SplitCheckNotes];
+    int *fast = (int*)malloc(4 * SplitCheckNotes * sizeof(int));
+    int *scan = (int*)malloc(4 * SplitCheckNotes * sizeof(int));
+    long long numnotes = 0;
+    int failed = 0, t;
+
+    for (t = 0; t < numtracks && !failed; t++) {
+        int count = 1 + checkUniform(&state, SplitCheckNotes);
+        int measurelen = 1 + checkUniform(&state, 960);
+        randomTrack(&state, count, measurelen, start, end, number);
+
+        scanHighLow(start, end, number, count, measurelen,
+                    scan, &scan[count], &scan[2*count], &scan[3*count]);
+        if (!handSplitterHighLow(start, end, number, count, measurelen,
+                                 fast, &fast[count], &fast[2*count], &fast[3*count])) {
+            fprintf(stderr, "track %d: the HandSplitter rejected a sorted track\n", t);
+            failed = 1;
+        }
+        for (int i = 0; i < 4*count && !failed; i++) {
+            if (fast[i] != scan[i]) {
+                int n = i % count;
+                fprintf(stderr, "track %d (%d notes, measure %d): note %d (start %d, end %d, "
+                        "number %d) %s is %d, scanning gives %d\n",
+                        t, count, measurelen, n, start[n], end[n], number[n],
+                        checkNames[i / count], fast[i], scan[i]);
+                failed = 1;
+            }
+        }
+        numnotes += count;
+    }
+
+    printf("%d tracks, %lld notes\n", t, numnotes);
+    printf("%s\n", failed ? "FAILED" : "PASSED");
+    free(start);
+    free(fast);
+    free(scan);
+    return failed;
+}
+
+#ifdef SPLITCHECK_MAIN
+int main(int argc, char **argv) {
+    return splitcheck_main(argc, argv);
+}
+#endif
@@ -0,0 +1,142 @@
+//
+//  HandSplitter.c
+//  MetroGnomeiPad
+//
+//  Copyright (c) 2012 Princeton University. All rights reserved.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "HandSplitter.h"
+
+/** The sliding windows of all the note numbers.  The notes of each
+ *  number are stored together: key k uses entries offset[k] up to
+ *  offset[k+1] of bykey and deque.
+ */
+typedef struct _HandWindows {
+    int offset[HandSplitterKeys + 1];
+    int next[HandSplitterKeys];    /** The cursor into bykey: the next note at or after the start time */
+    int head[HandSplitterKeys];    /** The front of the deque */
+    int tail[HandSplitterKeys];    /** One past the back of the deque */
+    int *bykey;                    /** The notes of each key, in start time order */
+    int *deque;                    /** The deque of each key */
+} HandWindows;
+
+/** Return true if a note with the given key overlaps the interval
+ *  [starttime, endtime), limited to notes that started no more than
+ *  measurelen before starttime.  This is the test that
+ *  findHighLowNotes applies to each note it scans.
+ */
+static inline int keySounds(HandWindows *w, const int *start, const int *end, int key,
+                            int starttime, int endtime, int measurelen) {
+    /* A note that started before starttime, and still sounds at it */
+    while (w->head[key] < w->tail[key] &&
+           start[w->deque[w->head[key]]] + measurelen < starttime) {
+        w->head[key]++;
+    }
+    if (w->head[key] < w->tail[key] && end[w->deque[w->head[key]]] >= starttime) {
+        return 1;
+    }
+    /* A note that starts at or after starttime, before the end */
+    int next = w->next[key];
+    return next < w->offset[key + 1] && start[w->bykey[next]] < endtime;
+}
+
+/** Fill in the high, low, highExact and lowExact notes of each note,
+ *  as described in HandSplitter.h.  The notes must be sorted by start
+ *  time, as combineToSingleTrack returns them.  Return false (and
+ *  fill in nothing) if they aren't, or a note ends before it starts,
+ *  so the caller can fall back to scanning.
+ */
+int handSplitterHighLow(const int *start, const int *end, const int *number,
+                        int count, int measurelen, int *high, int *low,
+                        int *highExact, int *lowExact) {
+    int minkey = HandSplitterKeys, maxkey = -1;
+    for (int i = 0; i < count; i++) {
+        if ((i > 0 && start[i] < start[i-1]) || end[i] < start[i] ||
+            number[i] < 0 || number[i] >= HandSplitterKeys) {
+            return 0;
+        }
+        if (minkey > number[i])
+            minkey = number[i];
+        if (maxkey < number[i])
+            maxkey = number[i];
+    }
+    if (count <= 0) {
+        return 1;
+    }
+
+    HandWindows *w = (HandWindows*)calloc(1, sizeof(HandWindows));
+    w->bykey = (int*)malloc(count * sizeof(int));
+    w->deque = (int*)malloc(count * sizeof(int));
+    for (int i = 0; i < count; i++) {
+        w->offset[number[i] + 1]++;
+    }
+    for (int k = 0; k < HandSplitterKeys; k++) {
+        w->offset[k + 1] += w->offset[k];
+        w->next[k] = w->head[k] = w->tail[k] = w->offset[k];
+    }
+    for (int i = 0; i < count; i++) {
+        int k = number[i];
+        w->bykey[w->next[k]++] = i;
+    }
+    for (int k = 0; k < HandSplitterKeys; k++) {
+        w->next[k] = w->offset[k];
+    }
+
+    int added = 0;        /* The notes before this are in the deques */
+    int groupend = 0;     /* The end of the notes with this start time */
+    int groupHigh = 0, groupLow = 0;
+    for (int i = 0; i < count; i++) {
+        int starttime = start[i];
+        int endtime = end[i];
+        if (starttime + measurelen < endtime) {
+            endtime = starttime + measurelen;
+        }
+
+        /* Move the notes that started before this one into the deques.
+         * A note with a later (or equal) end replaces the ones behind it.
+         */
+        while (added < count && start[added] < starttime) {
+            int k = number[added];
+            while (w->tail[k] > w->head[k] && end[w->deque[w->tail[k] - 1]] <= end[added]) {
+                w->tail[k]--;
+            }
+            w->deque[w->tail[k]++] = added;
+            w->next[k]++;
+            added++;
+        }
+
+        /* The notes that start at exactly this time */
+        if (i >= groupend) {
+            groupHigh = groupLow = number[i];
+            for (groupend = i; groupend < count && start[groupend] == starttime; groupend++) {
+                if (groupHigh < number[groupend])
+                    groupHigh = number[groupend];
+                if (groupLow > number[groupend])
+                    groupLow = number[groupend];
+            }
+        }
+        highExact[i] = groupHigh;
+        lowExact[i] = groupLow;
+
+        high[i] = low[i] = number[i];
+        for (int k = maxkey; k > number[i]; k--) {
+            if (keySounds(w, start, end, k, starttime, endtime, measurelen)) {
+                high[i] = k;
+                break;
+            }
+        }
+        for (int k = minkey; k < number[i]; k++) {
+            if (keySounds(w, start, end, k, starttime, endtime, measurelen)) {
+                low[i] = k;
+                break;
+            }
+        }
+    }
+
+    free(w->bykey);
+    free(w->deque);
+    free(w);
+    return 1;
+}
@@ -0,0 +1,44 @@
+//
+//  HandSplitter.h
+//  MetroGnomeiPad
+//
+//  Copyright (c) 2012 Princeton University. All rights reserved.
+//
+
+#ifndef MetroGnomeiPad_HandSplitter_h
+#define MetroGnomeiPad_HandSplitter_h
+
+#include <sys/types.h>
+
+/* The HandSplitter finds, for each note of a track, the high and low
+ * notes that MidiFile splitTrack uses to choose the left or right hand:
+ *
+ * high, low           - The highest/lowest note that overlaps the note,
+ *                       within a measure of it.  This is what
+ *                       MidiFile findHighLowNotes computes.
+ * highExact, lowExact - The highest/lowest note that starts at the
+ *                       same time.  This is what findExactHighLowNotes
+ *                       computes.
+ *
+ * Both include the note itself.  findHighLowNotes rescans a measure
+ * of notes for every note.  Instead, the HandSplitter keeps one
+ * sliding window per note number:
+ *
+ * - The notes that started in the last measure, in a deque kept in
+ *   decreasing order of end time.  The note number sounds at a start
+ *   time if the front of its deque ends at or after it.
+ * - A cursor to the next note with that number that starts at or
+ *   after the start time.
+ *
+ * Both only move forward, so the windows cost O(notes) in total.
+ * Each query scans the note numbers above (or below) the note, up to
+ * the first one found, so it is bounded by the range of the track.
+ */
+
+#define HandSplitterKeys  256   /** One window per note number */
+
+int handSplitterHighLow(const int *starttime, const int *endtime, const int *number,
+                        int count, int measurelen, int *high, int *low,
+                        int *highExact, int *lowExact);
+
+#endif
@@ -0,0 +1,295 @@
+//
+//  MeterDetector.c
+//  MetroGnomeiPad
+//
+//  Copyright (c) 2012 Princeton University. All rights reserved.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "MeterDetector.h"
+
+#define MeterMultipleRatio  0.9   /** See meterRank */
+#define MeterBeatSpread     0.7   /** See meterTempo: the spread of the weight, in octaves */
+#define MeterBeatTolerance  2     /** See meterTempo: the bins a multiple of the beat may be off */
+
+/** The number of autocorrelation lags meterAutocorrelate fills in:
+ *  up to twice the longest measure, for the score of meterRank.
+ */
+int meterLagCount(void) {
+    return 2 * (MeterMaxMicros / MeterBinMicros) + 2;
+}
+
+/** An in-place radix-2 FFT of (re, im).  The length n is a power of 2 */
+static void fft(double *re, double *im, int n) {
+    for (int i = 1, j = 0; i < n; i++) {
+        int bit = n >> 1;
+        for (; j & bit; bit >>= 1)
+            j ^= bit;
+        j ^= bit;
+        if (i < j) {
+            double t = re[i]; re[i] = re[j]; re[j] = t;
+            t = im[i]; im[i] = im[j]; im[j] = t;
+        }
+    }
+
+    double *costable = (double*)malloc((n/2 + 1) * sizeof(double));
+    double *sintable = (double*)malloc((n/2 + 1) * sizeof(double));
+    for (int k = 0; k < n/2; k++) {
+        costable[k] = cos(2 * M_PI * k / n);
+        sintable[k] = -sin(2 * M_PI * k / n);
+    }
+    for (int len = 2; len <= n; len <<= 1) {
+        int step = n / len;
+        for (int start = 0; start < n; start += len) {
+            for (int k = 0; k < len/2; k++) {
+                int a = start + k, b = start + k + len/2;
+                double wr = costable[k * step], wi = sintable[k * step];
+                double tr = re[b] * wr - im[b] * wi;
+                double ti = re[b] * wi + im[b] * wr;
+                re[b] = re[a] - tr;
+                im[b] = im[a] - ti;
+                re[a] += tr;
+                im[a] += ti;
+            }
+        }
+    }
+    free(costable);
+    free(sintable);
+}
+
+/** Fill in the autocorrelation of the onset histogram of the notes,
+ *  for lags 0 to meterLagCount()-1 bins.  The histogram starts at the
+ *  origin, in microseconds.  The notes must be in start time order.
+ */
+void meterAutocorrelate(const MidiNoteArray *notes, const MidiTempoMap *map,
+                        long long origin, double *autocorr) {
+    int numlags = meterLagCount();
+    memset(autocorr, 0, numlags * sizeof(double));
+    int count = notes->count;
+    if (count == 0)
+        return;
+
+    int *pulses = (int*)malloc(count * sizeof(int));
+    long long *micros = (long long*)malloc(count * sizeof(long long));
+    for (int i = 0; i < count; i++) {
+        pulses[i] = notes->notes[i].starttime;
+    }
+    midiTempoMapMicrosArray(map, pulses, micros, count);
+
+    long long last = micros[count - 1] - origin;
+    int bins = (int)((last > 0 ? last : 0) / MeterBinMicros) + 2;
+    if (bins > MeterMaxBins)
+        bins = MeterMaxBins;
+    int n = 1;
+    while (n < bins + numlags)
+        n <<= 1;
+    double *re = (double*)calloc(n, sizeof(double));
+    double *im = (double*)calloc(n, sizeof(double));
+
+    /* Each onset adds 1 to its bin, and 1/2 to the bins beside it,
+     * so that onsets a little off the beat still line up.
+     */
+    for (int i = 0; i < count; i++) {
+        long long t = micros[i] - origin;
+        int b = (int)((t > 0 ? t : 0) / MeterBinMicros);
+        if (b >= bins - 1)
+            break;
+        re[b] += 1.0;
+        re[b+1] += 0.5;
+        if (b > 0)
+            re[b-1] += 0.5;
+    }
+    double mean = 0;
+    for (int i = 0; i < bins; i++)
+        mean += re[i];
+    mean /= bins;
+    for (int i = 0; i < bins; i++)
+        re[i] -= mean;
+
+    /* The autocorrelation is the inverse FFT of the power spectrum.
+     * The power spectrum is real and symmetric, so a forward FFT
+     * gives the same result.  The zero padding (n >= bins + numlags)
+     * keeps the lags we need from wrapping around.
+     */
+    fft(re, im, n);
+    for (int i = 0; i < n; i++) {
+        re[i] = re[i] * re[i] + im[i] * im[i];
+        im[i] = 0;
+    }
+    fft(re, im, n);
+
+    /* Scale each lag by the number of bins it overlaps, so long lags
+     * aren't penalized for overlapping less of the song.
+     */
+    for (int lag = 0; lag < numlags && lag < bins; lag++) {
+        autocorr[lag] = re[lag] / n * bins / (bins - lag);
+    }
+
+    free(re);
+    free(im);
+    free(pulses);
+    free(micros);
+}
+
+static int compareCandidates(const void *v1, const void *v2) {
+    const MeterCandidate *c1 = (const MeterCandidate*)v1;
+    const MeterCandidate *c2 = (const MeterCandidate*)v2;
+    if (c1->confidence != c2->confidence)
+        return (c1->confidence > c2->confidence) ? -1 : 1;
+    return (c1->measure < c2->measure) ? -1 : (c1->measure > c2->measure);
+}
+
+/** Rank the measure lengths, given the autocorrelation (summed over
+ *  all tracks) from meterAutocorrelate.  The firstpulse is the start
+ *  time of the first note, where the histograms start.  Fill in at
+ *  most maxcandidates candidates, best first, and return how many.
+ */
+int meterRank(const double *autocorr, const MidiTempoMap *map, int firstpulse,
+              MeterCandidate *candidates, int maxcandidates) {
+    if (autocorr[0] <= 0)
+        return 0;
+
+    int minlag = MeterMinMicros / MeterBinMicros;
+    int maxlag = MeterMaxMicros / MeterBinMicros;
+    long long origin = midiTempoMapMicros(map, firstpulse);
+    int sixteenth = map->quarternote / 4;
+    if (sixteenth < 1)
+        sixteenth = 1;
+
+    MeterCandidate *found = (MeterCandidate*)malloc((maxlag - minlag + 1) * sizeof(MeterCandidate));
+    int numfound = 0;
+    for (int lag = minlag; lag <= maxlag; lag++) {
+        if (autocorr[lag] <= autocorr[lag-1] || autocorr[lag] < autocorr[lag+1])
+            continue;
+        double score = (autocorr[lag] + 0.5 * autocorr[2*lag]) / (1.5 * autocorr[0]);
+        if (score <= 0)
+            continue;
+        if (score > 1)
+            score = 1;
+
+        int measure = midiTempoMapPulse(map, origin + (long long)lag * MeterBinMicros) - firstpulse;
+        measure = (measure + sixteenth/2) / sixteenth * sixteenth;
+        if (measure <= 0)
+            continue;
+
+        /* Two peaks can round to the same length: keep the best */
+        int i = 0;
+        while (i < numfound && found[i].measure != measure)
+            i++;
+        if (i == numfound) {
+            found[numfound].measure = measure;
+            found[numfound].confidence = score;
+            numfound++;
+        }
+        else if (found[i].confidence < score) {
+            found[i].confidence = score;
+        }
+    }
+
+    /* A multiple of the measure repeats just as well as the measure.
+     * So if a length is a multiple of a shorter one that scores nearly
+     * as high, rank it below the shorter one.  The found lengths are
+     * in increasing order.
+     */
+    for (int i = 0; i < numfound; i++) {
+        for (int j = 0; j < i; j++) {
+            int multiple = (found[i].measure + found[j].measure/2) / found[j].measure;
+            int error = found[i].measure - multiple * found[j].measure;
+            if (multiple >= 2 && error <= sixteenth && error >= -sixteenth &&
+                found[j].confidence >= MeterMultipleRatio * found[i].confidence) {
+                found[i].confidence = MeterMultipleRatio * found[j].confidence;
+            }
+        }
+    }
+
+    qsort(found, numfound, sizeof(MeterCandidate), compareCandidates);
+    if (numfound > maxcandidates)
+        numfound = maxcandidates;
+    memcpy(candidates, found, numfound * sizeof(MeterCandidate));
+    free(found);
+    return numfound;
+}
+
+/** Guess the beat, given the autocorrelation (summed over all tracks)
+ *  from meterAutocorrelate.  The firstpulse is the start time of the
+ *  first note, where the histograms start.  The measure is the best
+ *  length from meterRank (or 0 if unknown): the beat divides it, so
+ *  it is at most half as long.  Fill in the tempo and return 1, or
+ *  return 0 (with the tempo zeroed) if there is no beat.
+ */
+int meterTempo(const double *autocorr, const MidiTempoMap *map, int firstpulse,
+               int measure, MeterTempo *tempo) {
+    memset(tempo, 0, sizeof(MeterTempo));
+    if (autocorr[0] <= 0)
+        return 0;
+
+    long long origin = midiTempoMapMicros(map, firstpulse);
+    int minlag = MeterMinBeatMicros / MeterBinMicros;
+    int maxlag = MeterMaxBeatMicros / MeterBinMicros;
+    if (measure > 0) {
+        long long micros = midiTempoMapMicros(map, firstpulse + measure) - origin;
+        int halfmeasure = (int)(micros / MeterBinMicros / 2);
+        if (maxlag > halfmeasure + MeterBeatTolerance)
+            maxlag = halfmeasure + MeterBeatTolerance;
+    }
+
+    int maxpeaks = (maxlag >= minlag) ? maxlag - minlag + 1 : 1;
+    int *lags = (int*)malloc(maxpeaks * sizeof(int));
+    double *scores = (double*)malloc(maxpeaks * sizeof(double));
+    int numfound = 0;
+    for (int lag = minlag; lag <= maxlag; lag++) {
+        if (autocorr[lag] <= autocorr[lag-1] || autocorr[lag] < autocorr[lag+1])
+            continue;
+        double score = autocorr[lag] / autocorr[0];
+        if (score <= 0)
+            continue;
+        lags[numfound] = lag;
+        scores[numfound] = (score > 1) ? 1 : score;
+        numfound++;
+    }
+
+    /* As in meterRank, a multiple of the beat repeats as well as the
+     * beat, so rank a lag below a divisor that scores nearly as high.
+     * Then weight each lag by its distance in octaves from 120 bpm.
+     */
+    int best = -1;
+    double bestweighted = 0;
+    for (int i = 0; i < numfound; i++) {
+        double score = scores[i];
+        for (int j = 0; j < i; j++) {
+            int multiple = (lags[i] + lags[j]/2) / lags[j];
+            int error = lags[i] - multiple * lags[j];
+            if (multiple >= 2 && error <= MeterBeatTolerance && error >= -MeterBeatTolerance &&
+                scores[j] >= MeterMultipleRatio * scores[i] &&
+                score > MeterMultipleRatio * scores[j]) {
+                score = MeterMultipleRatio * scores[j];
+            }
+        }
+        double octaves = log2((double)lags[i] * MeterBinMicros / MeterBeatMicros) / MeterBeatSpread;
+        double weighted = score * exp(-0.5 * octaves * octaves);
+        if (weighted > bestweighted) {
+            bestweighted = weighted;
+            best = i;
+        }
+    }
+    if (best < 0) {
+        free(lags);
+        free(scores);
+        return 0;
+    }
+
+    /* The vertex of the parabola through the peak and its neighbors */
+    int lag = lags[best];
+    double before = autocorr[lag-1], peak = autocorr[lag], after = autocorr[lag+1];
+    double curve = before - 2 * peak + after;
+    double offset = (curve < 0) ? 0.5 * (before - after) / curve : 0;
+
+    tempo->micros = (int)((lag + offset) * MeterBinMicros + 0.5);
+    tempo->beat = midiTempoMapPulse(map, origin + tempo->micros) - firstpulse;
+    tempo->confidence = scores[best];
+    free(lags);
+    free(scores);
+    return 1;
+}
@@ -0,0 +1,80 @@
+//
+//  MeterDetector.h
+//  MetroGnomeiPad
+//
+//  Copyright (c) 2012 Princeton University. All rights reserved.
+//
+
+#ifndef MetroGnomeiPad_MeterDetector_h
+#define MetroGnomeiPad_MeterDetector_h
+
+#include <sys/types.h>
+#include "MidiTempoMap.h"
+#include "MidiNoteArray.h"
+
+/* The MeterDetector guesses the measure length and the tempo of a
+ * song from its notes, for files that have no Time Signature event.
+ *
+ * 1. For each track, build an onset histogram over real time (using
+ *    the tempo map): the number of notes starting in each
+ *    MeterBinMicros bin, spread a little into the neighboring bins.
+ * 2. Autocorrelate each histogram with an FFT.  A lag where the
+ *    autocorrelation is high is a time after which the rhythm tends
+ *    to repeat.  The tracks are independent, so they can be done in
+ *    parallel, and their autocorrelations are added.
+ * 3. Score each peak of the autocorrelation between MeterMinMicros
+ *    and MeterMaxMicros.  A measure should also repeat at twice its
+ *    length, so the score adds half the autocorrelation at twice the
+ *    lag.  The peaks are converted to pulses, rounded to a sixteenth
+ *    note, and ranked by score.  A multiple of the measure repeats as
+ *    well as the measure itself, so a length that scores about the
+ *    same as one of its divisors is ranked below it.
+ * 4. The tempo comes from the same autocorrelation.  The beat is a
+ *    peak between MeterMinBeatMicros and MeterMaxBeatMicros, and at
+ *    most half the best measure.  The peaks are scored by their
+ *    autocorrelation alone (adding twice the lag, as in step 3, would
+ *    favor half measures), and a multiple of a peak that scores about
+ *    the same ranks below it.  Half and double the beat repeat too,
+ *    so the scores are also weighted by their distance in octaves
+ *    from MeterBeatMicros (120 bpm).  The best peak is refined to a
+ *    fraction of a bin by fitting a parabola through it.
+ *
+ * The cost is one pass over the notes, plus two FFTs per track of the
+ * length of the song in bins (at most MeterMaxBins).
+ */
+
+#define MeterBinMicros       10000    /** The histogram resolution: 10 msec */
+#define MeterMinMicros      500000    /** The shortest measure considered: 0.5 sec */
+#define MeterMaxMicros     4000000    /** The longest measure considered: 4 sec */
+#define MeterMaxBins         32768    /** Only the first 5.5 minutes of a song are used */
+#define MeterMaxCandidates       8    /** The most candidates worth returning */
+#define MeterMinBeatMicros  250000    /** The shortest beat considered: 240 bpm */
+#define MeterMaxBeatMicros 1500000    /** The longest beat considered: 40 bpm */
+#define MeterBeatMicros     500000    /** The most likely beat: 120 bpm */
+
+/** @struct MeterCandidate
+ * A guess of the measure length.
+ */
+typedef struct _MeterCandidate {
+    int measure;          /** The measure length, in pulses */
+    double confidence;    /** From 0 (no repetition) to 1 (exact repetition) */
+} MeterCandidate;
+
+/** @struct MeterTempo
+ * A guess of the beat.
+ */
+typedef struct _MeterTempo {
+    int beat;             /** The beat length, in pulses */
+    int micros;           /** The beat length, in microseconds (60000000/micros is the bpm) */
+    double confidence;    /** From 0 (no repetition) to 1 (exact repetition) */
+} MeterTempo;
+
+int  meterLagCount(void);
+void meterAutocorrelate(const MidiNoteArray *notes, const MidiTempoMap *map,
+                        long long origin, double *autocorr);
+int  meterRank(const double *autocorr, const MidiTempoMap *map, int firstpulse,
+               MeterCandidate *candidates, int maxcandidates);
+int  meterTempo(const double *autocorr, const MidiTempoMap *map, int firstpulse,
+                int measure, MeterTempo *tempo);
+
+#endif
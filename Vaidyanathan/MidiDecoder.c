@@ -0,0 +1,516 @@
+//
+//  MidiDecoder.c
+//  MetroGnomeiPad
+//
+//  Copyright (c) 2012 Princeton University. All rights reserved.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "MidiDecoder.h"
+
+#ifndef MetaEvent
+#define SysexEvent1            0xF0
+#define SysexEvent2            0xF7
+#define MetaEvent              0xFF
+#define MetaEventEndOfTrack    0x2F
+#define MetaEventTempo         0x51
+#define MetaEventTimeSignature 0x58
+#endif
+
+/* The kinds of status bytes, used by the dispatch table below */
+#define KindInvalid  0   /* Not a valid event code */
+#define KindData1    1   /* Channel event with one data byte */
+#define KindData2    2   /* Channel event with two data bytes */
+#define KindSysex    3   /* Sysex event: varlen length + data */
+#define KindMeta     4   /* Meta event: metacode + varlen length + data */
+
+/* The status byte dispatch table.  Entry i gives the kind of event
+ * for status byte i.  The bytes below 0x80 are data bytes, not status
+ * bytes, so they're marked invalid.
+ */
+static const u_char statusKind[256] = {
+    /* 0x00 - 0x7F: data bytes */
+    [0x80 ... 0xBF] = KindData2,  /* NoteOff, NoteOn, KeyPressure, ControlChange */
+    [0xC0 ... 0xDF] = KindData1,  /* ProgramChange, ChannelPressure */
+    [0xE0 ... 0xEF] = KindData2,  /* PitchBend */
+    [0xF0] = KindSysex,
+    [0xF7] = KindSysex,
+    [0xFF] = KindMeta,
+};
+
+/* The event class of each channel event, indexed by the event flag >> 4 */
+static const int channelEventClass[16] = {
+    [0x8] = MidiEventClassNotes,
+    [0x9] = MidiEventClassNotes,
+    [0xA] = MidiEventClassKeyPressure,
+    [0xB] = MidiEventClassControlChange,
+    [0xC] = MidiEventClassProgramChange,
+    [0xD] = MidiEventClassChanPressure,
+    [0xE] = MidiEventClassPitchBend,
+};
+
+/* The most bytes an event can take before its Sysex/Meta data:
+ * a 4 byte delta time, the status byte, the metacode, and a 4 byte
+ * varlen length.  Rounded up.
+ */
+#define MaxEventPrefix 12
+
+/** Read a 32-bit big endian int */
+static inline int readInt(const u_char *p) {
+    return (int)( ((unsigned int)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3] );
+}
+
+/** Read a variable-length integer (1 to 4 bytes) starting at p[*n],
+ *  and advance *n past it.
+ */
+static inline int readVarlen(const u_char *p, int *n) {
+    int i = *n;
+    u_char b = p[i++];
+    unsigned int result = b & 0x7F;
+    if (b & 0x80) {
+        b = p[i++];
+        result = (result << 7) | (b & 0x7F);
+        if (b & 0x80) {
+            b = p[i++];
+            result = (result << 7) | (b & 0x7F);
+            if (b & 0x80) {
+                b = p[i++];
+                result = (result << 7) | (b & 0x7F);
+            }
+        }
+    }
+    *n = i;
+    return (int)result;
+}
+
+/** Parse the MThd header at the start of the file */
+int midiDecodeHeader(const u_char *data, int datalen, MidiHeader *header, int *erroroffset) {
+    if (datalen < 14) {
+        *erroroffset = 0;
+        return (datalen >= 4 && memcmp(data, "MThd", 4) != 0) ?
+               MidiDecodeBadHeader : MidiDecodeTruncated;
+    }
+    if (memcmp(data, "MThd", 4) != 0) {
+        *erroroffset = 0;
+        return MidiDecodeBadHeader;
+    }
+    if (readInt(&data[4]) != 6) {
+        *erroroffset = 4;
+        return MidiDecodeBadHeaderLength;
+    }
+    header->trackmode   = (data[8] << 8) | data[9];
+    header->numtracks   = (data[10] << 8) | data[11];
+    header->quarternote = (data[12] << 8) | data[13];
+    return MidiDecodeOK;
+}
+
+/** Find the start of each MTrk chunk, using the track lengths in the
+ *  chunk headers.  The first MTrk header is at the given offset.
+ *  Store the offset of each MTrk header in trackoffsets.
+ */
+int midiFindTracks(const u_char *data, int datalen, int offset, int numtracks,
+                   int *trackoffsets, int *erroroffset) {
+    for (int tracknum = 0; tracknum < numtracks; tracknum++) {
+        if (offset + 8 > datalen) {
+            *erroroffset = offset;
+            return MidiDecodeTruncated;
+        }
+        if (memcmp(&data[offset], "MTrk", 4) != 0) {
+            *erroroffset = offset;
+            return MidiDecodeBadTrackHeader;
+        }
+        int tracklen = readInt(&data[offset + 4]);
+        if (tracklen < 0) {
+            *erroroffset = offset + 4;
+            return MidiDecodeBadTrackLength;
+        }
+        trackoffsets[tracknum] = offset;
+
+        /* The last track may be truncated.  midiDecodeTrack recovers from that. */
+        offset += 8;
+        if (tracklen > datalen - offset) {
+            tracklen = datalen - offset;
+        }
+        offset += tracklen;
+    }
+    return MidiDecodeOK;
+}
+
+/** Decode the event at data[*offset], and advance *offset past it.
+ *  The runningstatus is the status byte of the previous event, used
+ *  when this event has no status byte.  It is updated on return.
+ *
+ *  There is only one bounds check for the fixed-size part of the event.
+ *  Near the end of the data, that part is copied to a zero-padded
+ *  buffer first, so the decoding itself never needs to check.
+ *
+ *  Return MidiDecodeEnd if the data ends before the event's status
+ *  byte, since we can recover from that by stopping there.  On error,
+ *  *offset is set to where the error occurred.
+ */
+int midiDecodeEvent(const u_char *data, int datalen, int *offset,
+                    u_char *runningstatus, MidiRawEvent *event) {
+    int pos = *offset;
+    int avail = datalen - pos;
+    const u_char *p = &data[pos];
+    u_char tail[MaxEventPrefix];
+
+    if (avail < MaxEventPrefix) {
+        if (avail <= 0) {
+            return MidiDecodeEnd;
+        }
+        memset(tail, 0, sizeof(tail));
+        memcpy(tail, p, avail);
+        p = tail;
+    }
+
+    int n = 0;
+    event->deltatime = readVarlen(p, &n);
+    if (n >= avail) {
+        return MidiDecodeEnd;
+    }
+
+    u_char status = p[n];
+    if (status >= 0x80) {
+        n++;
+        *runningstatus = status;
+    }
+    else {
+        status = *runningstatus;
+    }
+    event->status = status;
+    event->data1 = 0;
+    event->data2 = 0;
+    event->payload = 0;
+    event->payloadlen = 0;
+
+    switch (statusKind[status]) {
+        case KindData2:
+            event->data1 = p[n];
+            event->data2 = p[n+1];
+            n += 2;
+            break;
+
+        case KindData1:
+            event->data1 = p[n];
+            n += 1;
+            break;
+
+        case KindMeta:
+            event->data1 = p[n];
+            n += 1;
+            /* Fall through */
+        case KindSysex:
+            event->payloadlen = readVarlen(p, &n);
+            event->payload = pos + n;
+            if (n > avail || event->payloadlen < 0 ||
+                event->payloadlen > avail - n) {
+                *offset = datalen;
+                return MidiDecodeTruncated;
+            }
+            n += event->payloadlen;
+            if (status == MetaEvent) {
+                if (event->data1 == MetaEventTimeSignature && event->payloadlen != 4) {
+                    *offset = pos + n;
+                    return MidiDecodeBadTimeSignature;
+                }
+                if (event->data1 == MetaEventTempo && event->payloadlen != 3) {
+                    *offset = pos + n;
+                    return MidiDecodeBadTempo;
+                }
+            }
+            break;
+
+        default:
+            *offset = pos + n;
+            return MidiDecodeUnknownEvent;
+    }
+
+    if (n > avail) {
+        *offset = datalen;
+        return MidiDecodeTruncated;
+    }
+    *offset = pos + n;
+    return MidiDecodeOK;
+}
+
+/** Start a cursor over the track whose MTrk header is at the given offset */
+int midiCursorInit(MidiCursor *cursor, const u_char *data, int datalen, int offset) {
+    memset(cursor, 0, sizeof(MidiCursor));
+    cursor->data = data;
+    cursor->datalen = datalen;
+    if (offset + 8 > datalen || memcmp(&data[offset], "MTrk", 4) != 0) {
+        cursor->done = 1;
+        cursor->erroroffset = offset;
+        return (offset + 8 > datalen) ? MidiDecodeTruncated : MidiDecodeBadTrackHeader;
+    }
+    int tracklen = readInt(&data[offset + 4]);
+    cursor->pos = offset + 8;
+    cursor->trackend = (tracklen > datalen - cursor->pos) ? datalen : cursor->pos + tracklen;
+    return MidiDecodeOK;
+}
+
+/** Decode the next event of the track.  Return MidiDecodeEnd after the
+ *  last event (EndOfTrack, the end of the track, or a truncation
+ *  between two events).  On error, the cursor stops and
+ *  cursor->erroroffset tells where.
+ */
+int midiCursorNext(MidiCursor *cursor, MidiRawEvent *event) {
+    if (cursor->done || cursor->pos >= cursor->trackend) {
+        cursor->done = 1;
+        return MidiDecodeEnd;
+    }
+    int next = cursor->pos;
+    int error = midiDecodeEvent(cursor->data, cursor->datalen, &next,
+                                &cursor->runningstatus, event);
+    if (error != MidiDecodeOK) {
+        cursor->done = 1;
+        cursor->erroroffset = next;
+        return error;
+    }
+    if (event->deltatime > INT_MAX - cursor->starttime) {
+        cursor->done = 1;
+        cursor->erroroffset = cursor->pos;
+        return MidiDecodeTimeOverflow;
+    }
+    cursor->pos = next;
+    cursor->starttime += event->deltatime;
+    event->starttime = cursor->starttime;
+    if (event->status == MetaEvent && event->data1 == MetaEventEndOfTrack) {
+        cursor->done = 1;
+    }
+    return MidiDecodeOK;
+}
+
+/** Return true if the filter keeps the given event.  A NULL filter
+ *  keeps everything.  Inlined into the decode loops, since it runs
+ *  once per event.
+ */
+static inline int filterKeeps(const MidiDecodeFilter *filter, const MidiRawEvent *event) {
+    if (filter == NULL) {
+        return 1;
+    }
+    u_char status = event->status;
+    if (status < SysexEvent1) {
+        return (filter->eventclasses & channelEventClass[status >> 4]) &&
+               (filter->channels & (1 << (status & 0x0F)));
+    }
+    else if (status != MetaEvent) {
+        return filter->eventclasses & MidiEventClassSysex;
+    }
+    switch (event->data1) {
+        case MetaEventEndOfTrack:    return 1;
+        case MetaEventTempo:         return filter->eventclasses & MidiEventClassTempo;
+        case MetaEventTimeSignature: return filter->eventclasses & MidiEventClassTimeSignature;
+        default:                     return filter->eventclasses & MidiEventClassOtherMeta;
+    }
+}
+
+/** Return true if the filter keeps the given event.  A NULL filter keeps everything. */
+int midiFilterKeeps(const MidiDecodeFilter *filter, const MidiRawEvent *event) {
+    return filterKeeps(filter, event);
+}
+
+/** Parse the track whose MTrk header is at the given offset into
+ *  the given store.  The store is initialized here, and uses the
+ *  file data as its payload blob.  If the track is truncated between
+ *  two events, keep the events parsed so far.
+ *
+ *  Only the events kept by the filter are stored.  The delta time of
+ *  each stored event is measured from the previous stored event, so
+ *  the start times are unchanged.
+ */
+int midiDecodeTrack(const u_char *data, int datalen, int offset,
+                    const MidiDecodeFilter *filter,
+                    MidiEventStore *store, int *erroroffset) {
+    MidiCursor cursor;
+    MidiRawEvent event;
+    int error = midiCursorInit(&cursor, data, datalen, offset);
+    int prevtime = 0;
+
+    /* Most events take 3 or 4 bytes.  A filtered track keeps an
+     * unknown fraction of them, so start from the same estimate, and
+     * give back the unused space once the track is decoded.
+     */
+    int capacity = (cursor.trackend - cursor.pos) / 3;
+    eventStoreInit(store, data, datalen, capacity);
+
+    while (error == MidiDecodeOK) {
+        error = midiCursorNext(&cursor, &event);
+        if (error == MidiDecodeOK && filterKeeps(filter, &event)) {
+            eventStoreAdd(store, event.starttime - prevtime, event.starttime, event.status,
+                          event.data1, event.data2, event.payload, event.payloadlen);
+            prevtime = event.starttime;
+        }
+    }
+    if (filter != NULL) {
+        eventStoreTrim(store);
+    }
+    if (error != MidiDecodeEnd) {
+        *erroroffset = cursor.erroroffset;
+        return error;
+    }
+    return MidiDecodeOK;
+}
+
+/** Return true if entry a comes before b: by start time, then track */
+static inline int mergeEntryBefore(const MidiMergeEntry *a, const MidiMergeEntry *b) {
+    if (a->starttime != b->starttime)
+        return a->starttime < b->starttime;
+    return a->tracknum < b->tracknum;
+}
+
+/** Move the entry at index i down the heap to its place */
+static void mergeHeapSiftDown(MidiMergeEntry *heap, int count, int i) {
+    MidiMergeEntry entry = heap[i];
+    while (1) {
+        int child = 2*i + 1;
+        if (child >= count)
+            break;
+        /* The tracks interleave unpredictably, so pick the child
+         * without a branch.
+         */
+        if (child + 1 < count)
+            child += mergeEntryBefore(&heap[child+1], &heap[child]);
+        if (!mergeEntryBefore(&heap[child], &entry))
+            break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = entry;
+}
+
+/** Decode the next event of the track that the filter keeps, into
+ *  merge->next[tracknum].  Return the decode result.
+ */
+static int mergeCursorAdvance(MidiMergeCursor *merge, int tracknum) {
+    MidiCursor *cursor = &merge->cursors[tracknum];
+    MidiRawEvent *event = &merge->next[tracknum];
+    const MidiDecodeFilter *filter = merge->filtered ? &merge->filter : NULL;
+    int result;
+    do {
+        result = midiCursorNext(cursor, event);
+    } while (result == MidiDecodeOK && !filterKeeps(filter, event));
+    return result;
+}
+
+/** Start a cursor over all the tracks of the given Midi file data.
+ *  Only the events kept by the filter are returned (a NULL filter
+ *  keeps everything).
+ */
+int midiMergeCursorInit(MidiMergeCursor *merge, const u_char *data, int datalen,
+                        const MidiDecodeFilter *filter, int *erroroffset) {
+    MidiHeader header;
+    memset(merge, 0, sizeof(MidiMergeCursor));
+    int error = midiDecodeHeader(data, datalen, &header, erroroffset);
+    if (error != MidiDecodeOK) {
+        return error;
+    }
+    int numtracks = header.numtracks;
+    int *offsets = (int*)calloc(numtracks + 1, sizeof(int));
+    error = midiFindTracks(data, datalen, 14, numtracks, offsets, erroroffset);
+    if (error != MidiDecodeOK) {
+        free(offsets);
+        return error;
+    }
+    if (filter != NULL) {
+        merge->filter = *filter;
+        merge->filtered = 1;
+    }
+    merge->numtracks = numtracks;
+    merge->cursors = (MidiCursor*)calloc(numtracks + 1, sizeof(MidiCursor));
+    merge->next = (MidiRawEvent*)calloc(numtracks + 1, sizeof(MidiRawEvent));
+    merge->result = (int*)calloc(numtracks + 1, sizeof(int));
+    merge->prevtime = (int*)calloc(numtracks + 1, sizeof(int));
+    merge->heap = (MidiMergeEntry*)calloc(numtracks + 1, sizeof(MidiMergeEntry));
+    for (int tracknum = 0; tracknum < numtracks; tracknum++) {
+        MidiCursor *cursor = &merge->cursors[tracknum];
+        merge->result[tracknum] = midiCursorInit(cursor, data, datalen, offsets[tracknum]);
+        if (merge->result[tracknum] == MidiDecodeOK) {
+            merge->result[tracknum] = mergeCursorAdvance(merge, tracknum);
+        }
+        if (merge->result[tracknum] != MidiDecodeEnd) {
+            MidiMergeEntry *entry = &merge->heap[merge->heapcount++];
+            entry->tracknum = tracknum;
+            entry->starttime = (merge->result[tracknum] == MidiDecodeOK) ?
+                               merge->next[tracknum].starttime : -1;
+        }
+    }
+    for (int i = merge->heapcount/2 - 1; i >= 0; i--) {
+        mergeHeapSiftDown(merge->heap, merge->heapcount, i);
+    }
+    free(offsets);
+    return MidiDecodeOK;
+}
+
+/** Return the next event of the file, in order of start time, and
+ *  the track it belongs to.  Return MidiDecodeEnd when all the tracks
+ *  are done.  If a track fails to decode, its error is returned before
+ *  any later events, and the track's cursor erroroffset tells where.
+ *
+ *  The delta time of the event is measured from the previous event
+ *  returned for the same track, so that filtered events don't change
+ *  the start times.
+ */
+int midiMergeCursorNext(MidiMergeCursor *merge, MidiRawEvent *event, int *tracknum) {
+    if (merge->heapcount == 0) {
+        return MidiDecodeEnd;
+    }
+    int best = merge->heap[0].tracknum;
+    *tracknum = best;
+    int result = merge->result[best];
+    if (result == MidiDecodeOK) {
+        *event = merge->next[best];
+        event->deltatime = event->starttime - merge->prevtime[best];
+        merge->prevtime[best] = event->starttime;
+        merge->result[best] = mergeCursorAdvance(merge, best);
+    }
+    else {
+        merge->result[best] = MidiDecodeEnd;
+    }
+
+    /* Replace the track at the top of the heap with its next event,
+     * or remove it if it's done.
+     */
+    int next = merge->result[best];
+    if (next == MidiDecodeEnd) {
+        merge->heap[0] = merge->heap[--merge->heapcount];
+    }
+    else {
+        merge->heap[0].starttime = (next == MidiDecodeOK) ? merge->next[best].starttime : -1;
+    }
+    if (merge->heapcount > 0) {
+        mergeHeapSiftDown(merge->heap, merge->heapcount, 0);
+    }
+    return result;
+}
+
+/** Free the per-track state of a merge cursor */
+void midiMergeCursorFree(MidiMergeCursor *merge) {
+    free(merge->cursors);
+    free(merge->next);
+    free(merge->result);
+    free(merge->prevtime);
+    free(merge->heap);
+    memset(merge, 0, sizeof(MidiMergeCursor));
+}
+
+/** Return a description of the given error code */
+const char* midiDecodeErrorString(int error) {
+    switch (error) {
+        case MidiDecodeOK:               return "No error";
+        case MidiDecodeEnd:              return "End of data";
+        case MidiDecodeTruncated:        return "File is truncated";
+        case MidiDecodeBadHeader:        return "Bad MThd header";
+        case MidiDecodeBadHeaderLength:  return "Bad MThd len";
+        case MidiDecodeBadTrackHeader:   return "Bad MTrk header";
+        case MidiDecodeBadTrackLength:   return "Bad MTrk len";
+        case MidiDecodeUnknownEvent:     return "Unknown event";
+        case MidiDecodeBadTimeSignature: return "Bad Meta Event Time Signature len";
+        case MidiDecodeBadTempo:         return "Bad Meta Event Tempo len";
+        case MidiDecodeTimeOverflow:     return "Event time overflows";
+        default:                         return "Unknown error";
+    }
+}
@@ -0,0 +1,155 @@
+//
+//  MidiDecoder.h
+//  MetroGnomeiPad
+//
+//  Copyright (c) 2012 Princeton University. All rights reserved.
+//
+
+#ifndef MetroGnomeiPad_MidiDecoder_h
+#define MetroGnomeiPad_MidiDecoder_h
+
+#include <sys/types.h>
+#include "MidiEventStore.h"
+
+/* The MidiDecoder is the low-level Midi file parser used by MidiFile.
+ * It is plain C: no message sends, no exceptions.  Each function
+ * returns one of the error codes below, and the file offset where
+ * the error occurred.  MidiFile turns errors into MidiFileExceptions.
+ *
+ * The Midi file format itself is described at the top of MidiFile.m.
+ */
+
+/** The decoder version.  Increase it whenever a change to the decoder
+ *  changes the parsed result, so that cached parses are redone.
+ */
+#define MidiDecoderVersion 2
+
+/** The error codes returned by the decoder */
+enum {
+    MidiDecodeOK = 0,            /** Success */
+    MidiDecodeEnd,               /** The data ended before the next event (not an error) */
+    MidiDecodeTruncated,         /** The data ended in the middle of an event */
+    MidiDecodeBadHeader,         /** Missing MThd header */
+    MidiDecodeBadHeaderLength,   /** The MThd length is not 6 */
+    MidiDecodeBadTrackHeader,    /** Missing MTrk header */
+    MidiDecodeBadTrackLength,    /** Negative MTrk length */
+    MidiDecodeUnknownEvent,      /** Invalid status byte */
+    MidiDecodeBadTimeSignature,  /** Time signature meta event is not 4 bytes */
+    MidiDecodeBadTempo,          /** Tempo meta event is not 3 bytes */
+    MidiDecodeTimeOverflow       /** The delta times add up past the largest int */
+};
+
+/* The event classes, for MidiDecodeFilter.eventclasses */
+#define MidiEventClassNotes          0x001   /** NoteOn and NoteOff */
+#define MidiEventClassKeyPressure    0x002
+#define MidiEventClassControlChange  0x004
+#define MidiEventClassProgramChange  0x008
+#define MidiEventClassChanPressure   0x010
+#define MidiEventClassPitchBend      0x020
+#define MidiEventClassSysex          0x040
+#define MidiEventClassTempo          0x080
+#define MidiEventClassTimeSignature  0x100
+#define MidiEventClassOtherMeta      0x200   /** All other meta events */
+#define MidiEventClassAll            0x3FF
+
+/** The events needed to display the sheet music */
+#define MidiEventClassDisplay  (MidiEventClassNotes | MidiEventClassProgramChange | \
+                                MidiEventClassTempo | MidiEventClassTimeSignature)
+
+#define MidiChannelsAll  0xFFFF
+
+/** @struct MidiDecodeFilter
+ * The events to keep when decoding a track.  The other events are
+ * skipped over without being stored.  The EndOfTrack event is always
+ * kept.  The channels only apply to channel events.
+ */
+typedef struct _MidiDecodeFilter {
+    int eventclasses;  /** The event classes to keep */
+    int channels;      /** The channels to keep (bit i = channel i) */
+} MidiDecodeFilter;
+
+/** @struct MidiHeader
+ * The contents of the MThd header.
+ */
+typedef struct _MidiHeader {
+    int trackmode;     /** 0 (single track), 1 (simultaneous tracks) 2 (independent tracks) */
+    int numtracks;     /** The number of MTrk chunks */
+    int quarternote;   /** The number of pulses per quarter note */
+} MidiHeader;
+
+/** @struct MidiRawEvent
+ * A single decoded event, in the same form as a MidiEventStore entry.
+ */
+typedef struct _MidiRawEvent {
+    int deltatime;     /** The time between the previous event and this one */
+    int starttime;     /** The absolute time this event occurs */
+    u_char status;     /** The status byte (event flag + channel) */
+    u_char data1;      /** The first data byte, or the metaevent code */
+    u_char data2;      /** The second data byte */
+    int payload;       /** File offset of the Sysex/Meta data */
+    int payloadlen;    /** Length of the Sysex/Meta data */
+} MidiRawEvent;
+
+/** @struct MidiCursor
+ * A pull-style cursor over the events of one track.  Each call to
+ * midiCursorNext() decodes the next event straight from the file data,
+ * so walking a track takes constant memory.
+ */
+typedef struct _MidiCursor {
+    const u_char *data;    /** The file data. Not owned */
+    int datalen;           /** The length of the file data */
+    int pos;               /** The offset of the next event */
+    int trackend;          /** The offset just past the track */
+    int starttime;         /** The start time of the last event */
+    u_char runningstatus;  /** The status byte of the last event */
+    int done;              /** True after EndOfTrack or an error */
+    int erroroffset;       /** Where the last error occurred */
+} MidiCursor;
+
+/** @struct MidiMergeEntry
+ * The next event of one track, in the heap of a MidiMergeCursor.
+ */
+typedef struct _MidiMergeEntry {
+    int starttime;     /** The start time of the event, or -1 for a decode error */
+    int tracknum;      /** The track */
+} MidiMergeEntry;
+
+/** @struct MidiMergeCursor
+ * A cursor over all the tracks of a file, returning the events in
+ * order of start time (ties go to the lower track number).  It holds
+ * one cursor and one look-ahead event per track, and a min-heap of
+ * the tracks by the start time of their look-ahead event, so each
+ * event costs O(log tracks).  Like midiDecodeTrack, it can skip the
+ * events a filter doesn't keep.
+ */
+typedef struct _MidiMergeCursor {
+    int numtracks;         /** The number of tracks */
+    MidiCursor *cursors;   /** The cursor for each track */
+    MidiRawEvent *next;    /** The next event of each track */
+    int *result;           /** The decode result for next[i] */
+    int *prevtime;         /** The start time of the last event returned for each track */
+    MidiMergeEntry *heap;  /** The tracks that aren't done, by next start time */
+    int heapcount;         /** The number of tracks in the heap */
+    MidiDecodeFilter filter;  /** The events to keep */
+    int filtered;          /** False if all events are kept */
+} MidiMergeCursor;
+
+int midiDecodeHeader(const u_char *data, int datalen, MidiHeader *header, int *erroroffset);
+int midiFindTracks(const u_char *data, int datalen, int offset, int numtracks,
+                   int *trackoffsets, int *erroroffset);
+int midiDecodeEvent(const u_char *data, int datalen, int *offset,
+                    u_char *runningstatus, MidiRawEvent *event);
+int midiDecodeTrack(const u_char *data, int datalen, int offset,
+                    const MidiDecodeFilter *filter,
+                    MidiEventStore *store, int *erroroffset);
+int midiFilterKeeps(const MidiDecodeFilter *filter, const MidiRawEvent *event);
+const char* midiDecodeErrorString(int error);
+
+int  midiCursorInit(MidiCursor *cursor, const u_char *data, int datalen, int offset);
+int  midiCursorNext(MidiCursor *cursor, MidiRawEvent *event);
+int  midiMergeCursorInit(MidiMergeCursor *merge, const u_char *data, int datalen,
+                         const MidiDecodeFilter *filter, int *erroroffset);
+int  midiMergeCursorNext(MidiMergeCursor *merge, MidiRawEvent *event, int *tracknum);
+void midiMergeCursorFree(MidiMergeCursor *merge);
+
+#endif
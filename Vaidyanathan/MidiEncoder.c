@@ -0,0 +1,309 @@
+//
+//  MidiEncoder.c
+//  MetroGnomeiPad
+//
+//  Copyright (c) 2012 Princeton University. All rights reserved.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "MidiEncoder.h"
+
+#ifndef MetaEvent
+#define EventNoteOff           0x80
+#define EventNoteOn            0x90
+#define EventKeyPressure       0xA0
+#define EventControlChange     0xB0
+#define EventProgramChange     0xC0
+#define EventPitchBend         0xE0
+#define MetaEvent              0xFF
+#define MetaEventTempo         0x51
+#endif
+
+/* The most bytes an event takes besides its Sysex/Meta data: a 4 byte
+ * delta time, the status byte, the metacode, and a 4 byte length.
+ */
+#define MaxEventPrefix 10
+
+/* The number of data bytes of each channel event, indexed by the
+ * event flag >> 4.
+ */
+static const u_char channelDataLength[16] = {
+    [0x8] = 2, [0x9] = 2, [0xA] = 2, [0xB] = 2,
+    [0xC] = 1, [0xD] = 1, [0xE] = 2,
+};
+
+/** Make room for n more bytes */
+static inline void encoderReserve(MidiEncoder *encoder, int n) {
+    if (encoder->len + n <= encoder->capacity)
+        return;
+    int newcapacity = encoder->capacity * 2;
+    if (newcapacity < encoder->len + n)
+        newcapacity = encoder->len + n;
+    encoder->data = (u_char*)realloc(encoder->data, newcapacity);
+    encoder->capacity = newcapacity;
+}
+
+/** Write a 4-byte big endian integer at the given offset */
+static inline void putInt(u_char *p, int value) {
+    p[0] = (u_char)((value >> 24) & 0xFF);
+    p[1] = (u_char)((value >> 16) & 0xFF);
+    p[2] = (u_char)((value >> 8) & 0xFF);
+    p[3] = (u_char)(value & 0xFF);
+}
+
+/** Write a variable-length integer (1 to 4 bytes) at p.
+ *  Return the number of bytes written.
+ */
+static inline int putVarlen(u_char *p, int num) {
+    unsigned int value = (unsigned int)num & 0x0FFFFFFF;
+    if (value < (1 << 7)) {
+        p[0] = (u_char)value;
+        return 1;
+    }
+    if (value < (1 << 14)) {
+        p[0] = (u_char)(0x80 | (value >> 7));
+        p[1] = (u_char)(value & 0x7F);
+        return 2;
+    }
+    if (value < (1 << 21)) {
+        p[0] = (u_char)(0x80 | (value >> 14));
+        p[1] = (u_char)(0x80 | ((value >> 7) & 0x7F));
+        p[2] = (u_char)(value & 0x7F);
+        return 3;
+    }
+    p[0] = (u_char)(0x80 | ((value >> 21) & 0x7F));
+    p[1] = (u_char)(0x80 | ((value >> 14) & 0x7F));
+    p[2] = (u_char)(0x80 | ((value >> 7) & 0x7F));
+    p[3] = (u_char)(value & 0x7F);
+    return 4;
+}
+
+/** Apply the transform's pause time to event i of the track, changing
+ *  the delta time that will be written.  This is only used without a
+ *  seek index.  Return false if the event should be left out.
+ */
+static inline int pauseEvent(const MidiTransform *transform, int *foundafterpause,
+                             const MidiEventStore *events, int i, int *deltatime) {
+    if (events->starttime[i] < transform->pausetime) {
+        u_char eventflag = eventStoreFlag(events, i);
+        if (eventflag == EventNoteOn || eventflag == EventNoteOff) {
+            return 0;
+        }
+        *deltatime = 0;
+    }
+    else if (!*foundafterpause) {
+        *deltatime = events->starttime[i] - transform->pausetime;
+        *foundafterpause = 1;
+    }
+    return 1;
+}
+
+/** Apply the transform to an event of the track, changing the data
+ *  bytes and payload that will be written.
+ */
+static inline void transformEvent(const MidiTransform *transform, int tracknum, u_char status,
+                                  u_char *data1, u_char *data2, const u_char **payload,
+                                  const u_char *tempo) {
+    u_char eventflag = (status >= 0xF0) ? status : (u_char)(status & 0xF0);
+    int isnote = (eventflag == EventNoteOn || eventflag == EventNoteOff);
+
+    if (isnote || eventflag == EventKeyPressure) {
+        int num = *data1 + transform->transpose;
+        if (num < 0)
+            num = 0;
+        if (num > 127)
+            num = 127;
+        *data1 = (u_char)num;
+        if (isnote && (transform->mutechannels & (1 << (status & 0x0F)))) {
+            *data2 = 0;
+        }
+    }
+    else if (eventflag == EventProgramChange) {
+        if (transform->trackinstruments != NULL) {
+            *data1 = (u_char)transform->trackinstruments[tracknum];
+        }
+        else if (transform->channelinstruments != NULL) {
+            *data1 = (u_char)transform->channelinstruments[status & 0x0F];
+        }
+    }
+    else if (eventflag == MetaEvent && *data1 == MetaEventTempo && transform->tempo > 0) {
+        *payload = tempo;
+    }
+}
+
+/** Write one event, with the given delta time and data */
+static inline void encodeEvent(MidiEncoder *encoder, u_char *runningstatus, int deltatime,
+                               u_char status, u_char data1, u_char data2,
+                               const u_char *payload, int payloadlen) {
+    encoderReserve(encoder, MaxEventPrefix + payloadlen);
+    u_char *p = &encoder->data[encoder->len];
+    int n = putVarlen(p, deltatime);
+
+    if (status < 0xF0) {
+        /* Always store the status and data2 bytes, but only count
+         * them when needed.  This avoids hard-to-predict branches.
+         */
+        p[n] = status;
+        n += (status != *runningstatus);
+        *runningstatus = status;
+        p[n++] = data1;
+        p[n] = data2;
+        n += channelDataLength[status >> 4] - 1;
+    }
+    else {
+        p[n++] = status;
+        if (status == MetaEvent) {
+            p[n++] = data1;
+        }
+        n += putVarlen(&p[n], payloadlen);
+        if (payloadlen > 0) {
+            memcpy(&p[n], payload, payloadlen);
+            n += payloadlen;
+        }
+        *runningstatus = 0;
+    }
+    encoder->len += n;
+}
+
+/** Write the non-note events before the pause time, in order, at
+ *  time 0, with the transform applied.  This is the same stream
+ *  pauseEvent() produces, without reading the notes before the last
+ *  checkpoint.
+ */
+static void encodeSeekControls(MidiEncoder *encoder, u_char *runningstatus,
+                               const MidiEventStore *events, int tracknum,
+                               const MidiTransform *transform, const u_char *tempo,
+                               const int *controls, int numcontrols) {
+    for (int c = 0; c < numcontrols; c++) {
+        int i = controls[c];
+        u_char status = events->status[i];
+        u_char data1 = events->data1[i];
+        u_char data2 = events->data2[i];
+        const u_char *payload = NULL;
+        int payloadlen = 0;
+        if (status >= 0xF0) {
+            payloadlen = events->payloadlen[i];
+            payload = eventStorePayload(events, i);
+        }
+        transformEvent(transform, tracknum, status, &data1, &data2, &payload, tempo);
+        encodeEvent(encoder, runningstatus, 0, status, data1, data2, payload, payloadlen);
+    }
+}
+
+/** Encode one track: the MTrk header, then each event.  The track
+ *  length is back-patched once the events are written.  If there is
+ *  a transform, it is applied to each event as it is written.
+ */
+static void encodeTrack(MidiEncoder *encoder, const MidiEventStore *events, int tracknum,
+                        const MidiTransform *transform) {
+    encoderReserve(encoder, 8 + 7 + events->count * 4);
+    int header = encoder->len;
+    memcpy(&encoder->data[header], "MTrk", 4);
+    encoder->len += 8;
+
+    /* With a new tempo, each track starts with a tempo event */
+    u_char tempo[3];
+    if (transform != NULL && transform->tempo > 0) {
+        u_char *p = &encoder->data[encoder->len];
+        tempo[0] = (u_char)((transform->tempo >> 16) & 0xFF);
+        tempo[1] = (u_char)((transform->tempo >> 8) & 0xFF);
+        tempo[2] = (u_char)(transform->tempo & 0xFF);
+        p[0] = 0;
+        p[1] = MetaEvent;
+        p[2] = MetaEventTempo;
+        p[3] = 3;
+        memcpy(&p[4], tempo, 3);
+        encoder->len += 7;
+    }
+
+    /* With a seek index, start with the non-note events before the
+     * pause time, and skip straight to the first event after it.
+     */
+    u_char runningstatus = 0;
+    int first = 0;
+    int usepause = (transform != NULL && transform->pausetime != 0);
+    int foundafterpause = 0;
+    int seeked = 0;
+    if (usepause && transform->seekindex != NULL) {
+        int numcontrols = 0;
+        first = midiSeekTrack(transform->seekindex, events, tracknum, transform->pausetime,
+                              &numcontrols);
+        encodeSeekControls(encoder, &runningstatus, events, tracknum, transform, tempo,
+                           transform->seekindex->tracks[tracknum].controls, numcontrols);
+        usepause = 0;
+        seeked = 1;
+    }
+
+    for (int i = first; i < events->count; i++) {
+        u_char status = events->status[i];
+        int deltatime = (seeked && i == first) ?
+            events->starttime[i] - transform->pausetime : events->deltatime[i];
+        u_char data1 = events->data1[i];
+        u_char data2 = events->data2[i];
+        const u_char *payload = NULL;
+        int payloadlen = 0;
+        if (status >= 0xF0) {
+            payloadlen = events->payloadlen[i];
+            payload = eventStorePayload(events, i);
+        }
+        if (transform != NULL) {
+            if (usepause && !pauseEvent(transform, &foundafterpause, events, i, &deltatime)) {
+                continue;
+            }
+            transformEvent(transform, tracknum, status, &data1, &data2, &payload, tempo);
+        }
+        encodeEvent(encoder, &runningstatus, deltatime, status, data1, data2, payload, payloadlen);
+    }
+    putInt(&encoder->data[header + 4], encoder->len - header - 8);
+}
+
+/** Set the transform to change nothing */
+void midiTransformInit(MidiTransform *transform) {
+    memset(transform, 0, sizeof(MidiTransform));
+}
+
+/** Encode the given tracks as a Midi file, applying the transform
+ *  (or NULL for none) as the events are written.  The stores are not
+ *  modified.  Return the file data, allocated with malloc, and its
+ *  length.
+ */
+u_char* midiEncodeFile(const MidiEventStore *stores, int numtracks,
+                       int trackmode, int quarternote,
+                       const MidiTransform *transform, int *length) {
+    MidiEncoder encoder;
+    int numevents = 0;
+    int numkept = 0;
+    for (int tracknum = 0; tracknum < numtracks; tracknum++) {
+        if (transform == NULL || transform->keeptracks == NULL ||
+            transform->keeptracks[tracknum]) {
+            numevents += stores[tracknum].count;
+            numkept++;
+        }
+    }
+    /* Most events take 2 to 4 bytes with running status.  Reserve 4,
+     * so that only large Sysex/Meta data makes the buffer grow.
+     */
+    encoder.capacity = 14 + numkept * (8 + 7) + numevents * 4 + 64;
+    encoder.data = (u_char*)malloc(encoder.capacity);
+    encoder.len = 14;
+
+    u_char *p = encoder.data;
+    memcpy(p, "MThd", 4);
+    putInt(&p[4], 6);
+    p[8]  = (u_char)(trackmode >> 8);
+    p[9]  = (u_char)(trackmode & 0xFF);
+    p[10] = (u_char)(numkept >> 8);
+    p[11] = (u_char)(numkept & 0xFF);
+    p[12] = (u_char)(quarternote >> 8);
+    p[13] = (u_char)(quarternote & 0xFF);
+
+    for (int tracknum = 0; tracknum < numtracks; tracknum++) {
+        if (transform == NULL || transform->keeptracks == NULL ||
+            transform->keeptracks[tracknum]) {
+            encodeTrack(&encoder, &stores[tracknum], tracknum, transform);
+        }
+    }
+    *length = encoder.len;
+    return encoder.data;
+}
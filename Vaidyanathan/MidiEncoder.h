@@ -0,0 +1,61 @@
+//
+//  MidiEncoder.h
+//  MetroGnomeiPad
+//
+//  Copyright (c) 2012 Princeton University. All rights reserved.
+//
+
+#ifndef MetroGnomeiPad_MidiEncoder_h
+#define MetroGnomeiPad_MidiEncoder_h
+
+#include <sys/types.h>
+#include "MidiEventStore.h"
+#include "MidiSeekIndex.h"
+
+/* The MidiEncoder is the counterpart of the MidiDecoder: it serializes
+ * MidiEventStores into a Midi file, in memory.  Each track is encoded
+ * in a single pass, and its MTrk length is filled in afterwards.
+ *
+ * Channel events use running status: the status byte is left out when
+ * it is the same as the previous event's.  Sysex and Meta events
+ * cancel the running status, as the Midi spec requires.
+ *
+ * The playback options (tempo, transpose, instruments, muted tracks
+ * and channels, pause time) are applied by a MidiTransform while the
+ * events are written, so the original events are never copied.  With
+ * a MidiSeekIndex, starting at a pause time doesn't read the notes
+ * before it.
+ */
+
+/** @struct MidiTransform
+ * The changes to make to the events as they are encoded.  Start from
+ * midiTransformInit(), which changes nothing.
+ */
+typedef struct _MidiTransform {
+    int transpose;                  /** Added to the note number of NoteOn, NoteOff and KeyPressure events */
+    int tempo;                      /** If > 0, each track starts with this tempo, and it replaces every other tempo */
+    const int *trackinstruments;    /** Per track: the instrument of its ProgramChange events, or NULL to keep them */
+    const int *channelinstruments;  /** Per channel: the same, by channel instead of track, or NULL */
+    const int *keeptracks;          /** Per track: false to leave the track out, or NULL to keep them all */
+    int mutechannels;               /** Bit i set: NoteOn/NoteOff events on channel i get velocity 0 */
+    int pausetime;                  /** If not 0, start at this time: drop the notes before it, and
+                                     *  move the other events before it to the start */
+    const MidiSeekIndex *seekindex; /** If not NULL, the pause time seeks with this index: the same
+                                     *  output, without reading the notes before it */
+} MidiTransform;
+
+/** @struct MidiEncoder
+ * The growable output buffer.
+ */
+typedef struct _MidiEncoder {
+    u_char *data;      /** The encoded file. Owned, until returned */
+    int len;           /** The used length of data */
+    int capacity;      /** The allocated length of data */
+} MidiEncoder;
+
+void    midiTransformInit(MidiTransform *transform);
+u_char* midiEncodeFile(const MidiEventStore *stores, int numtracks,
+                       int trackmode, int quarternote,
+                       const MidiTransform *transform, int *length);
+
+#endif
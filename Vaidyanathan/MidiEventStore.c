@@ -0,0 +1,132 @@
+//
+//  MidiEventStore.c
+//  MetroGnomeiPad
+//
+//  Copyright (c) 2012 Princeton University. All rights reserved.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "MidiEventStore.h"
+
+/* The MidiEventStore keeps the Midi events of a track in parallel
+ * arrays, instead of one MidiEvent object per event.  A NoteOn event
+ * costs 19 bytes here, versus a heap-allocated object of 60+ bytes,
+ * and reading a field is a plain array access.
+ */
+
+/** Grow the columns of the store so that it can hold n events */
+static void eventStoreReserve(MidiEventStore *store, int n) {
+    if (n <= store->capacity)
+        return;
+    int newcapacity = store->capacity * 2;
+    if (newcapacity < n)
+        newcapacity = n;
+    store->deltatime  = (int*)   realloc(store->deltatime,  newcapacity * sizeof(int));
+    store->starttime  = (int*)   realloc(store->starttime,  newcapacity * sizeof(int));
+    store->status     = (u_char*)realloc(store->status,     newcapacity);
+    store->data1      = (u_char*)realloc(store->data1,      newcapacity);
+    store->data2      = (u_char*)realloc(store->data2,      newcapacity);
+    store->payload    = (int*)   realloc(store->payload,    newcapacity * sizeof(int));
+    store->payloadlen = (int*)   realloc(store->payloadlen, newcapacity * sizeof(int));
+    store->capacity = newcapacity;
+}
+
+/** Shrink the columns of the store to fit its events */
+void eventStoreTrim(MidiEventStore *store) {
+    int n = (store->count > 0) ? store->count : 1;
+    if (n >= store->capacity)
+        return;
+    store->deltatime  = (int*)   realloc(store->deltatime,  n * sizeof(int));
+    store->starttime  = (int*)   realloc(store->starttime,  n * sizeof(int));
+    store->status     = (u_char*)realloc(store->status,     n);
+    store->data1      = (u_char*)realloc(store->data1,      n);
+    store->data2      = (u_char*)realloc(store->data2,      n);
+    store->payload    = (int*)   realloc(store->payload,    n * sizeof(int));
+    store->payloadlen = (int*)   realloc(store->payloadlen, n * sizeof(int));
+    store->capacity = n;
+}
+
+/** Initialize an empty store whose payloads refer to the given blob */
+void eventStoreInit(MidiEventStore *store, const u_char *blob, int bloblen, int capacity) {
+    memset(store, 0, sizeof(MidiEventStore));
+    store->blob = blob;
+    store->bloblen = bloblen;
+    if (capacity <= 0)
+        capacity = 1;
+    eventStoreReserve(store, capacity);
+}
+
+/** Free the columns of the store.  The shared blob is not freed. */
+void eventStoreFree(MidiEventStore *store) {
+    free(store->deltatime);
+    free(store->starttime);
+    free(store->status);
+    free(store->data1);
+    free(store->data2);
+    free(store->payload);
+    free(store->payloadlen);
+    free(store->extra);
+    memset(store, 0, sizeof(MidiEventStore));
+}
+
+/** Free an array of stores, created with malloc */
+void eventStoreFreeList(MidiEventStore *stores, int count) {
+    if (stores == NULL)
+        return;
+    for (int i = 0; i < count; i++) {
+        eventStoreFree(&stores[i]);
+    }
+    free(stores);
+}
+
+/** Append an event to the end of the store.  Return its index. */
+int eventStoreAdd(MidiEventStore *store, int deltatime, int starttime,
+                  u_char status, u_char data1, u_char data2,
+                  int payload, int payloadlen) {
+    eventStoreReserve(store, store->count + 1);
+    int i = store->count;
+    store->deltatime[i] = deltatime;
+    store->starttime[i] = starttime;
+    store->status[i] = status;
+    store->data1[i] = data1;
+    store->data2[i] = data2;
+    store->payload[i] = payload;
+    store->payloadlen[i] = payloadlen;
+    store->count++;
+    return i;
+}
+
+/** Add new payload bytes to the store, and return their offset */
+int eventStoreAddPayload(MidiEventStore *store, const u_char *bytes, int len) {
+    if (store->extralen + len > store->extracap) {
+        int newcap = store->extracap * 2;
+        if (newcap < store->extralen + len)
+            newcap = store->extralen + len + 16;
+        store->extra = (u_char*)realloc(store->extra, newcap);
+        store->extracap = newcap;
+    }
+    int offset = store->bloblen + store->extralen;
+    if (len > 0) {
+        memcpy(&store->extra[store->extralen], bytes, len);
+    }
+    store->extralen += len;
+    return offset;
+}
+
+/** Return the Sysex/Meta data bytes of event i */
+const u_char* eventStorePayload(const MidiEventStore *store, int i) {
+    int offset = store->payload[i];
+    if (offset < store->bloblen)
+        return &store->blob[offset];
+    else
+        return &store->extra[offset - store->bloblen];
+}
+
+/** Return the tempo (microseconds per quarter note) of a Tempo meta event */
+int eventStoreTempo(const MidiEventStore *store, int i) {
+    if (store->payloadlen[i] < 3)
+        return 0;
+    const u_char *value = eventStorePayload(store, i);
+    return (value[0] << 16) | (value[1] << 8) | value[2];
+}
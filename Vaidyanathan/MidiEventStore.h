@@ -0,0 +1,87 @@
+//
+//  MidiEventStore.h
+//  MetroGnomeiPad
+//
+//  Copyright (c) 2012 Princeton University. All rights reserved.
+//
+
+#ifndef MetroGnomeiPad_MidiEventStore_h
+#define MetroGnomeiPad_MidiEventStore_h
+
+#include <sys/types.h>
+
+/** @struct MidiEventStore
+ *
+ * The raw Midi events of a single track, stored column-wise.
+ * Event i is described by deltatime[i], starttime[i], status[i],
+ * data1[i], data2[i], and (for Sysex/Meta events) payload[i] and
+ * payloadlen[i].
+ *
+ * status  - The full status byte.  For channel events this is the
+ *           event flag plus the channel (e.g. 0x93 is NoteOn, channel 3).
+ *           For Sysex and Meta events it is 0xF0, 0xF7 or 0xFF.
+ * data1   - The first data byte: the note number, controller number,
+ *           instrument, channel pressure, the high byte of the pitch
+ *           bend, or the metaevent code for Meta events.
+ * data2   - The second data byte: the velocity, key pressure,
+ *           controller value, or the low byte of the pitch bend.
+ * payload - The offset of the Sysex/Meta data in the payload blob.
+ *
+ * The payload offsets refer to a blob shared by all the tracks of a
+ * file, normally the mapped file data.  Payloads created after parsing
+ * (like a new tempo) are appended to a small per-track extra buffer,
+ * addressed by offsets past the end of the shared blob.  Always use
+ * eventStorePayload() to get at the bytes.
+ */
+typedef struct _MidiEventStore {
+    int count;            /** The number of events */
+    int capacity;         /** The allocated length of each column */
+    int *deltatime;       /** The time between the previous event and this one */
+    int *starttime;       /** The absolute time this event occurs */
+    u_char *status;       /** The status byte (event flag + channel) */
+    u_char *data1;        /** The first data byte, or the metaevent code */
+    u_char *data2;        /** The second data byte */
+    int *payload;         /** Offset of the Sysex/Meta data */
+    int *payloadlen;      /** Length of the Sysex/Meta data */
+
+    const u_char *blob;   /** The shared payload blob. Not owned */
+    int bloblen;          /** The length of the shared blob */
+    u_char *extra;        /** Payload bytes added after parsing. Owned */
+    int extralen;         /** The used length of extra */
+    int extracap;         /** The allocated length of extra */
+} MidiEventStore;
+
+void eventStoreInit(MidiEventStore *store, const u_char *blob, int bloblen, int capacity);
+void eventStoreFree(MidiEventStore *store);
+void eventStoreTrim(MidiEventStore *store);
+void eventStoreFreeList(MidiEventStore *stores, int count);
+int  eventStoreAdd(MidiEventStore *store, int deltatime, int starttime,
+                   u_char status, u_char data1, u_char data2,
+                   int payload, int payloadlen);
+int  eventStoreAddPayload(MidiEventStore *store, const u_char *bytes, int len);
+const u_char* eventStorePayload(const MidiEventStore *store, int index);
+int  eventStoreTempo(const MidiEventStore *store, int index);
+
+/** Return the event flag (NoteOn, NoteOff, MetaEvent, etc) of event i */
+static inline u_char eventStoreFlag(const MidiEventStore *store, int i) {
+    u_char status = store->status[i];
+    return (status >= 0xF0) ? status : (u_char)(status & 0xF0);
+}
+
+/** Return the channel of event i.  Only valid for channel events. */
+static inline u_char eventStoreChannel(const MidiEventStore *store, int i) {
+    return (u_char)(store->status[i] & 0x0F);
+}
+
+/** Return the number of data bytes that follow the status byte of a
+ *  channel event, or -1 for Sysex/Meta events.
+ */
+static inline int eventStoreDataLength(u_char eventflag) {
+    switch (eventflag) {
+        case 0xC0: case 0xD0: return 1;
+        case 0xF0: case 0xF7: case 0xFF: return -1;
+        default: return 2;
+    }
+}
+
+#endif
@@ -20,6 +20,16 @@
 
 #import "Array.h"
 #import "MGTimeSignature.h"
+#include "MidiEventStore.h"
+#include "MidiDecoder.h"
+#include "MidiTempoMap.h"
+#include "MidiEncoder.h"
+#include "NotePairer.h"
+#include "HandSplitter.h"
+#include "OnsetIndex.h"
+#include "MidiNoteArray.h"
+#include "Quantizer.h"
+#include "MeterDetector.h"
 
 @interface MidiFileException : NSException {
 }
@@ -98,48 +108,35 @@
 -(void)dealloc;
 @end
 
-@interface MidiNote : NSObject <NSCopying> {
-    int starttime;  /** The start time, in pulses */
-    int channel;    /** The channel */
-    int notenumber; /** The note, from 0 to 127. Middle C is 60 */
-    int duration;   /** The duration, in pulses */
-}
-
--(int)startTime;
--(void)setStarttime:(int)value;
--(int)channel;
--(void)setChannel:(int)value;
--(int)number;
--(void)setNumber:(int)value;
--(int)duration;
--(void)setDuration:(int)value;
--(int)endTime;
--(void)noteOff:(int)endtime;
--(id)copyWithZone:(NSZone*)zone;
--(NSString*)description;
-
-@end
-
-int sortbynote(void* note1, void* note2);
-int sortbytime(void* note1, void* note2);
-
 @interface MidiTrack : NSObject <NSCopying> {
     int tracknum;          /** The track number */
-    Array* notes;          /** Array of notes */
+    MidiNoteArray *notes;  /** The notes, in start time order. May be shared with copies of the track */
+    int pitchoffset;       /** Added to each note number when read (kept within 0 to 127) */
+    int timeoffset;        /** Added to each note start time when read */
     int instrument;        /** Instrument for this track */
 }
 -(id)initWithTrack:(int)tracknum;
--(id)initWithEvents:(Array*)events andTrack:(int)tracknum;
+-(id)initWithEvents:(MidiEventStore*)events andTrack:(int)tracknum;
+-(id)initWithEvents:(MidiEventStore*)events andTrack:(int)tracknum
+         andOverlap:(int)overlap andDangling:(int)dangling;
 -(void)dealloc;
 -(int)number;
 -(void)setNumber:(int)value;
--(Array*)notes;
+-(MidiNoteArray*)notes;
+-(const MidiNoteArray*)readNotes;
+-(int)noteCount;
+-(MidiNoteData)noteAt:(int)index;
+-(int)pitchOffset;
+-(void)setPitchOffset:(int)value;
+-(int)timeOffset;
+-(void)setTimeOffset:(int)value;
 -(NSString*)instrumentName;
 -(int)instrument;
 -(void)setInstrument:(int)value;
 -(NSString*)description;
--(void)addNote:(MidiNote *)m;
--(void)noteOffWithChannel:(int)channel andNumber:(int)num andTime:(int)endtime;
+-(void)addNote:(const MidiNoteData*)note;
+-(void)sortNotes;
+-(void)buildOnsetIndex:(OnsetIndex*)index;
 -(id)copyWithZone:(NSZone *)zone;
 
 @end
@@ -148,8 +145,14 @@ int sortbytime(void* note1, void* note2);
     u_char *data;      /** The entire midi file data */
     int datalen;       /** The data length */
     int parse_offset;  /** The current offset while parsing */
+    BOOL mapped;       /** True if readBytes returns slices into data, instead of copies */
+    BOOL usemmap;      /** True if data was mmap'ed, false if malloc'ed */
+    MidiFileReader *parent; /** The reader whose data we share, or nil */
 }
 -(id)initWithFile:(NSString*)filename;
+-(id)initWithMappedFile:(NSString*)filename;
+-(id)initWithReader:(MidiFileReader*)reader atOffset:(int)offset;
+-(BOOL)mapped;
 -(void)checkRead:(int)amount;
 -(u_char)peek;
 -(u_char)readByte;
@@ -160,24 +163,48 @@ int sortbytime(void* note1, void* note2);
 -(int)readVarlen;
 -(void)skip:(int)amount;
 -(int)offset;
+-(u_char*)data;
+-(int)datalen;
 -(void)dealloc;
 @end
 
 /******************************************************************************/
 
+/** @struct SheetMusicCache
+ * The intermediate results of changeSheetMusicOptions, with the options
+ * each was made with.  A stage is reused while its options are unchanged.
+ */
+typedef struct _SheetMusicCache {
+    IntArray *selected;        /** The track selection (options->tracks) of rounded */
+    QuantizeOptions quantize;  /** The quantize options of rounded */
+    Array *rounded;            /** The selected tracks, with start times and durations rounded */
+    BOOL twoStaffs;            /** The twoStaffs option of staffs */
+    int measure;               /** The measure length staffs was split with */
+    Array *staffs;             /** rounded, combined into two staffs if twoStaffs */
+} SheetMusicCache;
+
 @interface MidiFile : NSObject {
     NSString* filename;      /** The Midi file name */
-    Array *events;           /** Array< Array<MidiEvent>> : the raw midi events. An Array of MidiTracks */
+    MidiFileReader *reader;  /** The mapped file data. Owns the meta/sysex payloads of events */
+    MidiEventStore *stores;  /** The raw midi events, one MidiEventStore per track */
+    int numstores;           /** The number of tracks in the midi file (stores) */
+    Array *events;           /** Array< Array<MidiEvent>> : the raw midi events as objects. Created on demand */
     Array *tracks;           /** The tracks (MidiTrack) of the midifile that have notes. Array of MidiTracks that contain notes */
     u_short trackmode;       /** 0 (single track), 1 (simultaneous tracks) 2 (independent tracks) */
     MGTimeSignature* timesig;  /** The time signature */
     int quarternote;         /** The number of pulses per quarter note */
     int totalpulses;         /** The total length of the song, in pulses */
     BOOL trackPerChannel;    /** True if we've split each channel into a track */
+    MidiSeekIndex *seekindex;  /** Checkpoints for starting at a pause time. Created on the first seek */
+    MidiTempoMap tempomap;   /** Every tempo change, for converting pulses to real time */
+    int transposition;       /** The total of transposeByAmount. Applied when the file is encoded */
+    SheetMusicCache sheetcache;  /** The cached stages of changeSheetMusicOptions */
 }
 //Instance Methods
 -(Array*)events;
--(NSString *)writeTemporaryMIDI; //Returns filepath of new Midi file
+-(MidiEventStore*)eventStores;
+-(int)eventStoreCount;
+-(NSData *)midiData; //Returns the Midi data, for playback from memory
 -(void)transposeByAmount:(int)interval;
 -(u_short)trackmode;
 -(MGTimeSignature *)timesig;
@@ -185,44 +212,65 @@ int sortbytime(void* note1, void* note2);
 -(int)quarternote;
 
 -(id)initWithFile:(NSString*)path;
--(Array*)readTrack:(MidiFileReader*)file;
+-(id)initWithFile:(NSString*)path andOptions:(MidiLoadOptions*)options;
+-(IntArray*)findTracks:(MidiFileReader*)file count:(int)num_tracks;
+-(void)readTracks:(MidiFileReader*)file count:(int)num_tracks withOptions:(MidiLoadOptions*)options;
 -(Array*)tracks;
 -(MGTimeSignature*)time;
 -(NSString*)filename;
 -(NSString*)description;
 -(int)totalpulses;
+-(const MidiTempoMap*)tempoMap;
+-(long long)microsecondsAtPulse:(int)pulse;
+-(int)pulseAtMicroseconds:(long long)micros;
+-(void)startMicroseconds:(long long*)micros ofNotes:(const MidiNoteArray*)notes;
+-(int)guessMeter:(MeterCandidate*)candidates maxCount:(int)max tempo:(MeterTempo*)tempo;
 -(IntArray*)guessMeasureLength;
+-(NSData*)changeSound:(MidiSoundOptions *)options;
 -(BOOL)changeSound:(MidiSoundOptions *)options toFile:(NSString*)filename;
--(BOOL)changeSoundPerChannel:(MidiSoundOptions *)options toFile:(NSString*)filename;
+-(NSData*)changeSoundPerChannel:(MidiSoundOptions *)options;
+-(MidiSeekIndex*)seekIndex:(int)pauseTime;
 -(Array*)changeSheetMusicOptions:(SheetMusicOptions*)options;
+-(void)clearSheetMusicCache;
 
 
 //Class Methods
-+(void)findHighLowNotes:(Array*)notes withMeasure:(int)measurelen startIndex:(int)startindex
++(void)findHighLowNotes:(const MidiNoteArray*)notes withMeasure:(int)measurelen startIndex:(int)startindex
                         fromStart:(int)starttime toEnd:(int)endtime withHigh:(int*)high
                         andLow:(int*)low;
-+(void)findExactHighLowNotes:(Array*)notes startIndex:(int)startindex
++(void)findExactHighLowNotes:(const MidiNoteArray*)notes startIndex:(int)startindex
                         withStart:(int)starttime withHigh:(int*)high
                         andLow:(int*)low; 
 
++(void)scanHighLowNotes:(const MidiNoteArray*)notes withMeasure:(int)measurelen
+               withHigh:(int*)high andLow:(int*)low
+          withHighExact:(int*)highExact andLowExact:(int*)lowExact;
++(void)findHighLowNotes:(const MidiNoteArray*)notes withMeasure:(int)measurelen
+               withHigh:(int*)high andLow:(int*)low
+          withHighExact:(int*)highExact andLowExact:(int*)lowExact;
 +(Array*)splitTrack:(MidiTrack *)track withMeasure:(int)measurelen;
-+(Array*)splitChannels:(MidiTrack *)track withEvents:(Array*)events;
++(Array*)splitChannels:(MidiTrack *)track withEvents:(MidiEventStore*)events;
 +(MidiTrack*) combineToSingleTrack:(Array *)tracks;
 
 +(Array*)combineToTwoTracks:(Array *)tracks withMeasure:(int)measurelen;
++(Array*)copyTracks:(Array *)tracks;
 +(void)checkStartTimes:(Array *)tracks;
-+(void)roundStartTimes:(Array *)tracks toInterval:(int)millisec  withTime:(MGTimeSignature*)time;
++(void)roundStartTimes:(Array *)tracks toInterval:(int)millisec  withTempoMap:(const MidiTempoMap*)map;
++(void)quantizeStartTimes:(Array *)tracks withOptions:(const QuantizeOptions*)options withTempoMap:(const MidiTempoMap*)map;
 +(void)roundDurations:(Array *)tracks withQuarter:(int)quarternote;
 +(void)shiftTime:(Array*)tracks byAmount:(int)amount;
 +(void)transpose:(Array*)tracks byAmount:(int)amount;
 +(BOOL)hasMultipleChannels:(MidiTrack*) track;
 +(NSArray*) instrumentNames;
 
-+(int)getTrackLength:(Array*)events;
-+(BOOL)writeMidiFile:(NSString*)filename withEvents:(Array*)events andMode:(int)mode andQuarter:(int)quarter;
-+(Array*)cloneMidiEvents:(Array*)origlist;
-+(void) addTempoEvent:(Array*)eventlist withTempo:(int)tempo;
-+(Array*)startAtPauseTime:(int)pauseTime withEvents:(Array*)list;
++(int)getTrackLength:(MidiEventStore*)events;
++(NSData*)midiDataWithEvents:(MidiEventStore*)eventlists count:(int)numtracks
+                     andMode:(int)mode andQuarter:(int)quarter;
++(NSData*)midiDataWithEvents:(MidiEventStore*)eventlists count:(int)numtracks
+                     andMode:(int)mode andQuarter:(int)quarter
+                andTransform:(MidiTransform*)transform;
++(BOOL)writeMidiFile:(NSString*)filename withEvents:(MidiEventStore*)eventlists count:(int)numtracks
+             andMode:(int)mode andQuarter:(int)quarter;
 
 @end
 
@@ -21,7 +21,9 @@
 #include <assert.h>
 #include <stdio.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <math.h>
+#include <dispatch/dispatch.h>
 
 /* This file contains the classes for parsing and modifying MIDI music files */
 
@@ -239,14 +241,6 @@ static int varlenToBytes(int num, u_char *buf, int offset) {
     }
 }
 
-/** Write a 4-byte integer to buf[offset : offset+4] */
-static void intToBytes(int value, u_char *buf, int offset) {
-    buf[offset] = (u_char)( (value >> 24) & 0xFF );
-    buf[offset+1] = (u_char)( (value >> 16) & 0xFF );
-    buf[offset+2] = (u_char)( (value >> 8) & 0xFF );
-    buf[offset+3] = (u_char)( value & 0xFF );
-}
-
 /** Write the given buffer to the given file.
  *  If an error occurs, set error = 1.
  */
@@ -375,128 +369,16 @@ static void dowrite(int fd, u_char *buf, int len, int *error) {
     return mevent;
 }
 
-- (void)dealloc {
-    if (eventFlag == MetaEvent || eventFlag == SysexEvent1 ||
-        eventFlag == SysexEvent2) {
-        metavalue = NULL;
-    }
-    [super dealloc];
-}
-
-@end
-
-
-
-/** @class MidiNote
- * A MidiNote contains
- *
- * starttime - The time (measured in pulses) when the note is pressed.
- * channel   - The channel the note is from.  This is used when matching
- *             NoteOff events with the corresponding NoteOn event.
- *             The channels for the NoteOn and NoteOff events must be
- *             the same.
- * notenumber - The note number, from 0 to 127.  Middle C is 60.
- * duration  - The time duration (measured in pulses) after which the 
- *             note is released.
- *
- * A MidiNote is created when we encounter a NoteOff event.  The duration
- * is initially unknown (set to 0).  When the corresponding NoteOff event
- * is found, the duration is set by the method NoteOff().
- */
-
-@implementation MidiNote
-
-- (id)init {
-    starttime = 0;
-    channel = 0;
-    duration = 0;
-    notenumber = 0;
-    return self;
-} 
-
-/* Get and set the MidiNote fields */
-- (int)startTime {
-    return starttime;
-}
-
-- (void)setStarttime:(int)t {
-    starttime = t;
-}
-
-- (int)endTime {
-    return starttime + duration;
-}
-
-- (int)duration {
-    return duration;
-}
-
-- (void)setDuration:(int)d {
-    duration = d;
-}
-
-- (int)channel {
-    return channel;
-}
-
-- (void)setChannel:(int)n {
-    channel = n;
-}
-
-- (int)number {
-    return notenumber;
-}
-
-- (void)setNumber:(int)n {
-    notenumber = n;
-}
-
-/* A NoteOff event occurs for this note at the given time.
- * Calculate the note duration based on the noteoff event.
+/* The metavalue of a Sysex/Meta event is a slice into the mapped
+ * file data, owned by the MidiFile's reader.  So there's nothing to free.
  */
-- (void)noteOff:(int)endtime {
-    duration = endtime - starttime;
-}
-
-- (id)copyWithZone:(NSZone*)zone {
-    MidiNote *m = [[MidiNote alloc] init];
-    [m setStarttime:starttime];
-    [m setChannel:channel];
-    [m setNumber:notenumber];
-    [m setDuration:duration];
-    return m;
-}
-
-- (NSString*)description {
-    NSString *s = [NSString stringWithFormat:
-                      @"MidiNote channel=%d number=%d start=%d duration=%d",
-                      channel, notenumber, starttime, duration ];
-    return s;
-}
-
 - (void)dealloc {
+    metavalue = NULL;
     [super dealloc];
 }
 
-@end /* class MidiNote */
-
-/** Compare two MidiNotes based on their start times.
- *  If the start times are equal, compare by their numbers.
- *  Used by the C mergesort function.
- */
-int sortbytime(void* v1, void* v2) {
-    MidiNote **m1 = (MidiNote**) v1;
-    MidiNote **m2 = (MidiNote**) v2;
-    MidiNote *note1 = *m1;
-    MidiNote *note2 = *m2;
+@end
 
-    if ([note1 startTime] == [note2 startTime]) {
-        return [note1 number] - [note2 number];
-    }
-    else {
-        return [note1 startTime] - [note2 startTime];
-    }
-}
 
 
 /** @class MidiTrack
@@ -504,18 +386,46 @@ int sortbytime(void* v1, void* v2) {
  * - The list of midi notes in the track.
  * - The first instrument used in the track.
  *
- * For each NoteOn event in the midi file, a new MidiNote is created
- * and added to the track, using the AddNote() method.
- * 
- * The NoteOff() method is called when a NoteOff event is encountered,
- * in order to update the duration of the MidiNote.
+ * The notes are kept by value, in a MidiNoteArray (see MidiNoteArray.h),
+ * so copying a track doesn't create an object per note.  Each note has:
+ *
+ * starttime - The time (measured in pulses) when the note is pressed.
+ * channel   - The channel the note is from.
+ * number    - The note number, from 0 to 127.  Middle C is 60.
+ * duration  - The time duration (measured in pulses) after which the
+ *             note is released.
+ *
+ * The NoteOn/NoteOff events are matched up by a NotePairer in
+ * initWithEvents, which sets the duration of each note from its
+ * NoteOff event (see NotePairer.h for overlapping and dangling notes).
+ * addNote adds a note that already has its duration.
+ *
+ * Copies of a track share its MidiNoteArray.  Transposing or shifting
+ * a track only sets its pitch/time offset, which is applied as the
+ * notes are read (noteAt).  The notes are only copied, with the
+ * offsets applied, when the track changes them (see notes).
  */ 
 @implementation MidiTrack
 
+/** Return the note moved by the given pitch and time offsets.
+ *  The note number is kept within 0 to 127.
+ */
+static inline MidiNoteData offsetNote(MidiNoteData note, int pitch, int time) {
+    note.starttime += time;
+    note.number += pitch;
+    if (note.number < 0)
+        note.number = 0;
+    if (note.number > 127)
+        note.number = 127;
+    return note;
+}
+
 /** Create an empty MidiTrack. Used by the copy method */
 - (id)initWithTrack:(int)t {
     tracknum = t;
-    notes = [Array new:20];
+    notes = noteArrayCreate(20);
+    pitchoffset = 0;
+    timeoffset = 0;
     instrument = 0;
     return self;
 }
@@ -523,35 +433,59 @@ int sortbytime(void* v1, void* v2) {
 /** Create a MidiTrack based on the Midi events.  Extract the NoteOn/NoteOff
  *  events to gather the list of MidiNotes.
  */
-- (id)initWithEvents:(Array*)list andTrack:(int)num {
+- (id)initWithEvents:(MidiEventStore*)list andTrack:(int)num {
+    return [self initWithEvents:list andTrack:num
+                     andOverlap:NoteOverlapLastOpened andDangling:NoteDanglingKeep];
+}
+
+/** Create a MidiTrack based on the Midi events.  The NoteOn/NoteOff
+ *  events are matched up by a NotePairer, with the given policies for
+ *  overlapping notes on the same key, and for notes that are never
+ *  turned off.
+ */
+- (id)initWithEvents:(MidiEventStore*)list andTrack:(int)num
+          andOverlap:(int)overlap andDangling:(int)dangling {
     tracknum = num;
-    notes = [Array new:100]; //arbitrary starting size
     instrument = 0;
+    pitchoffset = 0;
+    timeoffset = 0;
 
-    for (int i= 0;i < [list count]; i++) {
-        MidiEvent *mevent = [list get:i];
-        if ([mevent eventFlag] == EventNoteOn && [mevent velocity] > 0) {
-            MidiNote *note = [[MidiNote alloc] init];
-            [note setStarttime:[mevent startTime]];
-            [note setChannel:[mevent channel]];
-            [note setNumber:[mevent notenumber]];
-            [self addNote:note];
-            [note release];
+    NotePairer *pairer = (NotePairer*)malloc(sizeof(NotePairer));
+    notePairerInit(pairer, overlap, dangling, list->count / 2);
+    for (int i = 0; i < list->count; i++) {
+        u_char eventflag = eventStoreFlag(list, i);
+        if (eventflag == EventNoteOn && list->data2[i] > 0) {
+            notePairerNoteOn(pairer, eventStoreChannel(list, i), list->data1[i],
+                             list->data2[i], list->starttime[i], i);
         }
-        else if ([mevent eventFlag] == EventNoteOn && [mevent velocity] == 0) {
-            [self noteOffWithChannel:[mevent channel] andNumber:[mevent notenumber]
-                  andTime:[mevent startTime] ];
+        else if (eventflag == EventNoteOn || eventflag == EventNoteOff) {
+            notePairerNoteOff(pairer, eventStoreChannel(list, i), list->data1[i],
+                              list->starttime[i]);
         }
-        else if ([mevent eventFlag] == EventNoteOff) {
-            [self noteOffWithChannel:[mevent channel] andNumber:[mevent notenumber]
-                  andTime:[mevent startTime] ];
+        else if (eventflag == EventProgramChange) {
+            instrument = list->data1[i];
         }
-        else if ([mevent eventFlag] == EventProgramChange) {
-            instrument = [mevent instrument];
+    }
+    int endtime = (list->count > 0) ? list->starttime[list->count - 1] : 0;
+    notePairerFinish(pairer, endtime);
+
+    notes = noteArrayCreate(pairer->count);
+    for (int i = 0; i < pairer->count; i++) {
+        PairedNote *paired = &pairer->notes[i];
+        if (paired->dropped) {
+            continue;
         }
-        else NSLog(@"Not a MIDITrack event");
+        MidiNoteData note;
+        note.starttime = paired->starttime;
+        note.duration = paired->duration;
+        note.channel = paired->channel;
+        note.number = paired->number;
+        noteArrayAdd(notes, &note);
     }
-    if ([notes count] > 0 && [(MidiNote*)[notes get:0] channel] == 9) {
+    notePairerFree(pairer);
+    free(pairer);
+
+    if (notes->count > 0 && notes->notes[0].channel == 9) {
         instrument = 128;  /* Percussion */
     }
     return self;
@@ -559,7 +493,7 @@ int sortbytime(void* v1, void* v2) {
 
 
 - (void)dealloc {
-    [notes release];
+    noteArrayRelease(notes);
     [super dealloc];
 }
 
@@ -571,10 +505,83 @@ int sortbytime(void* v1, void* v2) {
     tracknum = value;
 }
 
-- (Array*)notes {
+/** Return the notes, in start time order, to read or change them.
+ *  If the notes are shared with another track (a copy), or there are
+ *  pitch/time offsets to apply, the track first makes its own copy of
+ *  the notes with the offsets applied.  That is the only time notes
+ *  are copied.
+ */
+- (MidiNoteArray*)notes {
+    if (notes->refcount > 1) {
+        MidiNoteArray *own = noteArrayCopy(notes);
+        noteArrayRelease(notes);
+        notes = own;
+    }
+    if (pitchoffset != 0 || timeoffset != 0) {
+        for (int i = 0; i < notes->count; i++) {
+            notes->notes[i] = offsetNote(notes->notes[i], pitchoffset, timeoffset);
+        }
+        pitchoffset = 0;
+        timeoffset = 0;
+    }
+    return notes;
+}
+
+/** Return the notes, in start time order, only to read them.  Unlike
+ *  notes, this doesn't copy notes that are shared with another track.
+ */
+- (const MidiNoteArray*)readNotes {
+    if (pitchoffset != 0 || timeoffset != 0) {
+        return [self notes];
+    }
     return notes;
 }
 
+- (int)noteCount {
+    return notes->count;
+}
+
+/** Return the note at the given index, with the pitch and time
+ *  offsets applied.  This never copies the notes.
+ */
+- (MidiNoteData)noteAt:(int)index {
+    return offsetNote(notes->notes[index], pitchoffset, timeoffset);
+}
+
+/** The amount added to each note number when it is read.  Transposing
+ *  a track only changes this, instead of every note.
+ */
+- (int)pitchOffset {
+    return pitchoffset;
+}
+
+- (void)setPitchOffset:(int)value {
+    pitchoffset = value;
+}
+
+/** The amount added to each start time when it is read */
+- (int)timeOffset {
+    return timeoffset;
+}
+
+- (void)setTimeOffset:(int)value {
+    timeoffset = value;
+}
+
+/** Build the onset index of the notes, which are in start time order.
+ *  Free it with onsetIndexFree().
+ */
+- (void)buildOnsetIndex:(OnsetIndex*)index {
+    const MidiNoteArray *list = [self readNotes];
+    int count = list->count;
+    int *starttimes = (int*)malloc((count + 1) * sizeof(int));
+    for (int i = 0; i < count; i++) {
+        starttimes[i] = list->notes[i].starttime;
+    }
+    onsetIndexBuild(index, starttimes, count);
+    free(starttimes);
+}
+
 - (NSString*)instrumentName {
     if (instrument >= 0 && instrument <= 128) {
         return [[MidiFile instrumentNames] objectAtIndex:instrument];
@@ -593,45 +600,40 @@ int sortbytime(void* v1, void* v2) {
     instrument = value;
 } 
 
-/** Add a MidiNote to this track.  This is called for each NoteOn event */
-- (void)addNote:(MidiNote*)m {
-    [notes add:m];
+/** Add a note, with its duration, to this track */
+- (void)addNote:(const MidiNoteData*)note {
+    noteArrayAdd([self notes], note);
 }
 
-/** A NoteOff event occured.  Find the MidiNote of the corresponding
- * NoteOn event, and update the duration of the MidiNote.
- */
-- (void)noteOffWithChannel:(int)channel andNumber:(int)number andTime:(int)endtime {
-    for (int i = [notes count]-1; i >= 0; i--) {
-        MidiNote* note = [notes get:i];
-        if ([note channel] == channel && [note number] == number &&
-            [note duration] == 0) {
-            [note noteOff:endtime];
-            return;
-        }
+/** Sort the notes by start time, then number */
+- (void)sortNotes {
+    if (!noteArrayIsSorted(notes)) {
+        noteArraySort([self notes]);
     }
 }
 
-/** Return a deep copy clone of this MidiTrack */
+/** Return a copy of this MidiTrack.  The copy shares the notes, so
+ *  this doesn't depend on the number of notes.  Whichever track changes
+ *  its notes first gets its own copy of them (see notes).
+ */
 - (id)copyWithZone:(NSZone*)zone {
-    MidiTrack *track = [[MidiTrack alloc] initWithTrack:tracknum];
-    [track setInstrument:instrument];
-    for (int i = 0; i < [notes count]; i++) {
-        MidiNote *note = [notes get:i];
-        MidiNote *notecopy = [note copy];
-        [[track notes] add:notecopy ];
-        [notecopy release];
-    }
+    MidiTrack *track = [MidiTrack alloc];
+    track->tracknum = tracknum;
+    track->instrument = instrument;
+    track->notes = noteArrayRetain(notes);
+    track->pitchoffset = pitchoffset;
+    track->timeoffset = timeoffset;
     return track;
 }
 
 - (NSString*)description {
     NSString *s = [NSString stringWithFormat:
                       @"Track number=%d instrument=%d\n", tracknum, instrument];
-    for (int i = 0; i < [notes count]; i++) {
-        MidiNote *m = [notes get:i];
-        s = [s stringByAppendingString:[m description]];
-        s = [s stringByAppendingString:@"\n"];
+    for (int i = 0; i < notes->count; i++) {
+        MidiNoteData m = [self noteAt:i];
+        s = [s stringByAppendingFormat:
+                @"MidiNote channel=%d number=%d start=%d duration=%d\n",
+                m.channel, m.number, m.starttime, m.duration];
     }
     s = [s stringByAppendingString:@"End Track\n"];
     return s;
@@ -673,8 +675,11 @@ int sortbytime(void* v1, void* v2) {
  */
 @implementation MidiFileReader
 
-/** Create a new MidiFileReader for the given filename */
-- (id)initWithFile:(NSString*)filename {
+/** Open the given file for reading, and return the file descriptor.
+ *  Store the file size in len.  Throw a MidiFileException if the file
+ *  can't be opened, or is empty.
+ */
+static int openMidiFile(NSString *filename, int *len) {
     const char *name = [filename cStringUsingEncoding:NSASCIIStringEncoding];
     int fd = open(name, O_RDONLY);
     if (fd == -1) {
@@ -688,29 +693,88 @@ int sortbytime(void* v1, void* v2) {
         @throw e;
     }
     struct stat info;
-    int ret = stat(name, &info);
-    if (info.st_size == 0) {
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        close(fd);
         NSString *reason = @"File is empty:";
         reason = [reason stringByAppendingString:filename];
         MidiFileException *e = [MidiFileException init:reason offset:0];
         @throw e;
     }
-    datalen = info.st_size;
-    data = (u_char*)malloc(datalen);
+    *len = (int)info.st_size;
+    return fd;
+}
+
+/** Read the entire file into a newly malloc'ed buffer of length len */
+static u_char* readMidiFile(int fd, int len) {
+    u_char *buf = (u_char*)malloc(len);
     int offset = 0;
     while (1) {
-        if (offset == datalen)
+        if (offset == len)
             break;
-        int n = read(fd, &data[offset], datalen - offset);
+        int n = read(fd, &buf[offset], len - offset);
         if (n <= 0)
             break;
         offset += n;
     }
+    return buf;
+}
+
+/** Create a new MidiFileReader for the given filename */
+- (id)initWithFile:(NSString*)filename {
+    int fd = openMidiFile(filename, &datalen);
+    data = readMidiFile(fd, datalen);
     close(fd);
+    mapped = NO;
     parse_offset = 0;
     return self;
 }
 
+/** Create a new MidiFileReader that memory-maps the given file.
+ *  Instead of returning a malloc'ed copy, readBytes returns a slice
+ *  pointing directly into the mapping.  The slices are only valid
+ *  while this reader is alive, so the owner (the MidiFile) must keep
+ *  the reader around as long as the parsed events are in use.
+ */
+- (id)initWithMappedFile:(NSString*)filename {
+    int fd = openMidiFile(filename, &datalen);
+    void *addr = mmap(NULL, datalen, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED) {
+        /* Fall back to reading the file.  The slices point into our
+         * private buffer instead, so callers see the same behavior.
+         */
+        data = readMidiFile(fd, datalen);
+        usemmap = NO;
+    }
+    else {
+        data = (u_char*)addr;
+        usemmap = YES;
+    }
+    close(fd);
+    mapped = YES;
+    parse_offset = 0;
+    return self;
+}
+
+/** Create a new MidiFileReader that reads the same data as the given
+ *  reader, starting at the given offset.  The data is shared, not copied,
+ *  and the given reader is retained until this reader is freed.
+ *  This lets several threads parse different tracks of the same file.
+ */
+- (id)initWithReader:(MidiFileReader*)reader atOffset:(int)offset {
+    parent = [reader retain];
+    data = [reader data];
+    datalen = [reader datalen];
+    mapped = [reader mapped];
+    usemmap = NO;
+    parse_offset = offset;
+    return self;
+}
+
+/** Return true if readBytes returns slices into the file data */
+- (BOOL)mapped {
+    return mapped;
+}
+
 /** Check that the given number of bytes doesn't exceed the file size */
 - (void)checkRead:(int)amount {
     if (parse_offset + amount > datalen) {
@@ -735,11 +799,20 @@ int sortbytime(void* v1, void* v2) {
     return x;
 }
 
-/** Read the given number of bytes from the file */
+/** Read the given number of bytes from the file.  For a mapped reader,
+ *  return a slice into the file data, which must not be freed.
+ *  Otherwise, return a malloc'ed copy.
+ */
 - (u_char*)readBytes:(int) amount {
     [self checkRead:amount];
-    u_char* result = malloc(sizeof(u_char) * amount);
-    memcpy(result, &data[parse_offset], amount);
+    u_char* result;
+    if (mapped) {
+        result = &data[parse_offset];
+    }
+    else {
+        result = malloc(sizeof(u_char) * amount);
+        memcpy(result, &data[parse_offset], amount);
+    }
     parse_offset += amount;
     return result;
 }
@@ -804,9 +877,27 @@ int sortbytime(void* v1, void* v2) {
     return parse_offset;
 }
 
+/** Return the entire file data */
+- (u_char*)data {
+    return data;
+}
+
+/** Return the length of the file data */
+- (int)datalen {
+    return datalen;
+}
+
 
 - (void)dealloc {
-    free(data);
+    if (parent != nil) {
+        [parent release];
+    }
+    else if (usemmap) {
+        munmap(data, datalen);
+    }
+    else {
+        free(data);
+    }
     [super dealloc];
 }
 
@@ -824,11 +915,14 @@ int sortbytime(void* v1, void* v2) {
  * - The time signature (e.g. 4/4, 3/4, 6/8)
  * - The number of pulses per quarter note.
  * - The tempo (number of microseconds per quarter note).
+ * - The tempo map, with every tempo change, for converting between
+ *   pulses and real time (microsecondsAtPulse, pulseAtMicroseconds).
  *
  * The constructor takes a filename as input, and upon returning,
  * contains the parsed data from the midi file.
  *
- * The methods readTrack() and readMetaEvent() are helper functions called
+ * The parsing itself is done by the C functions in MidiDecoder.c.
+ * The methods findTracks() and readTracks() are helper functions called
  * by the constructor during the parsing.
  *
  * After the MidiFile is parsed and created, the user can retrieve the 
@@ -839,27 +933,118 @@ int sortbytime(void* v1, void* v2) {
  *
  * - changeSheetMusicOptions()
  *   Apply the menu options to the parsed MidiFile.  This uses the helper functions:
- *     splitTrack()
+ *     splitTrack()  (with the HandSplitter)
  *     combineToTwoTracks()
  *     shiftTime()
  *     transpose()
  *     roundStartTimes()
- *     roundDurations()
+ *     roundDurations()  (with the OnsetIndex)
  *
  * - changeSound()
- *   Apply the menu options to the MIDI music data, and save the modified midi data
- *   to a file, for playback.  This uses the helper functions:
- *     addTempoEvent()
+ *   Apply the menu options to the MIDI music data, and return the modified midi
+ *   data in memory (or save it to a file), for playback.  The changes are
+ *   applied by a MidiTransform while the events are encoded, so the events
+ *   are never copied.  Starting at a pause time uses the MidiSeekIndex,
+ *   instead of reading every note before it.  This uses the helper functions:
  *     changeSoundPerChannel
+ *     midiDataWithEvents()
  */
 
 @implementation MidiFile
 
-/*Z: Return the list of events*/
+/** Return the MidiFileException for a MidiDecoder error code */
+static MidiFileException* decodeException(int error, int offset) {
+    NSString *reason = [NSString stringWithUTF8String:midiDecodeErrorString(error)];
+    return [MidiFileException init:reason offset:offset];
+}
+
+/** Create a MidiEvent object for event i of the given track events */
+static MidiEvent* newMidiEvent(MidiEventStore *list, int i) {
+    MidiEvent *mevent = [[MidiEvent alloc] init];
+    u_char eventflag = eventStoreFlag(list, i);
+    u_char data1 = list->data1[i];
+    u_char data2 = list->data2[i];
+
+    [mevent setDeltaTime:list->deltatime[i]];
+    [mevent setStartTime:list->starttime[i]];
+    [mevent setHasEventflag:YES];
+    [mevent setEventFlag:eventflag];
+    if (eventflag < SysexEvent1) {
+        [mevent setChannel:eventStoreChannel(list, i)];
+    }
+    switch (eventflag) {
+        case EventNoteOn:
+        case EventNoteOff:
+            [mevent setNotenumber:data1];
+            [mevent setVelocity:data2];
+            break;
+        case EventKeyPressure:
+            [mevent setNotenumber:data1];
+            [mevent setKeyPressure:data2];
+            break;
+        case EventControlChange:
+            [mevent setControlNum:data1];
+            [mevent setControlValue:data2];
+            break;
+        case EventProgramChange:
+            [mevent setInstrument:data1];
+            break;
+        case EventChannelPressure:
+            [mevent setChanPressure:data1];
+            break;
+        case EventPitchBend:
+            [mevent setPitchBend:(u_short)((data1 << 8) | data2)];
+            break;
+        case MetaEvent:
+            [mevent setMetaevent:data1];
+            /* Fall through */
+        default:
+            [mevent setMetalength:list->payloadlen[i]];
+            [mevent setMetavalue:(u_char*)eventStorePayload(list, i)];
+            break;
+    }
+    if (eventflag == MetaEvent && data1 == MetaEventTimeSignature) {
+        [mevent setNumerator:[mevent metavalue][0] ];
+        [mevent setDenominator:(int)pow(2, [mevent metavalue][1])];
+    }
+    else if (eventflag == MetaEvent && data1 == MetaEventTempo) {
+        [mevent setTempo:eventStoreTempo(list, i)];
+    }
+    return mevent;
+}
+
+/*Z: Return the list of events.
+ * The events are stored in MidiEventStores.  The MidiEvent objects
+ * are only created the first time this method is called.
+ */
 -(Array*)events {
+    if (events == nil) {
+        events = [Array new:numstores];
+        for (int tracknum = 0; tracknum < numstores; tracknum++) {
+            MidiEventStore *list = &stores[tracknum];
+            Array *trackevents = [Array new:list->count];
+            for (int i = 0; i < list->count; i++) {
+                MidiEvent *mevent = newMidiEvent(list, i);
+                [trackevents add:mevent];
+                [mevent release];
+            }
+            [events add:trackevents];
+            [trackevents release];
+        }
+    }
     return events;
 }
 
+/** Return the raw midi events, one MidiEventStore per track */
+-(MidiEventStore*)eventStores {
+    return stores;
+}
+
+/** Return the number of tracks in the midi file, including tracks without notes */
+-(int)eventStoreCount {
+    return numstores;
+}
+
 /** Get the list of tracks (MidiTrack) */
 - (Array*)tracks {
     return tracks;
@@ -880,6 +1065,34 @@ int sortbytime(void* v1, void* v2) {
     return totalpulses;
 }
 
+/** The tempo changes of the song */
+- (const MidiTempoMap*)tempoMap {
+    return &tempomap;
+}
+
+/** Return the time of the given pulse, in microseconds from the start */
+- (long long)microsecondsAtPulse:(int)pulse {
+    return midiTempoMapMicros(&tempomap, pulse);
+}
+
+/** Return the pulse at the given time, in microseconds from the start */
+- (int)pulseAtMicroseconds:(long long)micros {
+    return midiTempoMapPulse(&tempomap, micros);
+}
+
+/** Fill in the start time, in microseconds, of each note in the array.
+ *  The notes are normally in time order, so this is a single pass.
+ */
+- (void)startMicroseconds:(long long*)micros ofNotes:(const MidiNoteArray*)notes {
+    int count = notes->count;
+    int *pulses = (int*)malloc((count + 1) * sizeof(int));
+    for (int i = 0; i < count; i++) {
+        pulses[i] = notes->notes[i].starttime;
+    }
+    midiTempoMapMicrosArray(&tempomap, pulses, micros, count);
+    free(pulses);
+}
+
 /** Parse the given Midi file, and return an instance of this MidiFile
  * class.  After reading the midi file, this object will contain:
  * - The raw list of midi events
@@ -888,52 +1101,48 @@ int sortbytime(void* v1, void* v2) {
  * - The number, starttime, and duration of each note.
  */
 - (id)initWithFile:(NSString*)path {
-    const char *hdr;
-    int len;
+    return [self initWithFile:path andOptions:NULL];
+}
 
+/** Parse the given Midi file, keeping only the events, tracks and
+ * channels named in the options.  The other events are skipped over
+ * while decoding, without being stored.  If options is NULL, keep
+ * all the events.
+ */
+- (id)initWithFile:(NSString*)path andOptions:(MidiLoadOptions*)options {
     filename = [path retain];
     tracks = [Array new:5];
     trackPerChannel = NO;
 
-    MidiFileReader *file = [[MidiFileReader alloc] initWithFile:filename];
-    hdr = [file readAscii:4];
-    if (strncmp(hdr, "MThd", 4) != 0) {
-		[file release];
-        MidiFileException *e =
-           [MidiFileException init:@"Bad MThd header" offset:0];
-        @throw e;
-    }
-    len = [file readInt];
-    if (len !=  6) {
-        [file release];
-        MidiFileException *e =
-           [MidiFileException init:@"Bad MThd len" offset:4];
-        @throw e;
-    }
-    trackmode = [file readShort];
-    int num_tracks = [file readShort];
-    quarternote = [file readShort];
-
-    events = [Array new:num_tracks]; //Events is an array of arrays of each track
-    for (int tracknum = 0; tracknum < num_tracks; tracknum++) {
-        Array *trackevents = [self readTrack:file];
-        MidiTrack *track = 
-          [[MidiTrack alloc] initWithEvents:trackevents andTrack:tracknum];
-        [events add:trackevents];
-        [trackevents release];
-        [track setNumber:tracknum];
-        if ([[track notes] count] > 0) {
-            [tracks add:track];
-        }
-        [track release];
-    }
+    /* The reader is kept until dealloc, since the Sysex/Meta event
+     * payloads point directly into its mapped data.
+     */
+    MidiFileReader *file = [[MidiFileReader alloc] initWithMappedFile:filename];
+    reader = file;
+    MidiHeader header;
+    int erroroffset = 0;
+    int error = midiDecodeHeader([file data], [file datalen], &header, &erroroffset);
+    if (error != MidiDecodeOK) {
+        @throw decodeException(error, erroroffset);
+    }
+    [file skip:14];
+    trackmode = header.trackmode;
+    int num_tracks = header.numtracks;
+    quarternote = header.quarternote;
+
+    events = nil;
+    numstores = num_tracks;
+    stores = (MidiEventStore*)calloc(num_tracks, sizeof(MidiEventStore));
+    [self readTracks:file count:num_tracks withOptions:options];
+    midiTempoMapBuild(&tempomap, stores, numstores, quarternote);
 
     /* Get the length of the song in pulses */
     for (int tracknum = 0; tracknum < [tracks count]; tracknum++) {
         MidiTrack *track = [tracks get:tracknum];
-        MidiNote *last = [[track notes] get:([[track notes] count] -1) ];
-        if (totalpulses < [last startTime] + [last duration]) {
-            totalpulses = [last startTime] + [last duration];
+        const MidiNoteArray *notes = [track readNotes];
+        const MidiNoteData *last = &notes->notes[notes->count - 1];
+        if (totalpulses < noteEndTime(last)) {
+            totalpulses = noteEndTime(last);
         }
     }
 
@@ -941,7 +1150,7 @@ int sortbytime(void* v1, void* v2) {
      * each channel as a separate track.
      */
     if ([tracks count] == 1 && [MidiFile hasMultipleChannels:[tracks get:0]]) {
-        Array *trackevents = [events get:[[tracks get:0] number] ];
+        MidiEventStore *trackevents = &stores[ [[tracks get:0] number] ];
         Array* newtracks = [MidiFile splitChannels:[tracks get:0] withEvents:trackevents];
         trackPerChannel = YES;
         [tracks release];
@@ -954,16 +1163,19 @@ int sortbytime(void* v1, void* v2) {
     int tempo = 0;
     int numer = 0;
     int denom = 0;
-    for (int tracknum = 0; tracknum < [events count]; tracknum++) {
-        Array *eventlist = [events get:tracknum];
-        for (int i = 0; i < [eventlist count]; i++) {
-            MidiEvent *mevent = [eventlist get:i];
-            if ([mevent metaevent] == MetaEventTempo && tempo == 0) {
-                tempo = [mevent tempo];
+    for (int tracknum = 0; tracknum < numstores; tracknum++) {
+        MidiEventStore *eventlist = &stores[tracknum];
+        for (int i = 0; i < eventlist->count; i++) {
+            if (eventlist->status[i] != MetaEvent) {
+                continue;
+            }
+            if (eventlist->data1[i] == MetaEventTempo && tempo == 0) {
+                tempo = eventStoreTempo(eventlist, i);
             }
-            if ([mevent metaevent] == MetaEventTimeSignature && numer == 0) {
-                numer = [mevent numerator];
-                denom = [mevent denominator];
+            if (eventlist->data1[i] == MetaEventTimeSignature && numer == 0) {
+                const u_char *value = eventStorePayload(eventlist, i);
+                numer = value[0];
+                denom = (int)pow(2, value[1]);
             }
         }
     }
@@ -979,8 +1191,6 @@ int sortbytime(void* v1, void* v2) {
                      andQuarter:quarternote
                      andTempo:tempo];
 
-    
-    [file release];
     return self;
 }
 
@@ -989,190 +1199,134 @@ int sortbytime(void* v1, void* v2) {
     [tracks release];
     [timesig release];
     [events release];
+    eventStoreFreeList(stores, numstores);
+    midiSeekIndexFree(seekindex);
+    midiTempoMapFree(&tempomap);
+    [self clearSheetMusicCache];
+    [reader release];
     [super dealloc];
 }
 
-/** Parse a single track into a list of MidiEvents.
- * Entering this function, the file offset should be at the start of
- * the MTrk header.  Upon exiting, the file offset should be at the
- * start of the next MTrk header.
+/** Find the start of each MTrk chunk, using the track lengths in the
+ * chunk headers.  Entering this function, the file offset should be
+ * at the start of the first MTrk header.  Return the offsets of the
+ * MTrk headers.
  */
-- (Array*)readTrack:(MidiFileReader*)file {
-    Array *result = [Array new:20];
-    int starttime = 0;
-    const char *hdr = [file readAscii:4];
-
-    if (strncmp(hdr, "MTrk", 4) != 0) {
-        MidiFileException *e =
-           [MidiFileException init:@"Bad MTrk header" offset:([file offset] -4)];
-        @throw e;
+- (IntArray*)findTracks:(MidiFileReader*)file count:(int)num_tracks {
+    int *trackoffsets = (int*)calloc(num_tracks, sizeof(int));
+    int erroroffset = 0;
+    int error = midiFindTracks([file data], [file datalen], [file offset], num_tracks,
+                               trackoffsets, &erroroffset);
+    if (error != MidiDecodeOK) {
+        free(trackoffsets);
+        @throw decodeException(error, erroroffset);
+    }
+    IntArray *offsets = [IntArray new:num_tracks];
+    for (int tracknum = 0; tracknum < num_tracks; tracknum++) {
+        [offsets add:trackoffsets[tracknum]];
     }
-    int tracklen = [file readInt];
-    int trackend = tracklen + [file offset];
-
-    int eventflag = 0;
+    free(trackoffsets);
+    return offsets;
+}
 
-    while ([file offset] < trackend) {
-        /* If the midi file is truncated here, we can still recover.
-         * Just return what we've parsed so far.
-         */
-        int startoffset, deltatime;
-        u_char peekevent;
-        @try {
-            startoffset = [file offset];
-            deltatime = [file readVarlen];
-            starttime += deltatime;
-            peekevent = [file peek];
+/** Parse all the tracks into the MidiEventStores, and create the
+ * MidiTracks for the tracks that have notes.
+ *
+ * The tracks are independent of each other, so after finding where
+ * each track starts, the tracks are decoded in parallel.  The results
+ * are merged back in track order.  If any track fails to parse, the
+ * error for the lowest track number is thrown, just like a serial
+ * parse would.
+ *
+ * If options is not NULL, only the events it names are stored, and
+ * the tracks it excludes are left empty without being decoded.
+ */
+- (void)readTracks:(MidiFileReader*)file count:(int)num_tracks
+       withOptions:(MidiLoadOptions*)options {
+    IntArray *offsets = [self findTracks:file count:num_tracks];
+    MidiTrack **tracklist = (MidiTrack**)calloc(num_tracks, sizeof(MidiTrack*));
+    int *errors = (int*)calloc(num_tracks, sizeof(int));
+    int *erroroffsets = (int*)calloc(num_tracks, sizeof(int));
+    BOOL *skiptrack = (BOOL*)calloc(num_tracks, sizeof(BOOL));
+    MidiEventStore *eventstores = stores;
+    const u_char *data = [file data];
+    int datalen = [file datalen];
+
+    MidiDecodeFilter decodefilter;
+    MidiDecodeFilter *filter = NULL;
+    int overlap = NoteOverlapLastOpened;
+    int dangling = NoteDanglingKeep;
+    if (options != NULL) {
+        overlap = options->overlap;
+        dangling = options->dangling;
+        decodefilter.eventclasses = options->eventclasses;
+        decodefilter.channels = options->channels;
+        filter = &decodefilter;
+        for (int tracknum = 0; tracknum < num_tracks && options->tracks != nil; tracknum++) {
+            skiptrack[tracknum] =
+                (tracknum >= [options->tracks count] || ![options->tracks get:tracknum]);
+        }
+    }
+
+    dispatch_queue_t queue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+    dispatch_apply(num_tracks, queue, ^(size_t tracknum) {
+        if (skiptrack[tracknum]) {
+            eventStoreInit(&eventstores[tracknum], data, datalen, 0);
+            return;
         }
-        @catch (MidiFileException* e) {
-            return result;
-        } 
-
-        MidiEvent *mevent = [[MidiEvent alloc] init];
-        [result add:mevent];
-        [mevent setDeltaTime:deltatime];
-        [mevent setStartTime:starttime];
-
-        if (peekevent >= EventNoteOff) {
-            [mevent setHasEventflag:YES];
-            eventflag = [file readByte];
-            /* printf("Read new event %d %s\n", eventflag, eventName(eventflag)); */
+        errors[tracknum] = midiDecodeTrack(data, datalen, [offsets get:tracknum], filter,
+                                           &eventstores[tracknum], &erroroffsets[tracknum]);
+        if (errors[tracknum] == MidiDecodeOK) {
+            NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+            tracklist[tracknum] =
+                [[MidiTrack alloc] initWithEvents:&eventstores[tracknum] andTrack:tracknum
+                                       andOverlap:overlap andDangling:dangling];
+            [pool drain];
         }
+    });
 
-        /**
-        printf("offset %d:event %d %s delta %d\n",
-               startoffset, eventflag, eventName(eventflag), [mevent deltatime]);
-        **/
-
-        if (eventflag >= EventNoteOn && eventflag < EventNoteOn + 16) {
-            [mevent setEventFlag:EventNoteOn];
-            [mevent setChannel:(u_char)(eventflag - EventNoteOn)];
-            [mevent setNotenumber:[file readByte]];
-            [mevent setVelocity:[file readByte]];
-        }
-        else if (eventflag >= EventNoteOff && eventflag < EventNoteOff + 16) {
-            [mevent setEventFlag:EventNoteOff];
-            [mevent setChannel:(u_char)(eventflag - EventNoteOff)];
-            [mevent setNotenumber:[file readByte]];
-            [mevent setVelocity:[file readByte]];
-        }
-        else if (eventflag >= EventKeyPressure && 
-                 eventflag < EventKeyPressure + 16) {
-            [mevent setEventFlag:EventKeyPressure];
-            [mevent setChannel:(u_char)(eventflag - EventKeyPressure)];
-            [mevent setNotenumber:[file readByte]];
-            [mevent setKeyPressure:[file readByte]];
-        }
-        else if (eventflag >= EventControlChange && 
-                 eventflag < EventControlChange + 16) {
-            [mevent setEventFlag:EventControlChange];
-            [mevent setChannel:(u_char)(eventflag - EventControlChange)];
-            [mevent setControlNum:[file readByte]];
-            [mevent setControlValue:[file readByte]];
-        }
-        else if (eventflag >= EventProgramChange && 
-                 eventflag < EventProgramChange + 16) {
-            [mevent setEventFlag:EventProgramChange];
-            [mevent setChannel:(u_char)(eventflag - EventProgramChange)];
-            [mevent setInstrument:[file readByte]];
-            
-        }
-        else if (eventflag >= EventChannelPressure && 
-                 eventflag < EventChannelPressure + 16) {
-            [mevent setEventFlag:EventChannelPressure];
-            [mevent setChannel:(u_char)(eventflag - EventChannelPressure)];
-            [mevent setChanPressure:[file readByte]];
-        }
-        else if (eventflag >= EventPitchBend && 
-                 eventflag < EventPitchBend + 16) {
-            [mevent setEventFlag:EventPitchBend];
-            [mevent setChannel:(u_char)(eventflag - EventPitchBend)];
-            [mevent setPitchBend:[file readShort]];
-        }
-        else if (eventflag == SysexEvent1) {
-            [mevent setEventFlag:SysexEvent1];
-            [mevent setMetalength:[file readVarlen]];
-            [mevent setMetavalue:[file readBytes:[mevent metalength]] ];
-        }
-        else if (eventflag == SysexEvent2) {
-            [mevent setEventFlag:SysexEvent2];
-            [mevent setMetalength:[file readVarlen]];
-            [mevent setMetavalue:[file readBytes:[mevent metalength]] ];
-        }
-        else if (eventflag == MetaEvent) {
-            [mevent setEventFlag:MetaEvent];
-            [mevent setMetaevent:[file readByte]];
-            [mevent setMetalength:[file readVarlen]];
-            [mevent setMetavalue:[file readBytes:[mevent metalength]] ];
-
-            if ([mevent metaevent] == MetaEventTimeSignature) {
-                if ([mevent metalength] != 4) {
-                    MidiFileException *e = 
-                    [MidiFileException init:@"Bad Meta Event Time Signature len" 
-                      offset:[file offset]];
-                    @throw e;
-                }
-                [mevent setNumerator:[mevent metavalue][0] ];
-                u_char log2 = [mevent metavalue][1];
-                [mevent setDenominator:(int)pow(2, log2)];
-            }
-            else if ([mevent metaevent] == MetaEventTempo) {
-                if ([mevent metalength] != 3) {
-                    MidiFileException *e = 
-                    [MidiFileException init:@"Bad Meta Event Tempo len" 
-                      offset:[file offset]];
-                    @throw e;
-                }
-                u_char *value = [mevent metavalue];
-                [mevent setTempo:((value[0] << 16) | (value[1] << 8) | value[2])];
-            }
-            else if ([mevent metaevent] == MetaEventEndOfTrack) {
-                [mevent release];
-                break; 
-            }
+    MidiFileException *error = nil;
+    for (int tracknum = 0; tracknum < num_tracks; tracknum++) {
+        MidiTrack *track = tracklist[tracknum];
+        if (error == nil && errors[tracknum] != MidiDecodeOK) {
+            error = decodeException(errors[tracknum], erroroffsets[tracknum]);
         }
-        else {
-            /* printf("Unknown eventflag %d offset %d\n", eventflag, [file offset]); */
-            MidiFileException *e =
-                [MidiFileException init:@"Unknown event" offset:([file offset] -4)];
-            @throw e;
+        if (track != nil && error == nil && [track noteCount] > 0) {
+            [tracks add:track];
         }
-        [mevent release];
+        [track release];
     }
-
-    return result;
-}
-
-//Returns filepath of new Midi file
--(NSString *)writeTemporaryMIDI {
-    NSArray *myPathList =  NSSearchPathForDirectoriesInDomains(NSDocumentDirectory, NSUserDomainMask, YES);
-    NSString *myPath    =  [myPathList  objectAtIndex:0];
-    
-    //Generate unused file name
-    BOOL success = false;
-    while (!success) {
-        int random = arc4random();
-        NSString *fileName = [NSString stringWithFormat:@"%d.mid", random];
-        myPath = [myPath stringByAppendingPathComponent:fileName];
-        if(![[NSFileManager defaultManager] fileExistsAtPath:myPath])
-            success = true;
+    free(tracklist);
+    free(errors);
+    free(erroroffsets);
+    free(skiptrack);
+    [offsets release];
+    if (error != nil) {
+        @throw error;
     }
-    [MidiFile writeMidiFile:myPath withEvents:events andMode:trackmode andQuarter:quarternote]; //guessed the mode
-    return myPath;    
 }
 
+/** Return the Midi data of this file (autoreleased), with any
+ *  changes made since it was parsed, like transposeByAmount.
+ *  Use this to play the file from memory.
+ */
+-(NSData *)midiData {
+    MidiTransform transform;
+    midiTransformInit(&transform);
+    transform.transpose = transposition;
+    return [MidiFile midiDataWithEvents:stores count:numstores andMode:trackmode
+                             andQuarter:quarternote andTransform:&transform];
+}
+
+/** Transpose the whole song by the given amount.  The tracks only
+ *  record the offset (see MidiTrack), and the events are left as they
+ *  were parsed: the transposition is applied by the MidiEncoder when
+ *  the file is written (midiData, changeSound, etc).
+ */
 -(void)transposeByAmount:(int)interval {
     [MidiFile transpose:tracks byAmount:interval];
-    //[MidiFile transpose:events byAmount:interval];
-    for (int i = 0; i < [events count]; i++) {
-        Array *array = [events get:i];
-        for (int j = 0; j < [array count]; j++) {
-            MidiEvent *event = [array get:j];
-            [event setNotenumber:[event notenumber]+interval];
-        }
-        
-      
-    }
+    [self clearSheetMusicCache];
+    transposition += interval;
 }
 
 
@@ -1181,11 +1335,10 @@ int sortbytime(void* v1, void* v2) {
  * then we treat each channel as a separate track.
  */
 +(BOOL) hasMultipleChannels:(MidiTrack*) track {
-    Array *notes = [track notes];
-    int channel = [(MidiNote*)[notes get:0] channel];
-    for (int i =0; i < [notes count]; i++) {
-        MidiNote *note = [notes get:i];
-        if ([note channel] != channel) {
+    const MidiNoteArray *notes = [track readNotes];
+    int channel = notes->notes[0].channel;
+    for (int i =0; i < notes->count; i++) {
+        if (notes->notes[i].channel != channel) {
             return true;
         }
     }
@@ -1193,48 +1346,67 @@ int sortbytime(void* v1, void* v2) {
 }
 
 
-/** Calculate the track length (in bytes) given a list of Midi events */
-+(int)getTrackLength:(Array*)events {
+/** Calculate the track length (in bytes) given a list of Midi events,
+ *  without running status.  The MidiEncoder's output may be shorter.
+ */
++(int)getTrackLength:(MidiEventStore*)events {
     int len = 0;
-    u_char buf[1024];
-    for (int i = 0; i < [events count]; i++) {
-        MidiEvent *mevent = [events get:i];
-        len += varlenToBytes([mevent deltaTime], buf, 0);
+    u_char buf[16];
+    for (int i = 0; i < events->count; i++) {
+        u_char eventflag = eventStoreFlag(events, i);
+        len += varlenToBytes(events->deltatime[i], buf, 0);
         len += 1;  /* for eventflag */
-        switch ([mevent eventFlag]) {
-            case EventNoteOn: len += 2; break;
-            case EventNoteOff: len += 2; break;
-            case EventKeyPressure: len += 2; break;
-            case EventControlChange: len += 2; break;
-            case EventProgramChange: len += 1; break;
-            case EventChannelPressure: len += 1; break;
-            case EventPitchBend: len += 2; break;
-
-            case SysexEvent1:
-            case SysexEvent2:
-                len += varlenToBytes([mevent metalength], buf, 0);
-                len += [mevent metalength];
-                break;
-            case MetaEvent:
-                len += 1;
-                len += varlenToBytes([mevent metalength], buf, 0);
-                len += [mevent metalength];
-                break;
-            default: break;
+        if (eventflag == SysexEvent1 || eventflag == SysexEvent2) {
+            len += varlenToBytes(events->payloadlen[i], buf, 0);
+            len += events->payloadlen[i];
+        }
+        else if (eventflag == MetaEvent) {
+            len += 1;
+            len += varlenToBytes(events->payloadlen[i], buf, 0);
+            len += events->payloadlen[i];
+        }
+        else {
+            len += eventStoreDataLength(eventflag);
         }
     }
     return len;
 }
 
+/** Serialize the given list of Midi events into a valid Midi file,
+ *  in memory, using the MidiEncoder (one pass per track, with running
+ *  status).  This is used for sound playback: BASS can play the data
+ *  directly (BASS_MIDI_StreamCreateFile with mem = TRUE), so a tempo
+ *  or transpose change doesn't need a temporary file.
+ *
+ *  Return the autoreleased data.
+ */
++(NSData*)midiDataWithEvents:(MidiEventStore*)eventlists count:(int)numtracks
+                     andMode:(int)trackmode andQuarter:(int)quarter {
+    return [MidiFile midiDataWithEvents:eventlists count:numtracks andMode:trackmode
+                             andQuarter:quarter andTransform:NULL];
+}
+
+/** Serialize the given list of Midi events, as above, applying the
+ *  given transform (tempo, transpose, etc) to the events as they are
+ *  written.  The events themselves are not copied or modified.
+ */
++(NSData*)midiDataWithEvents:(MidiEventStore*)eventlists count:(int)numtracks
+                     andMode:(int)trackmode andQuarter:(int)quarter
+                andTransform:(MidiTransform*)transform {
+    int len = 0;
+    u_char *buf = midiEncodeFile(eventlists, numtracks, trackmode, quarter, transform, &len);
+    return [NSData dataWithBytesNoCopy:buf length:len freeWhenDone:YES];
+}
+
 /** Write the given list of Midi events into a valid Midi file. This
- *  method is used for sound playback, for creating new Midi files
- *  with the tempo, transpose, etc changed.
+ *  method is used for creating new Midi files with the tempo,
+ *  transpose, etc changed.  The file is serialized in memory by
+ *  midiDataWithEvents, and written with a single write.
  *
  *  Return true on success, and false on error.
  */
-+(BOOL)writeMidiFile:(NSString*)filename withEvents:(Array*)eventlists
-                 andMode:(int)trackmode andQuarter:(int)quarter {
-    u_char buf[4096];
++(BOOL)writeMidiFile:(NSString*)filename withEvents:(MidiEventStore*)eventlists
+               count:(int)numtracks andMode:(int)trackmode andQuarter:(int)quarter {
     const char *cfilename;
     int file, error;
 
@@ -1244,105 +1416,12 @@ int sortbytime(void* v1, void* v2) {
         return NO;
     }
 
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    NSData *data = [MidiFile midiDataWithEvents:eventlists count:numtracks
+                                        andMode:trackmode andQuarter:quarter];
     error = 0;
-    /* Write the MThd, len = 6, track mode, number tracks, quarter note */
-    dowrite(file, (u_char*)"MThd", 4, &error);
-    intToBytes(6, buf, 0);
-    dowrite(file, buf, 4, &error);
-    buf[0] = (u_char)(trackmode >> 8);
-    buf[1] = (u_char)(trackmode & 0xFF);
-    dowrite(file, buf, 2, &error);
-    buf[0] = 0;
-    buf[1] = (u_char)[eventlists count];
-    dowrite(file, buf, 2, &error);
-    buf[0] = (u_char)(quarter >> 8);
-    buf[1] = (u_char)(quarter & 0xFF);
-    dowrite(file, buf, 2, &error);
-
-    for (int tracknum = 0; tracknum < [eventlists count]; tracknum++) {
-        Array *events = [eventlists get:tracknum];
-
-        /* Write the MTrk header and track length */
-        dowrite(file, (u_char*)"MTrk", 4, &error);
-        int len = [MidiFile getTrackLength:events];
-        intToBytes(len, buf, 0);
-        dowrite(file, buf, 4, &error);
-
-        for (int i = 0; i < [events count]; i++) {
-            MidiEvent *mevent = [events get:i];
-            int varlen = varlenToBytes([mevent deltaTime], buf, 0);
-            dowrite(file, buf, varlen, &error);
-
-            if ([mevent eventFlag] == SysexEvent1 ||
-                [mevent eventFlag] == SysexEvent2 ||
-                [mevent eventFlag] == MetaEvent) {
-                buf[0] = [mevent eventFlag];
-            }
-            else {
-                buf[0] = (u_char)([mevent eventFlag] + [mevent channel]);
-            }
-            dowrite(file, buf, 1, &error);
-
-            if ([mevent eventFlag] == EventNoteOn) {
-                buf[0] = [mevent notenumber];
-                buf[1] = [mevent velocity];
-                dowrite(file, buf, 2, &error);
-            }
-            else if ([mevent eventFlag] == EventNoteOff) {
-                buf[0] = [mevent notenumber];
-                buf[1] = [mevent velocity];
-                dowrite(file, buf, 2, &error);
-            }
-            else if ([mevent eventFlag] == EventKeyPressure) {
-                buf[0] = [mevent notenumber];
-                buf[1] = [mevent keyPressure];
-                dowrite(file, buf, 2, &error);
-            }
-            else if ([mevent eventFlag] == EventControlChange) {
-                buf[0] = [mevent controlNum];
-                buf[1] = [mevent controlValue];
-                dowrite(file, buf, 2, &error);
-            }
-            else if ([mevent eventFlag] == EventProgramChange) {
-                buf[0] = [mevent instrument];
-                dowrite(file, buf, 1, &error);
-            }
-            else if ([mevent eventFlag] == EventChannelPressure) {
-                buf[0] = [mevent chanPressure];
-                dowrite(file, buf, 1, &error);
-            }
-            else if ([mevent eventFlag] == EventPitchBend) {
-                buf[0] = (u_char)([mevent pitchBend] >> 8);
-                buf[1] = (u_char)([mevent pitchBend] & 0xFF);
-                dowrite(file, buf, 2, &error);
-            }
-            else if ([mevent eventFlag] == SysexEvent1) {
-                int offset = varlenToBytes([mevent metalength], buf, 0);
-                memcpy(&(buf[offset]), [mevent metavalue], [mevent metalength]);
-                dowrite(file, buf, offset + [mevent metalength], &error);
-            }
-            else if ([mevent eventFlag] == SysexEvent2) {
-                int offset = varlenToBytes([mevent metalength], buf, 0);
-                memcpy(&(buf[offset]), [mevent metavalue], [mevent metalength]);
-                dowrite(file, buf, offset + [mevent metalength], &error);
-            }
-            else if ([mevent eventFlag] == MetaEvent &&
-                     [mevent metaevent] == MetaEventTempo) {
-                buf[0] = [mevent metaevent];
-                buf[1] = 3;
-                buf[2] = (u_char)(([mevent tempo] >> 16) & 0xFF);
-                buf[3] = (u_char)(([mevent tempo] >> 8) & 0xFF);
-                buf[4] = (u_char)([mevent tempo] & 0xFF);
-                dowrite(file, buf, 5, &error);
-            }
-            else if ([mevent eventFlag] == MetaEvent) {
-                buf[0] = [mevent metaevent];
-                int offset = varlenToBytes([mevent metalength], buf, 1) + 1;
-                memcpy(&(buf[offset]), [mevent metavalue], [mevent metalength]);
-                dowrite(file, buf, offset + [mevent metalength], &error);
-            }
-        }
-    }
+    dowrite(file, (u_char*)[data bytes], [data length], &error);
+    [pool drain];
     close(file);
     if (error)
         return NO;
@@ -1351,105 +1430,30 @@ int sortbytime(void* v1, void* v2) {
 }
 
 
-/** Clone the list of MidiEvents */
-+(Array*)cloneMidiEvents:(Array*)origlist {
-    Array *newlist = [Array new:[origlist count]];
-    for (int tracknum = 0; tracknum < [origlist count]; tracknum++) {
-        Array *origevents = [origlist get:tracknum];
-        Array *newevents = [Array new:[origevents count]];
-        [newlist add:newevents];
-        for (int i = 0; i < [origevents count]; i++) {
-            MidiEvent *mevent = [origevents get:i];
-            MidiEvent *eventcopy = [mevent copy];
-            [newevents add:eventcopy];
-            [eventcopy release];
-        }
-        [newevents release];
-    }
-    return newlist;
-}
-
-
-/** Add a tempo event to the beginning of each track */
-+(void) addTempoEvent:(Array*)eventlist withTempo:(int)tempo {
-    for (int tracknum = 0; tracknum < [eventlist count]; tracknum++) {
-
-        /* Create a new tempo event */
-        MidiEvent *tempoEvent = [[MidiEvent alloc] init];
-        [tempoEvent setDeltaTime:0];
-        [tempoEvent setStartTime:0];
-        [tempoEvent setHasEventflag:YES];
-        [tempoEvent setEventFlag:MetaEvent];
-        [tempoEvent setMetaevent:MetaEventTempo];
-        [tempoEvent setMetalength:3];
-        [tempoEvent setTempo:tempo];
-
-        /* Insert the event at the beginning of the events array */
-        Array *events = [eventlist get:tracknum];
-        [events add:tempoEvent];
-        for (int i = [events count]-2; i >= 0; i--) {
-            MidiEvent *event = [events get:i];
-            [events set:event index:i+1];
-        }
-        [events set:tempoEvent index:0];
-        [tempoEvent release];
-    }
-}
-
-
-/** Start the Midi music at the given pause time (in pulses).
- *  Remove any NoteOn/NoteOff events that occur before the pause time.
- *  For other events, change the delta-time to 0 if they occur
- *  before the pause time.  Return the modified Midi Events.
+/** Return the seek index used to start playback at the given pause
+ *  time, or NULL if it starts at the beginning.  The index is built
+ *  on the first seek, and reused by the ones after it.
  */
-+(Array*)startAtPauseTime:(int)pauseTime withEvents:(Array*)list {
-    Array *newlist = [Array new:[list count]];
-    for (int tracknum = 0; tracknum < [list count]; tracknum++) {
-        Array *events = [list get:tracknum];
-        Array *newevents = [Array new:[events count]];
-        [newlist add:newevents];
-
-        BOOL foundEventAfterPause = NO;
-        for (int i = 0; i < [events count]; i++) {
-            MidiEvent *mevent = [events get:i];
-
-            if ([mevent startTime] < pauseTime) {
-                if ([mevent eventFlag] == EventNoteOn ||
-                    [mevent eventFlag] == EventNoteOff) {
-
-                    /* Skip NoteOn/NoteOff event */
-                }
-                else {
-                    [mevent setDeltaTime:0];
-                    [newevents add:mevent];
-                }
-            }
-            else if (!foundEventAfterPause) {
-                [mevent setDeltaTime:([mevent startTime] - pauseTime)];
-                [newevents add:mevent];
-                foundEventAfterPause = YES;
-            }
-            else {
-                [newevents add:mevent];
-            }
-        }
-        [newevents release];
+- (MidiSeekIndex*)seekIndex:(int)pauseTime {
+    if (pauseTime == 0) {
+        return NULL;
     }
-    return newlist;
+    if (seekindex == NULL) {
+        seekindex = midiSeekIndexBuild(stores, numstores);
+    }
+    return seekindex;
 }
 
-
 /** Change the following sound options in the Midi file:
  * - The tempo (the microseconds per pulse)
  * - The instruments per track
  * - The note number (transpose value)
  * - The tracks to include
- * Save the modified midi data to the given filename.
- * Return true if the file was saved successfully, else false.
+ * Return the modified midi data (autoreleased), for playback from memory.
  */
-- (BOOL)changeSound:(MidiSoundOptions *)options toFile:(NSString*)destfile {
+- (NSData*)changeSound:(MidiSoundOptions *)options {
     if (trackPerChannel) {
-        return [self changeSoundPerChannel:options toFile:destfile];
+        return [self changeSoundPerChannel:options];
     }
 
     /* A midifile can contain tracks with notes and tracks without notes.
@@ -1458,69 +1462,45 @@ int sortbytime(void* v1, void* v2) {
      * midi file has tracks without notes. Re-compute the instruments, and
      * tracks to keep.
      */
-    int num_tracks = [events count];
-    IntArray *instruments = [IntArray new:num_tracks];
-    IntArray *keeptracks  = [IntArray new:num_tracks];
-
-    for (int i = 0; i < num_tracks; i++) {
-        [instruments add:0];
-        [keeptracks add:YES];
+    int *instruments = (int*)calloc(numstores + 1, sizeof(int));
+    int *keeptracks  = (int*)calloc(numstores + 1, sizeof(int));
+    for (int i = 0; i < numstores; i++) {
+        keeptracks[i] = YES;
     }
     for (int tracknum = 0; tracknum < [tracks count]; tracknum++) {
         MidiTrack *track = [tracks get:tracknum];
         int realtrack = [track number];
-        [instruments set:[options->instruments get:tracknum] index:realtrack ];
-        [keeptracks set:[options->tracks get:tracknum] index:realtrack ];
-    }
-
-    Array *newevents = [MidiFile cloneMidiEvents:events];
-    [MidiFile addTempoEvent:newevents withTempo:options->tempo];
-
-    /* Change the note number (transpose), instrument, and tempo */
-    for (int tracknum = 0; tracknum < [newevents count]; tracknum++) {
-        Array *eventlist = [newevents get:tracknum];
-        for (int i = 0; i < [eventlist count]; i++) {
-            MidiEvent *mevent = [eventlist get:i];
-            int num = [mevent notenumber] + options->transpose;
-            if (num < 0)
-                num = 0;
-            if (num > 127)
-                num = 127;
-            [mevent setNotenumber:(u_char)num];
-            if (!options->useDefaultInstruments) {
-                [mevent setInstrument:(u_char)[instruments get:tracknum] ];
-            }
-            [mevent setTempo:options->tempo];
-        }
+        instruments[realtrack] = [options->instruments get:tracknum];
+        keeptracks[realtrack] = [options->tracks get:tracknum];
     }
 
-    if (options->pauseTime != 0) {
-        Array *oldevents = newevents;
-        newevents = [MidiFile startAtPauseTime:options->pauseTime withEvents:oldevents]; 
-        [oldevents release];
-    }
-
-    /* Change the tracks to include */
-    int count = 0;
-    for (int tracknum = 0; tracknum < [keeptracks count]; tracknum++) {
-         if ([keeptracks get:tracknum]) {
-             count++;
-         }
-    }
-
-    Array *result = [Array new:count];
-    for (int tracknum = 0; tracknum < [keeptracks count]; tracknum++) {
-        if ([keeptracks get:tracknum]) {
-            [result add:[newevents get:tracknum]];
-        }
-    }
-    [newevents release];
-    [keeptracks release];
-    [instruments release];
-    BOOL ret = [MidiFile writeMidiFile:destfile withEvents:result
-                     andMode:trackmode andQuarter:quarternote];
-    [result release];
-    return ret;
+    /* The tempo, transpose, instruments, tracks and pause time are
+     * applied by the MidiEncoder as it writes the original events.
+     */
+    MidiTransform transform;
+    midiTransformInit(&transform);
+    transform.tempo = options->tempo;
+    transform.transpose = options->transpose + transposition;
+    transform.pausetime = options->pauseTime;
+    transform.seekindex = [self seekIndex:options->pauseTime];
+    transform.keeptracks = keeptracks;
+    if (!options->useDefaultInstruments) {
+        transform.trackinstruments = instruments;
+    }
+    NSData *data = [MidiFile midiDataWithEvents:stores count:numstores andMode:trackmode
+                                     andQuarter:quarternote andTransform:&transform];
+    free(instruments);
+    free(keeptracks);
+    return data;
+}
+
+/** Change the sound options, as in changeSound, and save the modified
+ * midi data to the given filename.
+ * Return true if the file was saved successfully, else false.
+ */
+- (BOOL)changeSound:(MidiSoundOptions *)options toFile:(NSString*)destfile {
+    NSData *data = [self changeSound:options];
+    return [data writeToFile:destfile atomically:NO];
 }
 
 
@@ -1530,8 +1510,7 @@ int sortbytime(void* v1, void* v2) {
  * - The instruments per track
  * - The note number (transpose value)
  * - The tracks to include
- * Save the modified Midi data to the given filename.
- * Return true if the file was saved successfully, else false.
+ * Return the modified Midi data (autoreleased).
  *
  * This Midi file only has one actual track, but we've split that
  * into multiple fake tracks, one per channel, and displayed that
@@ -1542,99 +1521,127 @@ int sortbytime(void* v1, void* v2) {
  * - We include/exclude channels, not tracks.
  * - We exclude a channel by setting the note volume/velocity to 0.
  */
-- (BOOL)changeSoundPerChannel:(MidiSoundOptions *)options toFile:(NSString*)destfile {
+- (NSData*)changeSoundPerChannel:(MidiSoundOptions *)options {
     /* Determine which channels to include/exclude.
      * Also, determine the instrument for each channel.
      */
-    IntArray *instruments = [IntArray new:16];
-    IntArray *keepchannel  = [IntArray new:16];
-
-    for (int i = 0; i < 16; i++) {
-        [instruments add:0];
-        [keepchannel add:YES];
-    }
+    int instruments[16];
+    int mutechannels = 0;
+    memset(instruments, 0, sizeof(instruments));
     for (int tracknum = 0; tracknum < [tracks count]; tracknum++) {
         MidiTrack *track = [tracks get:tracknum];
-        MidiNote *note = [[track notes] get:0];
-        int channel = [note channel];
-        [instruments set:[options->instruments get:tracknum] index:channel ];
-        [keepchannel set:[options->tracks get:tracknum] index:channel ];
-    }
-
-    Array *newevents = [MidiFile cloneMidiEvents:events];
-    [MidiFile addTempoEvent:newevents withTempo:options->tempo];
-
-    /* Change the note number (transpose), instrument, and tempo */
-    for (int tracknum = 0; tracknum < [newevents count]; tracknum++) {
-        Array *eventlist = [newevents get:tracknum];
-        for (int i = 0; i < [eventlist count]; i++) {
-            MidiEvent *mevent = [eventlist get:i];
-            int num = [mevent notenumber] + options->transpose;
-            if (num < 0)
-                num = 0;
-            if (num > 127)
-                num = 127;
-            [mevent setNotenumber:(u_char)num];
-            int channel = [mevent channel];
-            if (![keepchannel get:channel]) {
-                [mevent setVelocity:0];
-            }
-            if (!options->useDefaultInstruments) {
-                u_char instr = [instruments get:channel];
-                [mevent setInstrument:instr];
-            }
-            [mevent setTempo:options->tempo];
+        int channel = [track noteAt:0].channel;
+        instruments[channel] = [options->instruments get:tracknum];
+        if (![options->tracks get:tracknum]) {
+            mutechannels |= (1 << channel);
         }
     }
-    if (options->pauseTime != 0) {
-        Array *oldevents = newevents;
-        newevents = [MidiFile startAtPauseTime:options->pauseTime withEvents:oldevents];
-        [oldevents release];
+
+    MidiTransform transform;
+    midiTransformInit(&transform);
+    transform.tempo = options->tempo;
+    transform.transpose = options->transpose + transposition;
+    transform.pausetime = options->pauseTime;
+    transform.seekindex = [self seekIndex:options->pauseTime];
+    transform.mutechannels = mutechannels;
+    if (!options->useDefaultInstruments) {
+        transform.channelinstruments = instruments;
     }
-    [instruments release];
-    [keepchannel release];
-    BOOL ret = [MidiFile writeMidiFile:destfile withEvents:newevents
-                     andMode:trackmode andQuarter:quarternote];
-    [newevents release];
-    return ret;
+    return [MidiFile midiDataWithEvents:stores count:numstores andMode:trackmode
+                             andQuarter:quarternote andTransform:&transform];
 }
 
 
 
 /** Apply the given sheet music options to the midi file.
  *  Return the midi tracks with the changes applied.
+ *
+ *  The changes are applied in stages, and the result of each stage is
+ *  cached (see SheetMusicCache), keyed by the options it depends on:
+ *
+ *  1. Copy the selected tracks, and round the start times and
+ *     durations.  Depends on the tracks, combineInterval, the
+ *     quantize options and the time signature.
+ *  2. Combine into two staffs.  Depends on stage 1, twoStaffs and
+ *     the measure length.
+ *  3. Copy the result of stage 2, and shift and transpose it.  The
+ *     copies share the cached notes, and shifting and transposing
+ *     only set the track offsets, so this doesn't depend on the
+ *     number of notes.
+ *
+ *  So changing only the shift time or transpose only redoes stage 3.
+ *  The stages never modify a cached result: combineToTwoTracks copies
+ *  the notes into new tracks, and a copied track makes its own copy of
+ *  the notes before changing them.
  */
 - (Array*)changeSheetMusicOptions:(SheetMusicOptions*)options {
-    Array *old;
-    Array* newtracks = [Array new:10];
-
-    for (int track = 0; track < [tracks count]; track++) {
-        if ([options->tracks get:track]) {
-            MidiTrack *t = [tracks get:track];
-            MidiTrack *copy = [t copy];
-            [newtracks add:copy];
-            [copy release];
+    MGTimeSignature *time = [self time];
+    if (options->time != nil) {
+        time = options->time;
+    }
+
+    QuantizeOptions quantize;
+    quantizeOptionsInit(&quantize, options->combineInterval * 1000);
+    quantize.grid = options->quantizeGrid;
+    quantize.quarternote = [time quarter];
+    quantize.division = options->quantizeDivision;
+    quantize.swing = options->quantizeSwing;
+    quantize.maxdrift = options->maxDrift * 1000;
+
+    BOOL sameSelection = (sheetcache.selected != nil);
+    for (int track = 0; sameSelection && track < [tracks count]; track++) {
+        if (([options->tracks get:track] != 0) != ([sheetcache.selected get:track] != 0)) {
+            sameSelection = NO;
         }
     }
 
-    /* To make the sheet music look nicer, we round the start times
-     * so that notes close together appear as a single chord.  We
+    /* Stage 1: To make the sheet music look nicer, we round the start
+     * times so that notes close together appear as a single chord.  We
      * also extend the note durations, so that we have longer notes
      * and fewer rest symbols.
      */
-    MGTimeSignature *time = [self time];
-    if (options->time != nil) {
-        time = options->time;
+    if (sheetcache.rounded == nil || !sameSelection ||
+        memcmp(&quantize, &sheetcache.quantize, sizeof(QuantizeOptions)) != 0) {
+
+        [self clearSheetMusicCache];
+        Array *rounded = [Array new:10];
+        IntArray *selected = [IntArray new:[tracks count]];
+        for (int track = 0; track < [tracks count]; track++) {
+            int keep = ([options->tracks get:track] != 0);
+            [selected add:keep];
+            if (keep) {
+                MidiTrack *t = [tracks get:track];
+                MidiTrack *copy = [t copy];
+                [rounded add:copy];
+                [copy release];
+            }
+        }
+        [MidiFile quantizeStartTimes:rounded withOptions:&quantize withTempoMap:&tempomap];
+        [MidiFile roundDurations:rounded withQuarter:[time quarter]];
+
+        sheetcache.selected = selected;
+        sheetcache.quantize = quantize;
+        sheetcache.rounded = rounded;
     }
 
-    [MidiFile roundStartTimes:newtracks toInterval:options->combineInterval withTime:[self time]];
-    [MidiFile roundDurations:newtracks withQuarter:[time quarter]];
+    /* Stage 2: Combine into two staffs */
+    if (sheetcache.staffs == nil || sheetcache.twoStaffs != options->twoStaffs ||
+        (options->twoStaffs && sheetcache.measure != [time measure])) {
 
-    if (options->twoStaffs) {
-        old = newtracks;
-        newtracks = [MidiFile combineToTwoTracks:newtracks withMeasure:[time measure]];
-        [old release];
+        [sheetcache.staffs release];
+        if (options->twoStaffs) {
+            sheetcache.staffs = [MidiFile combineToTwoTracks:sheetcache.rounded
+                                                 withMeasure:[time measure]];
+        }
+        else {
+            sheetcache.staffs = [sheetcache.rounded retain];
+        }
+        sheetcache.twoStaffs = options->twoStaffs;
+        sheetcache.measure = [time measure];
     }
+
+    /* Stage 3: Shift and transpose a copy */
+    Array *newtracks = [MidiFile copyTracks:sheetcache.staffs];
     if (options->shifttime != 0) {
         [MidiFile shiftTime:newtracks byAmount:options->shifttime];
     }
@@ -1646,31 +1653,35 @@ int sortbytime(void* v1, void* v2) {
     return newtracks;
 }
 
+/** Drop the cached stages of changeSheetMusicOptions.  This must be
+ *  called after changing the notes of the tracks.
+ */
+-(void)clearSheetMusicCache {
+    [sheetcache.selected release];
+    [sheetcache.rounded release];
+    [sheetcache.staffs release];
+    memset(&sheetcache, 0, sizeof(SheetMusicCache));
+}
+
 
 /** Shift the starttime of the notes by the given amount.
  * This is used by the Shift Notes menu to shift notes left/right.
+ * Only the time offset of each track changes, not the notes.
  */
 +(void)shiftTime:(Array*)tracks byAmount:(int) amount {
     for (int tracknum = 0; tracknum < [tracks count]; tracknum++) {
         MidiTrack *track = [tracks get:tracknum];
-        for (int j = 0; j < [[track notes] count]; j++) {
-            MidiNote *note = [[track notes] get:j];
-            [note setStarttime:([note startTime] + amount)];
-        }
+        [track setTimeOffset:[track timeOffset] + amount];
     }
 }
 
-/* Shift the note keys up/down by the given amount */
+/* Shift the note keys up/down by the given amount.  Only the pitch
+ * offset of each track changes, not the notes.
+ */
 +(void)transpose:(Array*) tracks byAmount:(int) amount {
     for (int tracknum = 0; tracknum < [tracks count]; tracknum++) {
         MidiTrack *track = [tracks get:tracknum];
-        for (int j = 0; j < [[track notes] count]; j++) {
-            MidiNote *note = [[track notes] get:j];
-            [note setNumber:([note number] + amount)];
-            if ([note number] < 0) {
-                [note setNumber:0];
-            }
-        }
+        [track setPitchOffset:[track pitchOffset] + amount];
     }
 }
 
@@ -1684,7 +1695,7 @@ int sortbytime(void* v1, void* v2) {
  * reasonably close to this note.
  */
 
-+(void)findHighLowNotes:(Array*)notes withMeasure:(int)measurelen startIndex:(int)startindex
++(void)findHighLowNotes:(const MidiNoteArray*)notes withMeasure:(int)measurelen startIndex:(int)startindex
                         fromStart:(int)starttime toEnd:(int)endtime withHigh:(int*)high
                         andLow:(int*)low {
 
@@ -1693,64 +1704,115 @@ int sortbytime(void* v1, void* v2) {
         endtime = starttime + measurelen;
     }
 
-    while (i < [notes count]) {
-        MidiNote *note = [notes get:i];
-        if ([note startTime] >= endtime) {
+    while (i < notes->count) {
+        const MidiNoteData *note = &notes->notes[i];
+        if (note->starttime >= endtime) {
             break;
         }
-        if ([note endTime] < starttime) {
+        if (noteEndTime(note) < starttime) {
             i++;
             continue;
         }
-        if ([note startTime] + measurelen < starttime) {
+        if (note->starttime + measurelen < starttime) {
             i++;
             continue;
         }
-        if (*high < [note number]) {
-            *high = [note number];
+        if (*high < note->number) {
+            *high = note->number;
         }
-        if (*low > [note number]) {
-            *low = [note number];
+        if (*low > note->number) {
+            *low = note->number;
         }
         i++;
     }
 }
 
 /* Find the highest and lowest notes that start at this exact start time */
-+(void)findExactHighLowNotes:(Array*)notes startIndex:(int)startindex
++(void)findExactHighLowNotes:(const MidiNoteArray*)notes startIndex:(int)startindex
                         withStart:(int)starttime withHigh:(int*)high
                         andLow:(int*)low {
 
     int i = startindex;
 
-    while ([(MidiNote*)[notes get:i] startTime] < starttime) {
+    while (notes->notes[i].starttime < starttime) {
         i++;
     }
 
-    while (i < [notes count]) {
-        MidiNote *note = [notes get:i];
-        if ([note startTime] != starttime) {
+    while (i < notes->count) {
+        const MidiNoteData *note = &notes->notes[i];
+        if (note->starttime != starttime) {
             break;
         }
-        if (*high < [note number]) {
-            *high = [note number];
+        if (*high < note->number) {
+            *high = note->number;
         }
-        if (*low > [note number]) {
-            *low = [note number];
+        if (*low > note->number) {
+            *low = note->number;
         }
         i++;
     }
 }
 
 
+/* Find the high/low notes of each note in the track, the way splitTrack
+ * always has: by calling findHighLowNotes and findExactHighLowNotes for
+ * each note.  Each call rescans up to a measure of notes.  This is used
+ * when the HandSplitter can't be.  Tools/SplitCheck.c checks the
+ * HandSplitter against a C port of this scan.
+ */
++(void)scanHighLowNotes:(const MidiNoteArray*)notes withMeasure:(int)measurelen
+               withHigh:(int*)high andLow:(int*)low
+          withHighExact:(int*)highExact andLowExact:(int*)lowExact {
+    int startindex = 0;
+    for (int i = 0; i < notes->count; i++) {
+        const MidiNoteData *note = &notes->notes[i];
+        high[i] = low[i] = highExact[i] = lowExact[i] = note->number;
+
+        while (noteEndTime(&notes->notes[startindex]) < note->starttime) {
+            startindex++;
+        }
+        [MidiFile findHighLowNotes:notes withMeasure:measurelen startIndex:startindex
+                  fromStart:note->starttime toEnd:noteEndTime(note)
+                  withHigh:&high[i] andLow:&low[i]];
+        [MidiFile findExactHighLowNotes:notes startIndex:startindex withStart:note->starttime
+                  withHigh:&highExact[i] andLow:&lowExact[i]];
+    }
+}
+
+/* Find the high/low notes of each note in the track, for splitTrack.
+ * The arrays must have room for notes->count values.  The sliding
+ * windows of the HandSplitter give the same results as scanning, in
+ * linear time.
+ */
++(void)findHighLowNotes:(const MidiNoteArray*)notes withMeasure:(int)measurelen
+               withHigh:(int*)high andLow:(int*)low
+          withHighExact:(int*)highExact andLowExact:(int*)lowExact {
+    int count = notes->count;
+    int *starttimes = (int*)malloc((3*count + 1) * sizeof(int));
+    int *endtimes = &starttimes[count];
+    int *numbers = &starttimes[2*count];
+    for (int i = 0; i < count; i++) {
+        const MidiNoteData *note = &notes->notes[i];
+        starttimes[i] = note->starttime;
+        endtimes[i] = noteEndTime(note);
+        numbers[i] = note->number;
+    }
+    if (!handSplitterHighLow(starttimes, endtimes, numbers, count, measurelen,
+                             high, low, highExact, lowExact)) {
+        [MidiFile scanHighLowNotes:notes withMeasure:measurelen withHigh:high andLow:low
+                     withHighExact:highExact andLowExact:lowExact];
+    }
+    free(starttimes);
+}
+
 /* Split the given MidiTrack into two tracks, top and bottom.
  * The highest notes will go into top, the lowest into bottom.
  * This function is used to split piano songs into left-hand (bottom)
  * and right-hand (top) tracks.
  */
 +(Array*)splitTrack:(MidiTrack*) track withMeasure:(int)measurelen{
-    Array *notes = [track notes];
-    int notes_count = [notes count];
+    const MidiNoteArray *notes = [track readNotes];
+    int notes_count = notes->count;
 
     MidiTrack *top = [[MidiTrack alloc] initWithTrack:1];
     MidiTrack *bottom = [[MidiTrack alloc] initWithTrack:2];
@@ -1763,18 +1825,25 @@ int sortbytime(void* v1, void* v2) {
 
     int prevhigh  = 76; /* E5, top of treble staff */
     int prevlow   = 45; /* A3, bottom of bass staff */
-    int startindex = 0;
-
-    for (int i = 0; i < notes_count; i++) {
-        MidiNote *note = [notes get:i];
-        int number = [note number];
 
-        int high, low, highExact, lowExact;
-        high = low = highExact = lowExact = number;
+    /* The high/low notes that overlap each note, and that start
+     * at the same time as it.
+     */
+    int *highs = (int*)malloc(4 * notes_count * sizeof(int));
+    int *lows = &highs[notes_count];
+    int *highExacts = &highs[2*notes_count];
+    int *lowExacts = &highs[3*notes_count];
+    [MidiFile findHighLowNotes:notes withMeasure:measurelen
+                      withHigh:highs andLow:lows
+                 withHighExact:highExacts andLowExact:lowExacts];
 
-        while ([(MidiNote*)[notes get:startindex] endTime] < [note startTime]) {
-            startindex++;
-        }
+    for (int i = 0; i < notes_count; i++) {
+        const MidiNoteData *note = &notes->notes[i];
+        int number = note->number;
+        int high = highs[i];
+        int low = lows[i];
+        int highExact = highExacts[i];
+        int lowExact = lowExacts[i];
 
         /* I've tried several algorithms for splitting a track in two,
          * and the one below seems to work the best:
@@ -1789,12 +1858,6 @@ int sortbytime(void* v1, void* v2) {
          * - Else, look at the previous high/low notes that were more than an
          *   octave apart.  Choose the closeset note.
          */
-        [MidiFile findHighLowNotes:notes withMeasure:measurelen startIndex:startindex
-                  fromStart:[note startTime] toEnd:[note endTime]
-                  withHigh:&high andLow:&low];
-        [MidiFile findExactHighLowNotes:notes startIndex:startindex withStart:[note startTime]
-                  withHigh:&highExact andLow:&lowExact];
-
         if (highExact - number > 12 || number - lowExact > 12) {
             if (highExact - number <= number - lowExact) {
                 [top addNote:note];
@@ -1845,8 +1908,10 @@ int sortbytime(void* v1, void* v2) {
         }
     }
 
-    [[top notes] sort:sortbytime];
-    [[bottom notes] sort:sortbytime];
+    free(highs);
+
+    [top sortNotes];
+    [bottom sortNotes];
 
     [top release];
     [bottom release];
@@ -1855,9 +1920,49 @@ int sortbytime(void* v1, void* v2) {
 
 
 
+/** @struct MergeEntry
+ * The next note of one track, in the heap used by combineToSingleTrack.
+ * The start time and number are copied into the entry, so that
+ * comparing entries doesn't need to follow a pointer to the note.
+ */
+typedef struct _MergeEntry {
+    int starttime;
+    int number;
+    int tracknum;
+} MergeEntry;
+
+/** Return true if entry a comes before entry b: by start time, then
+ *  note number, then track number.
+ */
+static inline BOOL mergeEntryBefore(const MergeEntry *a, const MergeEntry *b) {
+    if (a->starttime != b->starttime)
+        return a->starttime < b->starttime;
+    if (a->number != b->number)
+        return a->number < b->number;
+    return a->tracknum < b->tracknum;
+}
+
+/** Move the entry at index i down the heap to its place */
+static void mergeHeapSiftDown(MergeEntry *heap, int count, int i) {
+    MergeEntry entry = heap[i];
+    while (1) {
+        int child = 2*i + 1;
+        if (child >= count)
+            break;
+        if (child + 1 < count && mergeEntryBefore(&heap[child+1], &heap[child]))
+            child++;
+        if (!mergeEntryBefore(&heap[child], &entry))
+            break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = entry;
+}
+
 /** Combine the notes in the given tracks into a single MidiTrack.
- *  The individual tracks are already sorted.  To merge them, we
- *  use a mergesort-like algorithm.
+ *  The individual tracks are already sorted.  To merge them, we keep
+ *  the next note of each track in a min-heap, so each note costs
+ *  O(log tracks), and there is no limit on the number of tracks.
  */
 +(MidiTrack*) combineToSingleTrack:(Array*)tracks {
     /* Add all notes into one track */
@@ -1867,64 +1972,74 @@ int sortbytime(void* v1, void* v2) {
         return result;
     }
     else if ([tracks count] == 1) {
-        MidiTrack *track = [tracks get:0];
-        for (int i = 0; i < [[track notes] count]; i++) {
-            [result addNote:[[track notes] get:i] ];
+        const MidiNoteArray *notes = [(MidiTrack*)[tracks get:0] readNotes];
+        noteArrayGrow([result notes], notes->count);
+        for (int i = 0; i < notes->count; i++) {
+            [result addNote:&notes->notes[i]];
         }
         return result;
     }
 
-    int noteindex[64];
-    int notecount[64];
-    for (int tracknum = 0; tracknum < [tracks count]; tracknum++) {
+    int numtracks = [tracks count];
+    const MidiNoteArray **notelists = (const MidiNoteArray**)malloc(numtracks * sizeof(MidiNoteArray*));
+    int *noteindex = (int*)malloc(numtracks * sizeof(int));
+    MergeEntry *heap = (MergeEntry*)malloc(numtracks * sizeof(MergeEntry));
+    int heapcount = 0;
+    int total = 0;
+    for (int tracknum = 0; tracknum < numtracks; tracknum++) {
         MidiTrack *track = [tracks get:tracknum];
+        notelists[tracknum] = [track readNotes];
         noteindex[tracknum] = 0;
-        notecount[tracknum] = [[track notes] count];
+        total += notelists[tracknum]->count;
+        if (notelists[tracknum]->count > 0) {
+            const MidiNoteData *note = &notelists[tracknum]->notes[0];
+            heap[heapcount].starttime = note->starttime;
+            heap[heapcount].number = note->number;
+            heap[heapcount].tracknum = tracknum;
+            heapcount++;
+        }
+    }
+    for (int i = heapcount/2 - 1; i >= 0; i--) {
+        mergeHeapSiftDown(heap, heapcount, i);
     }
 
-    MidiNote *prevnote = nil;
-    while (1) {
-        MidiNote *lowestnote = nil;
-        int lowestTrack = -1;
-        for (int tracknum = 0; tracknum < [tracks count]; tracknum++) {
-            MidiTrack *track = [tracks get:tracknum];
-            if (noteindex[tracknum] >= notecount[tracknum]) {
-                continue;
-            }
-            MidiNote *note = [[track notes] get:noteindex[tracknum]];
-            if (lowestnote == nil) {
-                lowestnote = note;
-                lowestTrack = tracknum;
-            }
-            else if ([note startTime] < [lowestnote startTime]) {
-                lowestnote = note;
-                lowestTrack = tracknum;
-            }
-            else if ([note startTime] == [lowestnote startTime] &&
-                     [note number] < [lowestnote number]) {
-                lowestnote = note;
-                lowestTrack = tracknum;
-            }
+    MidiNoteArray *resultnotes = [result notes];
+    noteArrayGrow(resultnotes, total);
+    while (heapcount > 0) {
+        int lowestTrack = heap[0].tracknum;
+        const MidiNoteArray *notes = notelists[lowestTrack];
+        const MidiNoteData *lowestnote = &notes->notes[noteindex[lowestTrack]];
+        noteindex[lowestTrack]++;
+
+        /* Replace the top of the heap with the track's next note */
+        if (noteindex[lowestTrack] < notes->count) {
+            const MidiNoteData *next = &notes->notes[noteindex[lowestTrack]];
+            heap[0].starttime = next->starttime;
+            heap[0].number = next->number;
         }
-        if (lowestnote == nil) {
-            /* We've finished the merge */
-            break;
+        else {
+            heap[0] = heap[--heapcount];
         }
-        noteindex[lowestTrack]++;
-        if ((prevnote != nil) && ([prevnote startTime] == [lowestnote startTime]) &&
-            ([prevnote number] == [lowestnote number]) ) {
+        mergeHeapSiftDown(heap, heapcount, 0);
+
+        MidiNoteData *prevnote = (resultnotes->count > 0) ?
+                                 &resultnotes->notes[resultnotes->count - 1] : NULL;
+        if ((prevnote != NULL) && (prevnote->starttime == lowestnote->starttime) &&
+            (prevnote->number == lowestnote->number) ) {
 
             /* Don't add duplicate notes, with the same start time and number */
-            if ([lowestnote duration] > [prevnote duration]) {
-                [prevnote setDuration:[lowestnote duration]];
+            if (lowestnote->duration > prevnote->duration) {
+                prevnote->duration = lowestnote->duration;
             }
         }
         else {
             [result addNote:lowestnote];
-            prevnote = lowestnote;
         }
     }
 
+    free(notelists);
+    free(noteindex);
+    free(heap);
     return result;
 }
 
@@ -1945,17 +2060,30 @@ int sortbytime(void* v1, void* v2) {
 }
 
 
-/** Check that the MidiNote start times are in increasing order.
+/** Return a copy of the given tracks.  The copies share the notes
+ *  until they are changed (see MidiTrack copyWithZone).
+ */
++(Array*)copyTracks:(Array*)tracks {
+    Array *result = [Array new:[tracks count]];
+    for (int tracknum = 0; tracknum < [tracks count]; tracknum++) {
+        MidiTrack *copy = [(MidiTrack*)[tracks get:tracknum] copy];
+        [result add:copy];
+        [copy release];
+    }
+    return result;
+}
+
+
+/** Check that the note start times are in increasing order.
  * This is for debugging purposes.
  */
 +(void)checkStartTimes:(Array*) tracks {
     for (int tracknum = 0; tracknum < [tracks count]; tracknum++) {
-        MidiTrack *track = [tracks get:tracknum];
+        const MidiNoteArray *notes = [(MidiTrack*)[tracks get:tracknum] readNotes];
         int prevtime = -1;
-        for (int j = 0; j < [[track notes] count]; j++) {
-            MidiNote *note = [[track notes] get:j];
-            assert([note startTime] >= prevtime);
-            prevtime = [note startTime];
+        for (int j = 0; j < notes->count; j++) {
+            assert(notes->notes[j].starttime >= prevtime);
+            prevtime = notes->notes[j].starttime;
         }
     }
 }
@@ -1975,56 +2103,63 @@ int sortbytime(void* v1, void* v2) {
  * So, this function is used to assign the same starttime for notes
  * that are close together (timewise).
  */
-+(void)roundStartTimes:(Array*)tracks toInterval:(int)millisec withTime:(MGTimeSignature*)time {
-    /* Get all the starttimes in all tracks, in sorted order */
-    int initsize = 1;
-    if ([tracks count] > 0) {
-        initsize = [[ (MidiTrack*)[tracks get:0] notes] count];
-        initsize = initsize * [tracks count]/2;
-    }
-    IntArray*  starttimes = [IntArray new:initsize];
-    for (int tracknum = 0; tracknum < [tracks count]; tracknum++) {
-        MidiTrack *track = [tracks get:tracknum];
-        for (int j = 0; j < [[track notes] count]; j++) {
-            MidiNote *note = [[track notes] get:j];
-            [starttimes add:[note startTime]];
-        }
-    }
-    [starttimes sort];
++(void)roundStartTimes:(Array*)tracks toInterval:(int)millisec
+             withTempoMap:(const MidiTempoMap*)map {
+    QuantizeOptions options;
+    quantizeOptionsInit(&options, millisec * 1000);
+    [MidiFile quantizeStartTimes:tracks withOptions:&options withTempoMap:map];
+}
 
-    /* Notes within "millisec" milliseconds apart should be combined */
-    int interval = [time quarter] * millisec * 1000 / [time tempo];
-
-    /* If two starttimes are within interval millisec, make them the same */
-    for (int i = 0; i < [starttimes count] - 1; i++) {
-        if ([starttimes get:(i+1)] - [starttimes get:i] <= interval) {
-            [starttimes set:[starttimes get:i] index:(i+1)];
-        }
-    }
 
+/** Combine the note start times that are close together, and
+ * optionally move them onto a grid (see Quantizer.h).  The start
+ * times of each track are copied out, quantized together in one pass
+ * over all the tracks, and copied back.
+ */
++(void)quantizeStartTimes:(Array*)tracks withOptions:(const QuantizeOptions*)options
+             withTempoMap:(const MidiTempoMap*)map {
     [MidiFile checkStartTimes:tracks];
 
-    /* Adjust the note starttimes, so that it matches one of the starttimes values */
-    for (int tracknum = 0; tracknum < [tracks count]; tracknum++) {
-        MidiTrack *track = [tracks get:tracknum];
-        int i = 0;
+    int numtracks = [tracks count];
+    int total = 0;
+    for (int tracknum = 0; tracknum < numtracks; tracknum++) {
+        total += [(MidiTrack*)[tracks get:tracknum] noteCount];
+    }
+    int *counts = (int*)malloc((numtracks + 1) * sizeof(int));
+    int **starttimes = (int**)malloc((numtracks + 1) * sizeof(int*));
+    int *buffer = (int*)malloc((total + 1) * sizeof(int));
 
-        for (int j = 0; j < [[track notes] count]; j++) {
-            MidiNote *note = [[track notes] get:j];
-            while (i < [starttimes count] &&
-                   [note startTime] - interval > [starttimes get:i]) {
-                i++;
-            }
+    int offset = 0;
+    for (int tracknum = 0; tracknum < numtracks; tracknum++) {
+        const MidiNoteArray *notes = [(MidiTrack*)[tracks get:tracknum] readNotes];
+        counts[tracknum] = notes->count;
+        starttimes[tracknum] = &buffer[offset];
+        for (int j = 0; j < counts[tracknum]; j++) {
+            starttimes[tracknum][j] = notes->notes[j].starttime;
+        }
+        offset += counts[tracknum];
+    }
 
-            if ([note startTime] > [starttimes get:i] &&
-                [note startTime] - [starttimes get:i] <= interval) {
+    quantizeStartTimes(starttimes, counts, numtracks, map, options);
 
-                [note setStarttime:[starttimes get:i]];
+    for (int tracknum = 0; tracknum < numtracks; tracknum++) {
+        MidiTrack *track = [tracks get:tracknum];
+        const MidiNoteArray *current = [track readNotes];
+        BOOL changed = NO;
+        for (int j = 0; j < counts[tracknum] && !changed; j++) {
+            changed = (current->notes[j].starttime != starttimes[tracknum][j]);
+        }
+        if (changed) {
+            MidiNoteArray *notes = [track notes];
+            for (int j = 0; j < counts[tracknum]; j++) {
+                notes->notes[j].starttime = starttimes[tracknum][j];
             }
+            noteArraySort(notes);
         }
-        [[track notes] sort:sortbytime];
     }
-    [starttimes release];
+    free(buffer);
+    free(starttimes);
+    free(counts);
 }
 
 
@@ -2034,26 +2169,22 @@ int sortbytime(void* v1, void* v2) {
  * look as nice.  Having nice looking sheet music is more important
  * than faithfully representing the Midi File data.
  *
- * Therefore, this function rounds the duration of MidiNotes up to
+ * Therefore, this function rounds the duration of the notes up to
  * the next note where possible.
  */
 +(void)roundDurations:(Array*)tracks withQuarter:(int) quarternote {
     for (int tracknum = 0; tracknum < [tracks count]; tracknum++) {
         MidiTrack *track = [tracks get:tracknum];
-        MidiNote *prevNote = nil;
-
-        for (int i = 0; i < [[track notes] count]; i++) {
-            MidiNote *note1 = [[track notes] get:i];
-
-            /* Get the next note that has a different start time */
-            MidiNote *note2 = note1;
-            for (int j = i+1; j < [[track notes] count]; j++) {
-                note2 = [[track notes] get:j];
-                if ([note1 startTime] < [note2 startTime]) {
-                    break;
-                }
-            }
-            int maxduration = [note2 startTime] - [note1 startTime];
+        MidiNoteArray *notes = [track notes];
+        MidiNoteData *prevNote = NULL;
+        OnsetIndex onsets;
+        [track buildOnsetIndex:&onsets];
+
+        for (int i = 0; i < notes->count; i++) {
+            MidiNoteData *note1 = &notes->notes[i];
+
+            /* The time until the next note that has a different start time */
+            int maxduration = onsetIndexTimeToNext(&onsets, i);
 
             int dur = 0;
             if (quarternote <= maxduration)
@@ -2066,51 +2197,52 @@ int sortbytime(void* v1, void* v2) {
                 dur = quarternote/4;
 
 
-            if (dur < [note1 duration]) {
-                dur = [note1 duration];
+            if (dur < note1->duration) {
+                dur = note1->duration;
             }
 
             /* Special case: If the previous note's duration
              * matches this note's duration, we can make a notepair.
              * So don't expand the duration in that case.
              */
-            if (prevNote != nil && [prevNote startTime] < [note1 startTime] &&
-                [prevNote duration] == [note1 duration] &&
-                ([note1 startTime] % quarternote != 0)) {
+            if (prevNote != NULL && prevNote->starttime < note1->starttime &&
+                prevNote->duration == note1->duration &&
+                (note1->starttime % quarternote != 0)) {
 
-                dur = [note1 duration];
+                dur = note1->duration;
             }
-            [note1 setDuration:dur];
+            note1->duration = dur;
             prevNote = note1;
         }
+        onsetIndexFree(&onsets);
     }
 }
 
 /** Split the given track into multiple tracks, separating each
  * channel into a separate track.
  */
-+(Array*) splitChannels:(MidiTrack*) origtrack withEvents:(Array*)events {
++(Array*) splitChannels:(MidiTrack*) origtrack withEvents:(MidiEventStore*)events {
 
     /* Find the instrument used for each channel */
     IntArray* channelInstruments = [IntArray new:16];
     for (int i =0; i < 16; i++) {
         [channelInstruments add:0];
     }
-    for (int i = 0; i < [events count]; i++) {
-        MidiEvent *mevent = [events get:i];
-        if ([mevent eventFlag] == EventProgramChange) {
-            [channelInstruments set:[mevent instrument] index:[mevent channel]];
+    for (int i = 0; i < events->count; i++) {
+        if (eventStoreFlag(events, i) == EventProgramChange) {
+            [channelInstruments set:events->data1[i] index:eventStoreChannel(events, i)];
         }
     }
     [channelInstruments set:128 index:9]; /* Channel 9 = Percussion */
 
     Array *result = [Array new:2];
-    for (int i = 0; i < [[origtrack notes] count]; i++) {
-        MidiNote *note = [[origtrack notes] get:i];
+    const MidiNoteArray *notes = [origtrack readNotes];
+    for (int i = 0; i < notes->count; i++) {
+        const MidiNoteData *note = &notes->notes[i];
         BOOL foundchannel = FALSE;
         for (int tracknum = 0; tracknum < [result count]; tracknum++) {
             MidiTrack *track = [result get:tracknum];
-            if ([note channel] == [(MidiNote*)[[track notes] get:0] channel]) {
+            if (note->channel == [track noteAt:0].channel) {
                 foundchannel = TRUE;
                 [track addNote:note];
             }
@@ -2118,7 +2250,7 @@ int sortbytime(void* v1, void* v2) {
         if (!foundchannel) {
             MidiTrack* track = [[MidiTrack alloc] initWithTrack:([result count] + 1)];
             [track addNote:note];
-            int instrument = [channelInstruments get:[note channel]];
+            int instrument = [channelInstruments get:note->channel];
             [track setInstrument:instrument];
             [result add:track];
             [track release];
@@ -2128,55 +2260,78 @@ int sortbytime(void* v1, void* v2) {
 }
 
 
-/** Guess the measure length.  We assume that the measure
- * length must be between 0.5 seconds and 4 seconds.
- * Take all the note start times that fall between 0.5 and 
- * 4 seconds, and return the starttimes.
+/** Guess the measure length and tempo, for files with no Time
+ *  Signature event.  Fill in at most max candidates, best first, and
+ *  return how many.  If tempo is not NULL, also fill in the guessed
+ *  beat (zeroed if there is none).  The onset histogram of each track
+ *  is autocorrelated in parallel, and the results are added.  See
+ *  MeterDetector.h.
  */
-- (IntArray*)guessMeasureLength {
-    IntArray *result = [IntArray new:30];
-
-    int pulses_per_second = (int) (1000000.0 / [timesig tempo] * [timesig quarter]);
-    int minmeasure = pulses_per_second / 2; /* The minimum measure length in pulses */
-    int maxmeasure = pulses_per_second * 4; /* The maximum measure length in pulses */
+- (int)guessMeter:(MeterCandidate*)candidates maxCount:(int)max tempo:(MeterTempo*)tempo {
+    int numtracks = [tracks count];
+    if (tempo != NULL) {
+        memset(tempo, 0, sizeof(MeterTempo));
+    }
+    if (numtracks == 0 || max <= 0) {
+        return 0;
+    }
 
-    /* Get the start time of the first note in the midi file. */
-    int firstnote = [timesig measure] * 5;
-    for (int tracknum = 0; tracknum < [tracks count]; tracknum++) {
+    /* Get the notes of each track, and the start time of the first note.
+     * readNotes may copy the notes, so do this before going parallel.
+     */
+    const MidiNoteArray **notelists = (const MidiNoteArray**)malloc(numtracks * sizeof(MidiNoteArray*));
+    int firstnote = -1;
+    for (int tracknum = 0; tracknum < numtracks; tracknum++) {
         MidiTrack *track = [tracks get:tracknum];
-        if (firstnote > [(MidiNote*)[[track notes] get:0] startTime] ) {
-            firstnote = [(MidiNote*)[[track notes] get:0] startTime];
+        notelists[tracknum] = [track readNotes];
+        if (notelists[tracknum]->count == 0)
+            continue;
+        int start = notelists[tracknum]->notes[0].starttime;
+        if (firstnote == -1 || firstnote > start) {
+            firstnote = start;
         }
     }
+    if (firstnote == -1) {
+        free(notelists);
+        return 0;
+    }
 
-    /* interval = 0.06 seconds, converted into pulses */
-    int interval = [timesig quarter] * 60000 / [timesig tempo];
-
-    for (int i = 0; i < [tracks count]; i++) {
-        MidiTrack *track = [tracks get:i];
-        int prevtime = 0;
+    long long origin = midiTempoMapMicros(&tempomap, firstnote);
+    int numlags = meterLagCount();
+    double *autocorr = (double*)calloc(numtracks * numlags, sizeof(double));
+    const MidiTempoMap *map = &tempomap;
 
-        for (int j = 0; j < [[track notes] count]; j++) {
-            MidiNote *note = [[track notes] get:j];
-            if ([note startTime] - prevtime <= interval)
-                continue;
+    dispatch_queue_t queue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+    dispatch_apply(numtracks, queue, ^(size_t tracknum) {
+        meterAutocorrelate(notelists[tracknum], map, origin, &autocorr[tracknum * numlags]);
+    });
 
-            prevtime = [note startTime];
-            int time_from_firstnote = [note startTime] - firstnote;
+    for (int tracknum = 1; tracknum < numtracks; tracknum++) {
+        for (int lag = 0; lag < numlags; lag++) {
+            autocorr[lag] += autocorr[tracknum * numlags + lag];
+        }
+    }
+    int count = meterRank(autocorr, &tempomap, firstnote, candidates, max);
+    if (tempo != NULL) {
+        meterTempo(autocorr, &tempomap, firstnote, count > 0 ? candidates[0].measure : 0, tempo);
+    }
 
-            /* Round the time down to a multiple of 4 */
-            time_from_firstnote = time_from_firstnote / 4 * 4;
-            if (time_from_firstnote < minmeasure)
-                continue;
-            if (time_from_firstnote > maxmeasure)
-                break;
+    free(autocorr);
+    free(notelists);
+    return count;
+}
 
-            if (![result contains:time_from_firstnote]) {
-                [result add:time_from_firstnote];
-            }
-        }
+/** Guess the measure length.  Return the likely measure lengths
+ *  (in pulses, between 0.5 and 4 seconds), the most likely first.
+ *  See guessMeter.
+ */
+- (IntArray*)guessMeasureLength {
+    MeterCandidate candidates[MeterMaxCandidates];
+    int count = [self guessMeter:candidates maxCount:MeterMaxCandidates tempo:NULL];
+    IntArray *result = [IntArray new:MeterMaxCandidates];
+    for (int i = 0; i < count; i++) {
+        [result add:candidates[i].measure];
     }
-    [result sort];
     return result;
 }
 
@@ -2372,6 +2527,3 @@ int main2(int argc, char **argv)
     printf("%s\n", out);
     return 0;
 }
-
-
-
@@ -0,0 +1,114 @@
+//
+//  MidiNoteArray.c
+//  MetroGnomeiPad
+//
+//  Copyright (c) 2012 Princeton University. All rights reserved.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "MidiNoteArray.h"
+
+#define InsertionSortLength  16   /** Runs shorter than this are insertion sorted */
+
+/** Create an empty array with room for capacity notes, and one owner.
+ *  Free it with noteArrayRelease().
+ */
+MidiNoteArray* noteArrayCreate(int capacity) {
+    if (capacity < 1)
+        capacity = 1;
+    MidiNoteArray *array = (MidiNoteArray*)malloc(sizeof(MidiNoteArray));
+    array->count = 0;
+    array->capacity = capacity;
+    array->refcount = 1;
+    array->notes = (MidiNoteData*)malloc(capacity * sizeof(MidiNoteData));
+    return array;
+}
+
+/** Add an owner to the array, and return it */
+MidiNoteArray* noteArrayRetain(MidiNoteArray *array) {
+    array->refcount++;
+    return array;
+}
+
+/** Remove an owner from the array.  Free it when there are none left */
+void noteArrayRelease(MidiNoteArray *array) {
+    if (array == NULL)
+        return;
+    if (--array->refcount > 0)
+        return;
+    free(array->notes);
+    free(array);
+}
+
+/** Make room for at least capacity notes */
+void noteArrayGrow(MidiNoteArray *array, int capacity) {
+    if (capacity <= array->capacity)
+        return;
+    array->notes = (MidiNoteData*)realloc(array->notes, capacity * sizeof(MidiNoteData));
+    array->capacity = capacity;
+}
+
+/** Return a new array (with one owner) with the notes of src */
+MidiNoteArray* noteArrayCopy(const MidiNoteArray *src) {
+    MidiNoteArray *dest = noteArrayCreate(src->count);
+    memcpy(dest->notes, src->notes, src->count * sizeof(MidiNoteData));
+    dest->count = src->count;
+    return dest;
+}
+
+int noteArrayIsSorted(const MidiNoteArray *array) {
+    for (int i = 1; i < array->count; i++) {
+        if (noteCompare(&array->notes[i-1], &array->notes[i]) > 0)
+            return 0;
+    }
+    return 1;
+}
+
+static void insertionSort(MidiNoteData *notes, int count) {
+    for (int i = 1; i < count; i++) {
+        MidiNoteData note = notes[i];
+        int j = i;
+        while (j > 0 && noteCompare(&notes[j-1], &note) > 0) {
+            notes[j] = notes[j-1];
+            j--;
+        }
+        notes[j] = note;
+    }
+}
+
+/** Sort notes[0..count) using the scratch space, which holds count notes */
+static void mergeSort(MidiNoteData *notes, MidiNoteData *scratch, int count) {
+    if (count < InsertionSortLength) {
+        insertionSort(notes, count);
+        return;
+    }
+    int half = count / 2;
+    mergeSort(notes, scratch, half);
+    mergeSort(notes + half, scratch, count - half);
+
+    /* The halves are already in order: nothing to merge */
+    if (noteCompare(&notes[half-1], &notes[half]) <= 0)
+        return;
+
+    memcpy(scratch, notes, half * sizeof(MidiNoteData));
+    int i = 0, j = half, k = 0;
+    while (i < half && j < count) {
+        if (noteCompare(&notes[j], &scratch[i]) < 0)
+            notes[k++] = notes[j++];
+        else
+            notes[k++] = scratch[i++];
+    }
+    while (i < half) {
+        notes[k++] = scratch[i++];
+    }
+}
+
+/** Sort the notes by start time, then number */
+void noteArraySort(MidiNoteArray *array) {
+    if (noteArrayIsSorted(array))
+        return;
+    MidiNoteData *scratch = (MidiNoteData*)malloc((array->count / 2 + 1) * sizeof(MidiNoteData));
+    mergeSort(array->notes, scratch, array->count);
+    free(scratch);
+}
@@ -0,0 +1,76 @@
+//
+//  MidiNoteArray.h
+//  MetroGnomeiPad
+//
+//  Copyright (c) 2012 Princeton University. All rights reserved.
+//
+
+#ifndef MetroGnomeiPad_MidiNoteArray_h
+#define MetroGnomeiPad_MidiNoteArray_h
+
+#include <sys/types.h>
+
+/* The MidiNoteArray holds the notes of a MidiTrack by value, in one
+ * contiguous block, with no object per note.  Copying a track is a
+ * single memcpy, and sorting compares the fields directly, with no
+ * message sends.
+ *
+ * Notes are sorted by start time, then by number.  The sort is a
+ * merge sort, so it is stable, and it returns at once if the notes
+ * are already sorted (the common case).
+ *
+ * The array is reference counted, so tracks can share their notes.
+ * A MidiTrack copy just retains the array, and the track makes its
+ * own copy the first time it changes a shared array (see MidiTrack
+ * notes).
+ */
+
+/** @struct MidiNoteData
+ * One note, 16 bytes.
+ */
+typedef struct _MidiNoteData {
+    int starttime;   /** The start time, in pulses */
+    int duration;    /** The duration, in pulses */
+    int channel;     /** The channel */
+    int number;      /** The note, from 0 to 127. Middle C is 60 */
+} MidiNoteData;
+
+/** @struct MidiNoteArray
+ * A growable, reference counted array of notes.
+ */
+typedef struct _MidiNoteArray {
+    int count;
+    int capacity;
+    int refcount;        /** The number of owners. Only change the array if it is 1 */
+    MidiNoteData *notes;
+} MidiNoteArray;
+
+MidiNoteArray* noteArrayCreate(int capacity);
+MidiNoteArray* noteArrayCopy(const MidiNoteArray *src);
+MidiNoteArray* noteArrayRetain(MidiNoteArray *array);
+void noteArrayRelease(MidiNoteArray *array);
+void noteArrayGrow(MidiNoteArray *array, int capacity);
+void noteArraySort(MidiNoteArray *array);
+int  noteArrayIsSorted(const MidiNoteArray *array);
+
+/** Add a note to the end of the array */
+static inline void noteArrayAdd(MidiNoteArray *array, const MidiNoteData *note) {
+    if (array->count == array->capacity) {
+        noteArrayGrow(array, array->capacity * 2);
+    }
+    array->notes[array->count++] = *note;
+}
+
+/** Return the end time of the note */
+static inline int noteEndTime(const MidiNoteData *note) {
+    return note->starttime + note->duration;
+}
+
+/** Compare two notes by start time, then number */
+static inline int noteCompare(const MidiNoteData *n1, const MidiNoteData *n2) {
+    if (n1->starttime != n2->starttime)
+        return (n1->starttime < n2->starttime) ? -1 : 1;
+    return (n1->number < n2->number) ? -1 : (n1->number > n2->number);
+}
+
+#endif
@@ -0,0 +1,109 @@
+//
+//  MidiSeekIndex.c
+//  MetroGnomeiPad
+//
+//  Copyright (c) 2012 Princeton University. All rights reserved.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "MidiSeekIndex.h"
+
+#ifndef EventNoteOff
+#define EventNoteOff           0x80
+#define EventNoteOn            0x90
+#endif
+
+/** Return true if event i of the track is a NoteOn or NoteOff, which
+ *  a seek drops.  Every other event is replayed.
+ */
+static inline int isNoteEvent(const MidiEventStore *events, int i) {
+    u_char eventflag = eventStoreFlag(events, i);
+    return eventflag == EventNoteOn || eventflag == EventNoteOff;
+}
+
+/** Build the seek index of the given tracks.  This is a single pass
+ *  over the events (plus a count of the non-note events, to size the
+ *  list).  Free the result with midiSeekIndexFree().
+ */
+MidiSeekIndex* midiSeekIndexBuild(const MidiEventStore *stores, int numtracks) {
+    MidiSeekIndex *index = (MidiSeekIndex*)malloc(sizeof(MidiSeekIndex));
+    index->numtracks = numtracks;
+    index->tracks = (MidiSeekTrack*)calloc(numtracks > 0 ? numtracks : 1, sizeof(MidiSeekTrack));
+
+    for (int tracknum = 0; tracknum < numtracks; tracknum++) {
+        const MidiEventStore *events = &stores[tracknum];
+        MidiSeekTrack *track = &index->tracks[tracknum];
+        track->count = events->count / MidiSeekInterval + 1;
+        track->checkpoints = (MidiSeekCheckpoint*)malloc(track->count * sizeof(MidiSeekCheckpoint));
+
+        int numcontrols = 0;
+        for (int i = 0; i < events->count; i++) {
+            numcontrols += !isNoteEvent(events, i);
+        }
+        track->controls = (int*)malloc((numcontrols > 0 ? numcontrols : 1) * sizeof(int));
+        track->numcontrols = 0;
+
+        for (int c = 0; c < track->count; c++) {
+            int first = c * MidiSeekInterval;
+            MidiSeekCheckpoint *checkpoint = &track->checkpoints[c];
+            checkpoint->index = first;
+            checkpoint->starttime = (first < events->count) ? events->starttime[first] : 0x7FFFFFFF;
+            checkpoint->numcontrols = track->numcontrols;
+
+            int last = first + MidiSeekInterval;
+            if (last > events->count)
+                last = events->count;
+            for (int i = first; i < last; i++) {
+                if (!isNoteEvent(events, i)) {
+                    track->controls[track->numcontrols++] = i;
+                }
+            }
+        }
+    }
+    return index;
+}
+
+void midiSeekIndexFree(MidiSeekIndex *index) {
+    if (index == NULL)
+        return;
+    for (int tracknum = 0; tracknum < index->numtracks; tracknum++) {
+        free(index->tracks[tracknum].checkpoints);
+        free(index->tracks[tracknum].controls);
+    }
+    free(index->tracks);
+    free(index);
+}
+
+/** Seek to the pause time in the given track.  Set numcontrols to the
+ *  number of non-note events before the pause time: they are the first
+ *  numcontrols entries of the track's controls[], in order.  Return
+ *  the index of the first event at or after the pause time (or the
+ *  event count, if there is none).
+ */
+int midiSeekTrack(const MidiSeekIndex *index, const MidiEventStore *events, int tracknum,
+                  int pausetime, int *numcontrols) {
+    const MidiSeekTrack *track = &index->tracks[tracknum];
+
+    /* Find the last checkpoint that starts before the pause time.
+     * Checkpoint 0 (the start of the track) always qualifies.
+     */
+    int low = 0, high = track->count - 1;
+    while (low < high) {
+        int mid = (low + high + 1) / 2;
+        if (track->checkpoints[mid].starttime < pausetime)
+            low = mid;
+        else
+            high = mid - 1;
+    }
+    const MidiSeekCheckpoint *checkpoint = &track->checkpoints[low];
+    int count = checkpoint->numcontrols;
+
+    int i = checkpoint->index;
+    while (i < events->count && events->starttime[i] < pausetime) {
+        count += !isNoteEvent(events, i);
+        i++;
+    }
+    *numcontrols = count;
+    return i;
+}
@@ -0,0 +1,69 @@
+//
+//  MidiSeekIndex.h
+//  MetroGnomeiPad
+//
+//  Copyright (c) 2012 Princeton University. All rights reserved.
+//
+
+#ifndef MetroGnomeiPad_MidiSeekIndex_h
+#define MetroGnomeiPad_MidiSeekIndex_h
+
+#include <sys/types.h>
+#include "MidiEventStore.h"
+
+/* The MidiSeekIndex makes starting playback in the middle of a song
+ * cheap.  To start at a pause time, the notes before it are dropped,
+ * but every other event before it (tempo, time signature, program,
+ * controller, pitch bend, pressure, Sysex and Meta events) is still
+ * sent, in order, at the start.  That is what sets up the instrument,
+ * controllers and synth state the player needs.  Replaying them in
+ * order, instead of summarizing them, keeps Sysex resets and RPN/NRPN
+ * Data Entry sequences intact.
+ *
+ * For each track, the index holds the positions of its non-note
+ * events, and a checkpoint every MidiSeekInterval events with the
+ * number of non-note events before it.  A seek is a binary search for
+ * the last checkpoint at or before the pause time, then a scan of at
+ * most MidiSeekInterval events from there.  The note events before
+ * the checkpoint are never read.
+ *
+ * The index refers to the events by position, so it must be rebuilt
+ * if events are added or removed.  Changing the note events (like
+ * transposing) doesn't affect it.
+ */
+
+#define MidiSeekInterval   1024   /** Events between checkpoints */
+
+/** @struct MidiSeekCheckpoint
+ * The position in a track before event (index).
+ */
+typedef struct _MidiSeekCheckpoint {
+    int starttime;                /** The start time of event (index) */
+    int index;                    /** The first event not included */
+    int numcontrols;              /** The number of non-note events before event (index) */
+} MidiSeekCheckpoint;
+
+/** @struct MidiSeekTrack
+ * The non-note events and checkpoints of one track, in time order.
+ */
+typedef struct _MidiSeekTrack {
+    int count;                    /** The number of checkpoints */
+    MidiSeekCheckpoint *checkpoints;
+    int numcontrols;              /** The number of non-note events */
+    int *controls;                /** The index of each non-note event */
+} MidiSeekTrack;
+
+/** @struct MidiSeekIndex
+ * The checkpoints of each track of a Midi file.
+ */
+typedef struct _MidiSeekIndex {
+    int numtracks;
+    MidiSeekTrack *tracks;
+} MidiSeekIndex;
+
+MidiSeekIndex* midiSeekIndexBuild(const MidiEventStore *stores, int numtracks);
+void midiSeekIndexFree(MidiSeekIndex *index);
+int  midiSeekTrack(const MidiSeekIndex *index, const MidiEventStore *events, int tracknum,
+                   int pausetime, int *numcontrols);
+
+#endif
@@ -0,0 +1,156 @@
+//
+//  MidiTempoMap.c
+//  MetroGnomeiPad
+//
+//  Copyright (c) 2012 Princeton University. All rights reserved.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "MidiTempoMap.h"
+
+#ifndef MetaEvent
+#define MetaEvent              0xFF
+#define MetaEventTempo         0x51
+#endif
+
+/** A Tempo event found while building the map */
+typedef struct _TempoEvent {
+    int pulse;
+    int order;   /** The order it was found in, to keep the sort stable */
+    int tempo;
+} TempoEvent;
+
+/** Sort TempoEvents by time.  At the same time, the later track wins */
+static int compareTempoEvents(const void *v1, const void *v2) {
+    const TempoEvent *t1 = (const TempoEvent*)v1;
+    const TempoEvent *t2 = (const TempoEvent*)v2;
+    if (t1->pulse != t2->pulse)
+        return (t1->pulse < t2->pulse) ? -1 : 1;
+    return (t1->order < t2->order) ? -1 : (t1->order > t2->order);
+}
+
+/** Return the index of the last change at or before the pulse */
+static inline int findChange(const MidiTempoMap *map, int pulse) {
+    int low = 0, high = map->count - 1;
+    while (low < high) {
+        int mid = (low + high + 1) / 2;
+        if (map->pulse[mid] <= pulse)
+            low = mid;
+        else
+            high = mid - 1;
+    }
+    return low;
+}
+
+/** Build the tempo map from the Tempo events of all the tracks.
+ *  Free it with midiTempoMapFree().
+ */
+void midiTempoMapBuild(MidiTempoMap *map, const MidiEventStore *stores, int numtracks,
+                       int quarternote) {
+    int numevents = 0;
+    for (int tracknum = 0; tracknum < numtracks; tracknum++) {
+        const MidiEventStore *events = &stores[tracknum];
+        for (int i = 0; i < events->count; i++) {
+            if (events->status[i] == MetaEvent && events->data1[i] == MetaEventTempo)
+                numevents++;
+        }
+    }
+    TempoEvent *tempos = (TempoEvent*)malloc((numevents + 1) * sizeof(TempoEvent));
+    int n = 0;
+    for (int tracknum = 0; tracknum < numtracks; tracknum++) {
+        const MidiEventStore *events = &stores[tracknum];
+        for (int i = 0; i < events->count; i++) {
+            if (events->status[i] == MetaEvent && events->data1[i] == MetaEventTempo) {
+                tempos[n].pulse = events->starttime[i];
+                tempos[n].order = n;
+                tempos[n].tempo = eventStoreTempo(events, i);
+                n++;
+            }
+        }
+    }
+    qsort(tempos, n, sizeof(TempoEvent), compareTempoEvents);
+
+    map->quarternote = (quarternote > 0) ? quarternote : 1;
+    map->pulse = (int*)malloc((n + 1) * sizeof(int));
+    map->tempo = (int*)malloc((n + 1) * sizeof(int));
+    map->elapsed = (long long*)malloc((n + 1) * sizeof(long long));
+    map->pulse[0] = 0;
+    map->tempo[0] = MidiDefaultTempo;
+    map->elapsed[0] = 0;
+    map->count = 1;
+
+    for (int i = 0; i < n; i++) {
+        int last = map->count - 1;
+        if (tempos[i].tempo <= 0) {
+            continue;
+        }
+        if (tempos[i].pulse <= map->pulse[last]) {
+            map->tempo[last] = tempos[i].tempo;
+        }
+        else if (tempos[i].tempo != map->tempo[last]) {
+            map->pulse[map->count] = tempos[i].pulse;
+            map->tempo[map->count] = tempos[i].tempo;
+            map->elapsed[map->count] = map->elapsed[last] +
+                (long long)(tempos[i].pulse - map->pulse[last]) * map->tempo[last];
+            map->count++;
+        }
+    }
+    free(tempos);
+}
+
+void midiTempoMapFree(MidiTempoMap *map) {
+    free(map->pulse);
+    free(map->tempo);
+    free(map->elapsed);
+    memset(map, 0, sizeof(MidiTempoMap));
+}
+
+/** Return the tempo in effect at the given pulse */
+int midiTempoMapTempo(const MidiTempoMap *map, int pulse) {
+    return map->tempo[findChange(map, pulse)];
+}
+
+/** Return the time of the given pulse, in microseconds */
+long long midiTempoMapMicros(const MidiTempoMap *map, int pulse) {
+    int i = findChange(map, pulse);
+    return (map->elapsed[i] + (long long)(pulse - map->pulse[i]) * map->tempo[i]) / map->quarternote;
+}
+
+/** Return the pulse at the given time in microseconds, rounded to the
+ *  nearest pulse.  So midiTempoMapPulse(midiTempoMapMicros(p)) is p.
+ */
+int midiTempoMapPulse(const MidiTempoMap *map, long long micros) {
+    long long elapsed = micros * map->quarternote;
+    int low = 0, high = map->count - 1;
+    while (low < high) {
+        int mid = (low + high + 1) / 2;
+        if (map->elapsed[mid] <= elapsed)
+            low = mid;
+        else
+            high = mid - 1;
+    }
+    return map->pulse[low] +
+           (int)((elapsed - map->elapsed[low] + map->tempo[low] / 2) / map->tempo[low]);
+}
+
+/** Convert an array of pulses to microseconds.  If the pulses are in
+ *  increasing order (like note start times), this is a single pass
+ *  over the pulses and the tempo changes.  Otherwise each out of order
+ *  pulse costs a binary search.
+ */
+void midiTempoMapMicrosArray(const MidiTempoMap *map, const int *pulses,
+                             long long *micros, int count) {
+    int c = 0;
+    for (int i = 0; i < count; i++) {
+        int pulse = pulses[i];
+        if (pulse < map->pulse[c]) {
+            c = findChange(map, pulse);
+        }
+        while (c + 1 < map->count && map->pulse[c + 1] <= pulse) {
+            c++;
+        }
+        micros[i] = (map->elapsed[c] + (long long)(pulse - map->pulse[c]) * map->tempo[c]) /
+                    map->quarternote;
+    }
+}
@@ -0,0 +1,46 @@
+//
+//  MidiTempoMap.h
+//  MetroGnomeiPad
+//
+//  Copyright (c) 2012 Princeton University. All rights reserved.
+//
+
+#ifndef MetroGnomeiPad_MidiTempoMap_h
+#define MetroGnomeiPad_MidiTempoMap_h
+
+#include <sys/types.h>
+#include "MidiEventStore.h"
+
+/* The MidiTempoMap converts between pulses and real time, for songs
+ * that change tempo.  It holds every tempo change of the file, in
+ * time order, and the elapsed time at each change.  A conversion is a
+ * binary search for the tempo in effect, plus one multiply.
+ *
+ * The elapsed times are kept in microseconds * quarternote, so they
+ * are exact: converting many times never accumulates rounding error.
+ */
+
+#define MidiDefaultTempo  500000   /** The tempo before the first Tempo event (120 bpm) */
+
+/** @struct MidiTempoMap
+ * Change i sets the tempo to tempo[i] at pulse[i].  Change 0 is
+ * always at pulse 0.
+ */
+typedef struct _MidiTempoMap {
+    int count;             /** The number of tempo changes (at least 1) */
+    int quarternote;       /** The number of pulses per quarter note */
+    int *pulse;            /** The time of each change, in pulses */
+    int *tempo;            /** The new tempo, in microseconds per quarter note */
+    long long *elapsed;    /** The time at pulse[i], in microseconds * quarternote */
+} MidiTempoMap;
+
+void midiTempoMapBuild(MidiTempoMap *map, const MidiEventStore *stores, int numtracks,
+                       int quarternote);
+void midiTempoMapFree(MidiTempoMap *map);
+int  midiTempoMapTempo(const MidiTempoMap *map, int pulse);
+long long midiTempoMapMicros(const MidiTempoMap *map, int pulse);
+int  midiTempoMapPulse(const MidiTempoMap *map, long long micros);
+void midiTempoMapMicrosArray(const MidiTempoMap *map, const int *pulses,
+                             long long *micros, int count);
+
+#endif
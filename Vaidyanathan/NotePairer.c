@@ -0,0 +1,119 @@
+//
+//  NotePairer.c
+//  MetroGnomeiPad
+//
+//  Copyright (c) 2012 Princeton University. All rights reserved.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "NotePairer.h"
+
+/** Return the open list index for the given channel and note number */
+static inline int pairerKey(int channel, int number) {
+    return ((channel & 0x0F) << 7) | (number & 0x7F);
+}
+
+/** Remove note i from the open list of its key, and end it */
+static void pairerClose(NotePairer *pairer, int i, int endtime) {
+    PairedNote *note = &pairer->notes[i];
+    int key = pairerKey(note->channel, note->number);
+    if (note->older >= 0)
+        pairer->notes[note->older].newer = note->newer;
+    else
+        pairer->oldest[key] = note->newer;
+    if (note->newer >= 0)
+        pairer->notes[note->newer].older = note->older;
+    else
+        pairer->newest[key] = note->older;
+
+    note->older = note->newer = -1;
+    note->open = 0;
+    note->duration = endtime - note->starttime;
+}
+
+/** Initialize an empty pairer with the given policies */
+void notePairerInit(NotePairer *pairer, int overlap, int dangling, int capacity) {
+    pairer->overlap = overlap;
+    pairer->dangling = dangling;
+    pairer->count = 0;
+    pairer->capacity = (capacity > 0) ? capacity : 16;
+    pairer->notes = (PairedNote*)malloc(pairer->capacity * sizeof(PairedNote));
+    memset(pairer->newest, 0xFF, sizeof(pairer->newest));
+    memset(pairer->oldest, 0xFF, sizeof(pairer->oldest));
+}
+
+/** Free the notes of the pairer */
+void notePairerFree(NotePairer *pairer) {
+    free(pairer->notes);
+    pairer->notes = NULL;
+    pairer->count = pairer->capacity = 0;
+}
+
+/** A NoteOn event (with velocity > 0) occurred.  Add a new open note,
+ *  and return its index.
+ */
+int notePairerNoteOn(NotePairer *pairer, int channel, int number, int velocity,
+                     int starttime, int tag) {
+    int key = pairerKey(channel, number);
+    if (pairer->overlap == NoteOverlapRetrigger) {
+        while (pairer->newest[key] >= 0) {
+            pairerClose(pairer, pairer->newest[key], starttime);
+        }
+    }
+    if (pairer->count == pairer->capacity) {
+        pairer->capacity *= 2;
+        pairer->notes = (PairedNote*)realloc(pairer->notes,
+                                             pairer->capacity * sizeof(PairedNote));
+    }
+    int i = pairer->count++;
+    PairedNote *note = &pairer->notes[i];
+    note->starttime = starttime;
+    note->duration = 0;
+    note->tag = tag;
+    note->channel = (u_char)(channel & 0x0F);
+    note->number = (u_char)(number & 0x7F);
+    note->velocity = (u_char)velocity;
+    note->open = 1;
+    note->dropped = 0;
+
+    /* Append to the newer end of the key's open list */
+    note->newer = -1;
+    note->older = pairer->newest[key];
+    if (note->older >= 0)
+        pairer->notes[note->older].newer = i;
+    else
+        pairer->oldest[key] = i;
+    pairer->newest[key] = i;
+    return i;
+}
+
+/** A NoteOff event (or NoteOn with velocity 0) occurred.  End the
+ *  matching open note, if any.
+ */
+void notePairerNoteOff(NotePairer *pairer, int channel, int number, int endtime) {
+    int key = pairerKey(channel, number);
+    int i = (pairer->overlap == NoteOverlapFirstOpened) ?
+            pairer->oldest[key] : pairer->newest[key];
+    if (i >= 0) {
+        pairerClose(pairer, i, endtime);
+    }
+}
+
+/** The track ended at the given time.  Apply the dangling policy to
+ *  the notes that are still open.
+ */
+void notePairerFinish(NotePairer *pairer, int endtime) {
+    for (int key = 0; key < NotePairerKeys; key++) {
+        while (pairer->newest[key] >= 0) {
+            int i = pairer->newest[key];
+            pairerClose(pairer, i, endtime);
+            if (pairer->dangling == NoteDanglingKeep) {
+                pairer->notes[i].duration = 0;
+            }
+            else if (pairer->dangling == NoteDanglingDrop) {
+                pairer->notes[i].dropped = 1;
+            }
+        }
+    }
+}
@@ -0,0 +1,69 @@
+//
+//  NotePairer.h
+//  MetroGnomeiPad
+//
+//  Copyright (c) 2012 Princeton University. All rights reserved.
+//
+
+#ifndef MetroGnomeiPad_NotePairer_h
+#define MetroGnomeiPad_NotePairer_h
+
+#include <sys/types.h>
+
+/* The NotePairer matches NoteOff events (and NoteOn events with
+ * velocity 0) to the NoteOn events that started them.  It keeps a
+ * list of the open notes of each (channel, key), so each NoteOn and
+ * NoteOff costs O(1), no matter how many notes are open.
+ *
+ * It is used by MidiTrack and MGPart to build their notes.
+ */
+
+/* What a NoteOff does when several notes on the same key are open */
+#define NoteOverlapLastOpened   0   /** End the most recent note (default) */
+#define NoteOverlapFirstOpened  1   /** End the oldest note */
+#define NoteOverlapRetrigger    2   /** A NoteOn ends any open note on its key */
+
+/* What to do with the notes still open at the end of the track */
+#define NoteDanglingKeep        0   /** Leave their duration at 0 (default) */
+#define NoteDanglingEndOfTrack  1   /** End them at the end of the track */
+#define NoteDanglingDrop        2   /** Mark them as dropped */
+
+#define NotePairerKeys  (16 * 128)  /* One list per (channel, key) */
+
+/** @struct PairedNote
+ * A note found by the NotePairer.
+ */
+typedef struct _PairedNote {
+    int starttime;     /** The start time, in pulses */
+    int duration;      /** The duration, in pulses.  0 while open */
+    int tag;           /** The caller's id for the note (e.g. the event index) */
+    u_char channel;    /** The channel */
+    u_char number;     /** The note number, from 0 to 127 */
+    u_char velocity;   /** The NoteOn velocity */
+    u_char open;       /** True until the note is ended */
+    u_char dropped;    /** True if the note was dropped by NoteDanglingDrop */
+    int older;         /** The next older open note with the same key, or -1 */
+    int newer;         /** The next newer open note with the same key, or -1 */
+} PairedNote;
+
+/** @struct NotePairer
+ * The notes found so far, in NoteOn order, and the open note lists.
+ */
+typedef struct _NotePairer {
+    int overlap;                    /** NoteOverlapLastOpened, etc */
+    int dangling;                   /** NoteDanglingKeep, etc */
+    PairedNote *notes;              /** The notes, in NoteOn order */
+    int count;                      /** The number of notes */
+    int capacity;                   /** The allocated length of notes */
+    int newest[NotePairerKeys];     /** The newest open note of each key, or -1 */
+    int oldest[NotePairerKeys];     /** The oldest open note of each key, or -1 */
+} NotePairer;
+
+void notePairerInit(NotePairer *pairer, int overlap, int dangling, int capacity);
+void notePairerFree(NotePairer *pairer);
+int  notePairerNoteOn(NotePairer *pairer, int channel, int number, int velocity,
+                      int starttime, int tag);
+void notePairerNoteOff(NotePairer *pairer, int channel, int number, int endtime);
+void notePairerFinish(NotePairer *pairer, int endtime);
+
+#endif
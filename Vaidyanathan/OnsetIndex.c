@@ -0,0 +1,45 @@
+//
+//  OnsetIndex.c
+//  MetroGnomeiPad
+//
+//  Copyright (c) 2012 Princeton University. All rights reserved.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "OnsetIndex.h"
+
+/** Build the onset index of the given start times, in increasing
+ *  order.  The first backward pass counts the onsets, and the second
+ *  fills them in.  Free the index with onsetIndexFree().
+ */
+void onsetIndexBuild(OnsetIndex *index, const int *starttimes, int count) {
+    index->count = count;
+    index->onset = (int*)malloc((count + 1) * sizeof(int));
+
+    /* Number the onsets from the end: the last onset is 0 */
+    int fromend = -1;
+    for (int i = count - 1; i >= 0; i--) {
+        if (i == count - 1 || starttimes[i] != starttimes[i + 1]) {
+            fromend++;
+        }
+        index->onset[i] = fromend;
+    }
+    index->numonsets = fromend + 1;
+    index->onsettime = (int*)malloc((index->numonsets + 1) * sizeof(int));
+    index->firstnote = (int*)malloc((index->numonsets + 1) * sizeof(int));
+    for (int i = count - 1; i >= 0; i--) {
+        int k = index->numonsets - 1 - index->onset[i];
+        index->onset[i] = k;
+        index->onsettime[k] = starttimes[i];
+        index->firstnote[k] = i;
+    }
+    index->firstnote[index->numonsets] = count;
+}
+
+void onsetIndexFree(OnsetIndex *index) {
+    free(index->onset);
+    free(index->onsettime);
+    free(index->firstnote);
+    memset(index, 0, sizeof(OnsetIndex));
+}
@@ -0,0 +1,57 @@
+//
+//  OnsetIndex.h
+//  MetroGnomeiPad
+//
+//  Copyright (c) 2012 Princeton University. All rights reserved.
+//
+
+#ifndef MetroGnomeiPad_OnsetIndex_h
+#define MetroGnomeiPad_OnsetIndex_h
+
+#include <sys/types.h>
+
+/* The OnsetIndex groups the notes of a track by start time (onset).
+ * Notes that start together, like the notes of a chord, share one
+ * onset.  It answers "when does the next note after this one start?"
+ * in O(1), so stages like roundDurations don't have to search past
+ * every note of a chord for each note of the chord.
+ *
+ * It is built in linear time, by passes backward over the start times,
+ * which must be in increasing order, as the notes of a MidiTrack are.
+ */
+
+/** @struct OnsetIndex
+ * Note i starts at onset onset[i].  Onset k starts at onsettime[k],
+ * and its first note is firstnote[k].  firstnote[numonsets] is the
+ * number of notes, so the notes of onset k are firstnote[k] up to
+ * firstnote[k+1].
+ */
+typedef struct _OnsetIndex {
+    int count;          /** The number of notes */
+    int numonsets;      /** The number of distinct start times */
+    int *onset;         /** The onset of each note */
+    int *onsettime;     /** The start time of each onset */
+    int *firstnote;     /** The first note of each onset */
+} OnsetIndex;
+
+void onsetIndexBuild(OnsetIndex *index, const int *starttimes, int count);
+void onsetIndexFree(OnsetIndex *index);
+
+/** Return the index of the first note that starts after note i, or
+ *  the number of notes if there is none.
+ */
+static inline int onsetIndexNextNote(const OnsetIndex *index, int i) {
+    return index->firstnote[index->onset[i] + 1];
+}
+
+/** Return the time from the start of note i to the next onset, or 0
+ *  if no note starts after it.
+ */
+static inline int onsetIndexTimeToNext(const OnsetIndex *index, int i) {
+    int k = index->onset[i];
+    if (k + 1 >= index->numonsets)
+        return 0;
+    return index->onsettime[k + 1] - index->onsettime[k];
+}
+
+#endif
@@ -45,9 +45,26 @@ struct _SheetMusicOptions {
     id key;                  /** Use the given KeySignature */
     MGTimeSignature *time;   /** Use the given time signature */
     int combineInterval;     /** Combine notes within given time interval (msec) */
+    int quantizeGrid;        /** Move chords onto a grid (QuantizeGridNone, etc, see Quantizer.h) */
+    int quantizeDivision;    /** Grid steps per quarter note */
+    int quantizeSwing;       /** For a swing grid, percent of each step pair for the first step */
+    int maxDrift;            /** Don't move notes onto the grid by more than this (msec, 0 = no limit) */
 };
 typedef struct _SheetMusicOptions SheetMusicOptions;
 
+/** @struct MidiLoadOptions
+ * The MidiLoadOptions contain the events to keep when parsing a midi
+ * file.  The other events are skipped over without being stored.
+ */
+struct _MidiLoadOptions {
+    int eventclasses;  /** The event classes to keep (MidiEventClassAll, etc, see MidiDecoder.h) */
+    int channels;      /** The channels to keep (bit i = channel i) */
+    IntArray *tracks;  /** Which tracks to keep (true = keep), or nil for all tracks */
+    int overlap;       /** How to pair overlapping notes on one key (NoteOverlapLastOpened, etc, see NotePairer.h) */
+    int dangling;      /** What to do with notes never turned off (NoteDanglingKeep, etc) */
+};
+typedef struct _MidiLoadOptions MidiLoadOptions;
+
 
     
     
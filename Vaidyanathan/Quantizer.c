@@ -0,0 +1,159 @@
+//
+//  Quantizer.c
+//  MetroGnomeiPad
+//
+//  Copyright (c) 2012 Princeton University. All rights reserved.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "Quantizer.h"
+
+/** The next start time of one track, in the merge heap */
+typedef struct _QuantizeCursor {
+    int starttime;
+    int tracknum;
+} QuantizeCursor;
+
+/** Return true if cursor a comes before b: by time, then track */
+static inline int cursorBefore(const QuantizeCursor *a, const QuantizeCursor *b) {
+    if (a->starttime != b->starttime)
+        return a->starttime < b->starttime;
+    return a->tracknum < b->tracknum;
+}
+
+/** Move the cursor at index i down the heap to its place */
+static void cursorSiftDown(QuantizeCursor *heap, int count, int i) {
+    QuantizeCursor cursor = heap[i];
+    while (1) {
+        int child = 2*i + 1;
+        if (child >= count)
+            break;
+        if (child + 1 < count && cursorBefore(&heap[child+1], &heap[child]))
+            child++;
+        if (!cursorBefore(&heap[child], &cursor))
+            break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = cursor;
+}
+
+void quantizeOptionsInit(QuantizeOptions *options, int interval) {
+    memset(options, 0, sizeof(QuantizeOptions));
+    options->interval = interval;
+    options->grid = QuantizeGridNone;
+}
+
+/** Return the grid point nearest the given pulse.  The grid is made
+ *  of pairs of steps: each pair is pairnum/pairden pulses long, and
+ *  its second step starts swing percent into the pair.
+ */
+int quantizeGridPoint(const QuantizeOptions *options, int pulse) {
+    if (options->grid == QuantizeGridNone || options->quarternote <= 0 || options->division <= 0) {
+        return pulse;
+    }
+    long long pairnum = 2LL * options->quarternote;
+    long long pairden = options->division;
+    int swing = 50;
+    if (options->grid == QuantizeGridTriplet) {
+        pairnum = 4LL * options->quarternote;
+        pairden = 3LL * options->division;
+    }
+    else if (options->grid == QuantizeGridSwing) {
+        swing = (options->swing > 0 && options->swing < 100) ? options->swing : QuantizeDefaultSwing;
+    }
+
+    /* The pair containing the pulse, and its three grid points */
+    long long pair = (long long)pulse * pairden / pairnum;
+    if ((long long)pulse * pairden < pair * pairnum)
+        pair--;
+    long long points[3];
+    points[0] = pair * pairnum / pairden;
+    points[1] = (pair * 100 + swing) * pairnum / (pairden * 100);
+    points[2] = (pair + 1) * pairnum / pairden;
+
+    long long best = points[0];
+    for (int p = 1; p < 3; p++) {
+        long long diff = points[p] - pulse, bestdiff = best - pulse;
+        if ((diff < 0 ? -diff : diff) < (bestdiff < 0 ? -bestdiff : bestdiff))
+            best = points[p];
+    }
+    return (int)best;
+}
+
+/** Return the start time for a group that begins at the given pulse */
+static int groupStartTime(const MidiTempoMap *map, const QuantizeOptions *options,
+                          int pulse, long long micros) {
+    int gridpoint = quantizeGridPoint(options, pulse);
+    if (gridpoint == pulse) {
+        return pulse;
+    }
+    if (options->maxdrift > 0) {
+        long long drift = midiTempoMapMicros(map, gridpoint) - micros;
+        if (drift > options->maxdrift || -drift > options->maxdrift) {
+            return pulse;
+        }
+    }
+    return gridpoint;
+}
+
+/** Quantize the start times of the given tracks, in place.  Each
+ *  track's start times must be in increasing order.  The tracks are
+ *  merged with a heap, so this costs O(n log tracks).
+ */
+void quantizeStartTimes(int **starttimes, const int *counts, int numtracks,
+                        const MidiTempoMap *map, const QuantizeOptions *options) {
+    QuantizeCursor *heap = (QuantizeCursor*)malloc((numtracks + 1) * sizeof(QuantizeCursor));
+    int *next = (int*)calloc(numtracks + 1, sizeof(int));
+    int heapcount = 0;
+    for (int tracknum = 0; tracknum < numtracks; tracknum++) {
+        if (counts[tracknum] > 0) {
+            heap[heapcount].starttime = starttimes[tracknum][0];
+            heap[heapcount].tracknum = tracknum;
+            heapcount++;
+        }
+    }
+    for (int i = heapcount/2 - 1; i >= 0; i--) {
+        cursorSiftDown(heap, heapcount, i);
+    }
+
+    /* The group's first start time (in pulses and microseconds), and
+     * where its notes go.  The tempo map is walked forward, as in
+     * midiTempoMapMicrosArray, since the start times come in order.
+     */
+    int groupPulse = 0;
+    long long groupMicros = 0;
+    int groupTarget = 0;
+    int havegroup = 0;
+    int change = 0;
+    while (heapcount > 0) {
+        int tracknum = heap[0].tracknum;
+        int pulse = heap[0].starttime;
+        int i = next[tracknum]++;
+        if (next[tracknum] < counts[tracknum]) {
+            heap[0].starttime = starttimes[tracknum][next[tracknum]];
+        }
+        else {
+            heap[0] = heap[--heapcount];
+        }
+        cursorSiftDown(heap, heapcount, 0);
+
+        while (change + 1 < map->count && map->pulse[change + 1] <= pulse) {
+            change++;
+        }
+        long long micros = pulse < map->pulse[change] ? midiTempoMapMicros(map, pulse) :
+            (map->elapsed[change] + (long long)(pulse - map->pulse[change]) * map->tempo[change]) /
+            map->quarternote;
+
+        if (!havegroup || micros - groupMicros > options->interval) {
+            groupPulse = pulse;
+            groupMicros = micros;
+            groupTarget = groupStartTime(map, options, groupPulse, groupMicros);
+            havegroup = 1;
+        }
+        starttimes[tracknum][i] = groupTarget;
+    }
+    free(heap);
+    free(next);
+}
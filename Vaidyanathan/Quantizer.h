@@ -0,0 +1,65 @@
+//
+//  Quantizer.h
+//  MetroGnomeiPad
+//
+//  Copyright (c) 2012 Princeton University. All rights reserved.
+//
+
+#ifndef MetroGnomeiPad_Quantizer_h
+#define MetroGnomeiPad_Quantizer_h
+
+#include <sys/types.h>
+#include "MidiTempoMap.h"
+
+/* The Quantizer moves note start times that are close together onto
+ * one start time, so they are drawn as a single chord.  It is what
+ * MidiFile roundStartTimes uses.
+ *
+ * The start times of all the tracks are merged in one pass (each track
+ * is already sorted).  A start time more than the interval after the
+ * first start time of the current group begins a new group.  So a
+ * note never moves by more than the interval, no matter how many notes
+ * are in the group.  Every note in a group moves to the group's first
+ * start time.
+ *
+ * With a grid, each group's start time is moved to the nearest grid
+ * point instead, unless that is more than maxdrift away.  The grid has
+ * pairs of steps, so it can swing:
+ *
+ *   QuantizeGridStraight - division steps per quarter note
+ *   QuantizeGridTriplet  - 3/2 * division steps per quarter note
+ *   QuantizeGridSwing    - division steps per quarter note, where the
+ *                          first step of each pair takes swing percent
+ *                          of the pair (66 is triplet swing)
+ *
+ * The interval and maxdrift are in microseconds, converted with the
+ * tempo map, so they hold in every tempo.
+ */
+
+#define QuantizeGridNone      0
+#define QuantizeGridStraight  1
+#define QuantizeGridTriplet   2
+#define QuantizeGridSwing     3
+
+#define QuantizeDefaultSwing  66
+
+/** @struct QuantizeOptions
+ * How to quantize.  Start from quantizeOptionsInit(), which only
+ * combines start times within the given interval.
+ */
+typedef struct _QuantizeOptions {
+    int interval;      /** Combine start times within this many microseconds */
+    int grid;          /** QuantizeGridNone, QuantizeGridStraight, etc */
+    int quarternote;   /** Pulses per quarter note, for the grid */
+    int division;      /** Grid steps per quarter note (e.g. 4 for 16th notes) */
+    int swing;         /** For QuantizeGridSwing, percent of each pair for the first step */
+    int maxdrift;      /** Don't move a start time to the grid by more than this
+                        *  many microseconds.  0 for no limit */
+} QuantizeOptions;
+
+void quantizeOptionsInit(QuantizeOptions *options, int interval);
+int  quantizeGridPoint(const QuantizeOptions *options, int pulse);
+void quantizeStartTimes(int **starttimes, const int *counts, int numtracks,
+                        const MidiTempoMap *map, const QuantizeOptions *options);
+
+#endif